@@ -0,0 +1,524 @@
+/*******************************************************************************
+*   File Name: binaryCmd.c
+*
+* Description: Binary framed command/response protocol.  Runs alongside the
+*              text console: the "bin" command switches the serial port over
+*              and BIN_CMD_EXIT switches it back.  See binaryCmd.h for the
+*              packet layout.
+*******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include <util/crc16.h>
+#include "binaryCmd.h"
+#include "uart.h"
+#include "twi_utils.h"
+#include "humiditySensor.h"
+#include "muxPCA9546.h"
+#include "telemetry.h"
+#include "console.h"
+
+
+// receive state, encoded bytes collected up to the 0x00 delimiter
+static uint8_t  rxFrame[BIN_MAX_FRAME];
+static uint8_t  rxLen;
+static uint8_t  rxOverflow;         // frame too long, discard to delimiter
+static uint8_t  binActive;
+
+
+/******************************************************************************
+*                                COBS ENCODE                                  *
+*******************************************************************************
+* Description: Consistent overhead byte stuffing.  The output has no zero
+*              bytes and is at most len + len / 254 + 1 bytes long, 257 for
+*              the longest input.  The 0x00 delimiter is not added.
+*
+*   Arguments: src - data to encode
+*              len - number of bytes in src
+*              dst - encoded data goes here, must not overlap src
+*
+*      Return: number of encoded bytes
+******************************************************************************/
+uint16_t cobs_encode(const uint8_t *src, uint8_t len, uint8_t *dst)
+{
+    uint16_t code_idx = 0;
+    uint8_t  code     = 1;
+    uint16_t out      = 1;
+    uint8_t  i;
+
+    for(i = 0; i < len; i++)
+    {
+        if(src[i] == 0)
+        {
+            dst[code_idx] = code;
+            code_idx      = out++;
+            code          = 1;
+        }
+        else
+        {
+            dst[out++] = src[i];
+            if(++code == 0xFF)
+            {
+                dst[code_idx] = code;
+                code_idx      = out++;
+                code          = 1;
+            }
+        }
+    }
+    dst[code_idx] = code;
+
+    return out;
+}
+
+
+/******************************************************************************
+*                                COBS DECODE                                  *
+*******************************************************************************
+* Description: Reverse of cobs_encode().  May decode in place (dst == src),
+*              the output never gets ahead of the input.
+*
+*   Arguments: src - encoded data, without the 0x00 delimiter
+*              len - number of bytes in src
+*              dst - decoded data goes here
+*
+*      Return: number of decoded bytes, -1 if the encoding is invalid
+******************************************************************************/
+int16_t cobs_decode(const uint8_t *src, uint16_t len, uint8_t *dst)
+{
+    uint16_t i   = 0;
+    uint16_t out = 0;
+    uint8_t  code;
+    uint8_t  j;
+
+    while(i < len)
+    {
+        code = src[i++];
+        if(code == 0)
+        {
+            return -1;
+        }
+
+        for(j = 1; j < code; j++)
+        {
+            if(i >= len)
+            {
+                return -1;
+            }
+            dst[out++] = src[i++];
+        }
+
+        if(code != 0xFF && i < len)
+        {
+            dst[out++] = 0;
+        }
+    }
+    return out;
+}
+
+
+/******************************************************************************
+*                                  CALC CRC                                   *
+*******************************************************************************
+* Description: CRC-16/XMODEM
+*
+*   Arguments: buf - data
+*              len - number of bytes
+*
+*      Return: crc
+******************************************************************************/
+static uint16_t binCrc(const uint8_t *buf, uint8_t len)
+{
+    uint16_t crc = 0;
+
+    while(len--)
+    {
+        crc = _crc_xmodem_update(crc, *buf++);
+    }
+    return crc;
+}
+
+
+/******************************************************************************
+*                                SEND PACKET                                  *
+*******************************************************************************
+* Description: Build, encode and queue one packet.  Blocks if the transmit
+*              ring is full.
+*
+*   Arguments: cmd  - command, response or event ID
+*              seq  - sequence number
+*              data - packet data, may be NULL if len is 0
+*              len  - number of data bytes
+*
+*      Return: None
+******************************************************************************/
+void binarySendPacket(uint8_t cmd, uint8_t seq, const uint8_t *data, uint8_t len)
+{
+    uint8_t  pkt[BIN_MAX_PAYLOAD];
+    uint8_t  frame[BIN_MAX_FRAME];
+    uint8_t  pkt_len;
+    uint8_t  frame_len;
+    uint8_t  i;
+    uint16_t crc;
+
+    if(len > BIN_MAX_PAYLOAD - BIN_HDR_LEN - BIN_CRC_LEN)
+    {
+        len = BIN_MAX_PAYLOAD - BIN_HDR_LEN - BIN_CRC_LEN;
+    }
+
+    pkt[0] = cmd;
+    pkt[1] = seq;
+    memcpy(&pkt[BIN_HDR_LEN], data, len);
+    pkt_len = BIN_HDR_LEN + len;
+
+    crc = binCrc(pkt, pkt_len);
+    pkt[pkt_len++] = crc & 0xFF;
+    pkt[pkt_len++] = crc >> 8;
+
+    frame_len = cobs_encode(pkt, pkt_len, frame);
+    for(i = 0; i < frame_len; i++)
+    {
+        uart_tx_queue(frame[i], UART_TX_BLOCK);
+    }
+    uart_tx_queue(0, UART_TX_BLOCK);
+}
+
+
+/******************************************************************************
+*                                SEND RESPONSE                                *
+*******************************************************************************
+* Description: Send a response packet: status followed by the data
+*
+*   Arguments: cmd    - command being answered
+*              seq    - sequence number from the request
+*              status - BIN_OK or BIN_ERR_xxx
+*              data   - response data, may be NULL if len is 0
+*              len    - number of data bytes
+*
+*      Return: None
+******************************************************************************/
+static void binaryRespond(uint8_t cmd, uint8_t seq, uint8_t status,
+                          const uint8_t *data, uint8_t len)
+{
+    uint8_t rsp[BIN_MAX_PAYLOAD - BIN_HDR_LEN - BIN_CRC_LEN];
+
+    if(len > sizeof(rsp) - 1)
+    {
+        len = sizeof(rsp) - 1;
+    }
+    rsp[0] = status;
+    memcpy(&rsp[1], data, len);
+
+    binarySendPacket(cmd | BIN_RSP_FLAG, seq, rsp, len + 1);
+}
+
+
+/******************************************************************************
+*                                TWI TRANSFER                                 *
+*******************************************************************************
+* Description: Blocking TWI transaction that never prints, the console may
+*              be carrying binary data.
+*
+*   Arguments: addr  - 7-bit device address
+*              wr    - data to write
+*              wrLen - number of bytes to write
+*              rd    - read data goes here
+*              rdLen - number of bytes to read
+*
+*      Return: bytes transferred or TWI_ERR_xxx
+******************************************************************************/
+static int16_t binaryTwi(uint8_t addr, const uint8_t *wr, uint8_t wrLen,
+                         uint8_t *rd, uint8_t rdLen)
+{
+    twi_xfer_t xfer;
+
+    twi_setup_xfer(&xfer, addr, wr, wrLen, rd, rdLen);
+    if(twi_submit(&xfer) != 0)
+    {
+        return TWI_ERR_BUSY;
+    }
+
+    while(twi_xfer_pending(&xfer))
+    {
+        twi_service();
+    }
+    return xfer.result;
+}
+
+
+/******************************************************************************
+*                             RESPOND TWI ERROR                               *
+*******************************************************************************
+* Description: Send BIN_ERR_TWI with the TWI result code
+*
+*   Arguments: cmd    - command being answered
+*              seq    - sequence number from the request
+*              result - TWI_ERR_xxx
+*
+*      Return: None
+******************************************************************************/
+static void binaryRespondTwiError(uint8_t cmd, uint8_t seq, int16_t result)
+{
+    uint8_t data[2];
+
+    data[0] = result & 0xFF;
+    data[1] = result >> 8;
+    binaryRespond(cmd, seq, BIN_ERR_TWI, data, sizeof(data));
+}
+
+
+/******************************************************************************
+*                               PROCESS PACKET                                *
+*******************************************************************************
+* Description: Check and execute one decoded request
+*
+*   Arguments: pkt - decoded packet
+*              len - packet length, crc included
+*
+*      Return: None
+******************************************************************************/
+static void binaryProcessPacket(uint8_t *pkt, uint8_t len)
+{
+    uint8_t  cmd;
+    uint8_t  seq;
+    uint8_t *args;
+    uint8_t  arg_len;
+    uint8_t  data[BIN_MAX_PAYLOAD];
+    uint8_t  raw[4];
+    int16_t  result;
+    telem_stats_t stats;
+
+    if(len < BIN_HDR_LEN + BIN_CRC_LEN)
+    {
+        return;     // nothing to answer
+    }
+
+    cmd     = pkt[0];
+    seq     = pkt[1];
+    args    = &pkt[BIN_HDR_LEN];
+    arg_len = len - BIN_HDR_LEN - BIN_CRC_LEN;
+
+    if(binCrc(pkt, len - BIN_CRC_LEN) !=
+       (pkt[len - 2] | ((uint16_t)pkt[len - 1] << 8)))
+    {
+        binaryRespond(cmd, seq, BIN_ERR_CRC, NULL, 0);
+        return;
+    }
+
+    switch(cmd)
+    {
+        case BIN_CMD_PING:
+            data[0] = BIN_PROTOCOL_VERSION;
+            data[1] = BIN_MAX_PAYLOAD;
+            binaryRespond(cmd, seq, BIN_OK, data, 2);
+            break;
+
+        case BIN_CMD_EXIT:
+            telemetry_stop(NULL);
+            binaryRespond(cmd, seq, BIN_OK, NULL, 0);
+            uart_flush();
+            binActive = 0;
+            uart_set_echo(1);
+            cprintf("\r\n>");
+            break;
+
+        case BIN_CMD_HUMID_MR:
+            // telemetry owns the sensor's request / read sequence
+            if(telemetry_active())
+            {
+                binaryRespond(cmd, seq, BIN_ERR_BUSY, NULL, 0);
+                break;
+            }
+
+            result = binaryTwi(TWI_HUMIDITY_SENSOR_ADDR, NULL, 0, NULL, 0);
+            if(result < 0)
+            {
+                binaryRespondTwiError(cmd, seq, result);
+            }
+            else
+            {
+                binaryRespond(cmd, seq, BIN_OK, NULL, 0);
+            }
+            break;
+
+        case BIN_CMD_HUMID_READ:
+            if(telemetry_active())
+            {
+                binaryRespond(cmd, seq, BIN_ERR_BUSY, NULL, 0);
+                break;
+            }
+
+            result = binaryTwi(TWI_HUMIDITY_SENSOR_ADDR, NULL, 0, raw, 4);
+            if(result < 0)
+            {
+                binaryRespondTwiError(cmd, seq, result);
+                break;
+            }
+
+            binaryRespond(cmd, seq, BIN_OK, data, humidityPackRaw(raw, data));
+            break;
+
+        case BIN_CMD_TELEM_START:
+            if(arg_len != 2)
+            {
+                binaryRespond(cmd, seq, BIN_ERR_LEN, NULL, 0);
+            }
+            else if(telemetry_start(args[0] | ((uint16_t)args[1] << 8)) < 0)
+            {
+                binaryRespond(cmd, seq, BIN_ERR_ARG, NULL, 0);
+            }
+            else
+            {
+                binaryRespond(cmd, seq, BIN_OK, NULL, 0);
+            }
+            break;
+
+        case BIN_CMD_TELEM_STOP:
+            telemetry_stop(&stats);
+            memcpy(&data[0], &stats.sent,    4);     // AVR is little endian
+            memcpy(&data[4], &stats.dropped, 4);
+            memcpy(&data[8], &stats.errors,  4);
+            binaryRespond(cmd, seq, BIN_OK, data, 12);
+            break;
+
+        case BIN_CMD_MUX_GET:
+            result = muxSync();
+            if(result < 0)
+            {
+                binaryRespondTwiError(cmd, seq, result);
+            }
+            else
+            {
+                data[0] = getMuxConfiguration();
+                binaryRespond(cmd, seq, BIN_OK, data, 1);
+            }
+            break;
+
+        case BIN_CMD_MUX_SET:
+            if(arg_len != 1)
+            {
+                binaryRespond(cmd, seq, BIN_ERR_LEN, NULL, 0);
+                break;
+            }
+            result = muxSelectChannels(args[0]);
+            if(result < 0)
+            {
+                binaryRespondTwiError(cmd, seq, result);
+            }
+            else
+            {
+                data[0] = getMuxConfiguration();
+                binaryRespond(cmd, seq, BIN_OK, data, 1);
+            }
+            break;
+
+        case BIN_CMD_TWI_XFER:
+            // addr, rdLen, write data
+            if(arg_len < 2 || args[1] > BIN_MAX_PAYLOAD - BIN_HDR_LEN - BIN_CRC_LEN - 1)
+            {
+                binaryRespond(cmd, seq, BIN_ERR_LEN, NULL, 0);
+                break;
+            }
+            result = binaryTwi(args[0], &args[2], arg_len - 2, data, args[1]);
+            if(result < 0)
+            {
+                binaryRespondTwiError(cmd, seq, result);
+            }
+            else
+            {
+                binaryRespond(cmd, seq, BIN_OK, data, args[1]);
+            }
+            break;
+
+        default:
+            binaryRespond(cmd, seq, BIN_ERR_CMD, NULL, 0);
+            break;
+    }
+}
+
+
+/******************************************************************************
+*                            START BINARY PROTOCOL                            *
+*******************************************************************************
+* Description: Switch the serial port from the text console to the binary
+*              protocol.  Echo is turned off.  XON/XOFF cannot be used, COBS
+*              frames may contain the XON and XOFF codes.
+*
+*   Arguments: None
+*
+*      Return: None
+******************************************************************************/
+void binaryCmdStart(void)
+{
+    if(uart_get_flow() == UART_FLOW_XONXOFF)
+    {
+        cprintf("ERROR - binary mode needs flow control none or rts\r\n");
+        return;
+    }
+
+    // the 0x00 ends the text for a host resynchronizing on frames
+    cprintf("binary mode\r\n");
+    uart_tx_queue(0, UART_TX_BLOCK);
+    uart_flush();
+
+    rxLen      = 0;
+    rxOverflow = 0;
+    binActive  = 1;
+    uart_set_echo(0);
+}
+
+
+/******************************************************************************
+*                           BINARY PROTOCOL ACTIVE                            *
+*******************************************************************************
+* Description: Is the serial port carrying the binary protocol
+*
+*   Arguments: None
+*
+*      Return: non zero in binary mode
+******************************************************************************/
+uint8_t binaryCmdActive(void)
+{
+    return binActive;
+}
+
+
+/******************************************************************************
+*                              RECEIVE BYTE                                   *
+*******************************************************************************
+* Description: Collect one received byte.  A 0x00 ends the frame, which is
+*              then decoded and executed.  Oversize frames are dropped
+*              whole.
+*
+*   Arguments: data - received byte
+*
+*      Return: None
+******************************************************************************/
+void binaryCmdRxByte(uint8_t data)
+{
+    int16_t len;
+
+    if(data != 0)
+    {
+        if(rxLen < sizeof(rxFrame))
+        {
+            rxFrame[rxLen++] = data;
+        }
+        else
+        {
+            rxOverflow = 1;
+        }
+        return;
+    }
+
+    if(rxLen > 0 && !rxOverflow)
+    {
+        len = cobs_decode(rxFrame, rxLen, rxFrame);
+        if(len > 0)
+        {
+            binaryProcessPacket(rxFrame, len);
+        }
+    }
+
+    rxLen      = 0;
+    rxOverflow = 0;
+}
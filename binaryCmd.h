@@ -0,0 +1,71 @@
+/*******************************************************************************
+*   File Name: binaryCmd.h
+*
+* Description: Data and definitions for binaryCmd.c, the binary framed
+*              command/response protocol.
+*
+*              Wire format: every packet is COBS encoded and followed by a
+*              single 0x00 delimiter, so a receiver can always resynchronize
+*              on the next zero.  Decoded packet:
+*
+*                request:   cmd  seq  args...             crc16
+*                response:  cmd|0x80  seq  status  data... crc16
+*                event:     evt  seq  data...             crc16
+*
+*              crc16 is CRC-16/XMODEM (poly 0x1021, init 0) over every byte
+*              ahead of it, sent low byte first.  seq is echoed unchanged in
+*              the response.  Multi-byte fields are little endian.
+*
+*              tools/mfgproto.py is the host side reference.
+*******************************************************************************/
+#ifndef __BINARY_CMD_H__
+#define __BINARY_CMD_H__
+
+#include <inttypes.h>
+
+#define BIN_PROTOCOL_VERSION    1
+#define BIN_MAX_PAYLOAD         64      // decoded packet, header and crc included
+#define BIN_MAX_FRAME           (BIN_MAX_PAYLOAD + BIN_MAX_PAYLOAD / 254 + 1)
+#define BIN_HDR_LEN             2       // cmd, seq
+#define BIN_CRC_LEN             2
+#define BIN_RSP_FLAG            0x80    // set in the cmd byte of a response
+
+/*
+ * command IDs, request arguments -> response data
+ */
+#define BIN_CMD_PING            0x01    // -> version, max payload
+#define BIN_CMD_EXIT            0x02    // -> (none), back to the text console
+#define BIN_CMD_TELEM_START     0x08    // period ms(2) -> (none)
+#define BIN_CMD_TELEM_STOP      0x09    // -> sent(4), dropped(4), errors(4)
+#define BIN_CMD_HUMID_MR        0x10    // -> (none)
+#define BIN_CMD_HUMID_READ      0x11    // -> status bits, rh raw(2), temp raw(2)
+#define BIN_CMD_MUX_GET         0x20    // -> control register, read from the mux
+#define BIN_CMD_MUX_SET         0x21    // control -> control register, skipped if unchanged
+#define BIN_CMD_TWI_XFER        0x30    // addr, rdLen, wr data... -> rd data...
+
+/*
+ * unsolicited event IDs, never have BIN_RSP_FLAG set
+ */
+#define BIN_EVT_BASE            0x40
+
+/*
+ * response status
+ */
+#define BIN_OK                  0
+#define BIN_ERR_CRC             1       // packet failed the CRC check
+#define BIN_ERR_CMD             2       // unknown command
+#define BIN_ERR_LEN             3       // wrong argument length
+#define BIN_ERR_TWI             4       // bus error, data is the int16 TWI_ERR_xxx
+#define BIN_ERR_ARG             5       // argument out of range
+#define BIN_ERR_BUSY            6       // sensor in use by telemetry
+
+// global functions
+uint16_t cobs_encode(const uint8_t *src, uint8_t len, uint8_t *dst);
+int16_t  cobs_decode(const uint8_t *src, uint16_t len, uint8_t *dst);
+void     binaryCmdStart(void);
+uint8_t  binaryCmdActive(void);
+void     binaryCmdRxByte(uint8_t data);
+void     binarySendPacket(uint8_t cmd, uint8_t seq, const uint8_t *data, uint8_t len);
+
+
+#endif  // end __BINARY_CMD_H__
@@ -0,0 +1,228 @@
+/*******************************************************************************
+*   File Name: console.c
+*
+* Description: Console output.  A formatter for the handful of conversions the
+*              firmware uses, so avr-libc's vfprintf (and its RAM copies of
+*              the format strings) is not linked.  Output goes through the
+*              UART transmit queue.
+*******************************************************************************/
+#include <stdarg.h>
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+#include "console.h"
+#include "uart.h"
+
+
+/******************************************************************************
+*                                DIGIT CHARACTER                              *
+*******************************************************************************
+* Description: Character for a digit, 0 - 15
+*
+*   Arguments: digit - digit value
+*              upper - use A-F for hex
+*
+*      Return: character
+******************************************************************************/
+static char cdigit(uint8_t digit, uint8_t upper)
+{
+    return (digit < 10) ? ('0' + digit) : ((upper ? 'A' : 'a') + digit - 10);
+}
+
+
+/******************************************************************************
+*                                PUT NUMBER                                   *
+*******************************************************************************
+* Description: Output an unsigned number.  Values that fit in 16 bits, which
+*              is every conversion without 'l', are converted with 16-bit
+*              division; the AVR's 32-bit divide costs several times as much.
+*
+*   Arguments: value - number to print
+*              base  - 10 or 16
+*              upper - use A-F for hex
+*              neg   - print a minus sign
+*              width - minimum field width
+*              zero  - pad with zeros instead of spaces
+*
+*      Return: None
+******************************************************************************/
+static void cputnum(uint32_t value, uint8_t base, uint8_t upper, uint8_t neg,
+                    uint8_t width, uint8_t zero)
+{
+    char     buf[10];               // 4294967295
+    uint8_t  len = 0;
+    uint16_t small;
+
+    if(value <= UINT16_MAX)
+    {
+        small = value;
+        do
+        {
+            buf[len++] = cdigit(small % base, upper);
+            small /= base;
+        } while(small != 0);
+    }
+    else
+    {
+        do
+        {
+            buf[len++] = cdigit(value % base, upper);
+            value /= base;
+        } while(value != 0);
+    }
+
+    if(neg)
+    {
+        width = (width > 0) ? width - 1 : 0;
+        if(zero)
+        {
+            transmit_usart0('-');
+        }
+    }
+
+    while(width > len)
+    {
+        transmit_usart0(zero ? '0' : ' ');
+        width--;
+    }
+
+    if(neg && !zero)
+    {
+        transmit_usart0('-');
+    }
+
+    while(len > 0)
+    {
+        transmit_usart0(buf[--len]);
+    }
+}
+
+
+/******************************************************************************
+*                              CONSOLE VPRINTF                                *
+*******************************************************************************
+* Description: Format and send a message, see console.h for the conversions.
+*              Anything else is printed as is.
+*
+*   Arguments: fmt - format string in flash
+*              ap  - arguments
+*
+*      Return: None
+******************************************************************************/
+void cvprintf_P(const char *fmt, va_list ap)
+{
+    char        c;
+    uint8_t     zero;
+    uint8_t     width;
+    uint8_t     is_long;
+    uint32_t    uval;
+    int32_t     sval;
+    const char *str;
+
+    while((c = pgm_read_byte(fmt++)) != '\0')
+    {
+        if(c != '%')
+        {
+            transmit_usart0(c);
+            continue;
+        }
+
+        zero    = 0;
+        width   = 0;
+        is_long = 0;
+
+        c = pgm_read_byte(fmt++);
+        if(c == '0' || c == '.')
+        {
+            zero = 1;
+            c    = pgm_read_byte(fmt++);
+        }
+        while(c >= '0' && c <= '9')
+        {
+            width = width * 10 + (c - '0');
+            c     = pgm_read_byte(fmt++);
+        }
+        if(c == 'l')
+        {
+            is_long = 1;
+            c       = pgm_read_byte(fmt++);
+        }
+
+        switch(c)
+        {
+            case 'd':
+                sval = is_long ? va_arg(ap, int32_t) : va_arg(ap, int);
+                uval = (sval < 0) ? -(uint32_t)sval : (uint32_t)sval;
+                cputnum(uval, 10, 0, sval < 0, width, zero);
+                break;
+
+            case 'u':
+            case 'x':
+            case 'X':
+                uval = is_long ? va_arg(ap, uint32_t) : va_arg(ap, unsigned int);
+                cputnum(uval, (c == 'u') ? 10 : 16, c == 'X', 0, width, zero);
+                break;
+
+            case 'c':
+                transmit_usart0(va_arg(ap, int));
+                break;
+
+            case 's':
+                str = va_arg(ap, const char *);
+                while(*str != '\0')
+                {
+                    transmit_usart0(*str++);
+                }
+                break;
+
+            case 'S':
+                cputs_P(va_arg(ap, const char *));
+                break;
+
+            case '\0':
+                return;
+
+            default:
+                transmit_usart0(c);     // %% and anything unsupported
+                break;
+        }
+    }
+}
+
+
+/******************************************************************************
+*                               CONSOLE PRINTF                                *
+*******************************************************************************
+* Description: printf_P replacement
+*
+*   Arguments: fmt - format string in flash
+*
+*      Return: None
+******************************************************************************/
+void cprintf_P(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    cvprintf_P(fmt, ap);
+    va_end(ap);
+}
+
+
+/******************************************************************************
+*                                CONSOLE PUTS                                 *
+*******************************************************************************
+* Description: Send a flash string as is, no formatting and no newline
+*
+*   Arguments: str - string in flash
+*
+*      Return: None
+******************************************************************************/
+void cputs_P(const char *str)
+{
+    char c;
+
+    while((c = pgm_read_byte(str++)) != '\0')
+    {
+        transmit_usart0(c);
+    }
+}
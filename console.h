@@ -0,0 +1,27 @@
+/*******************************************************************************
+*   File Name: console.h
+*
+* Description: Data and definitions for console.c, a small printf for the
+*              serial console.  Format strings live in flash.  cprintf() takes
+*              a string literal and puts it in flash with PSTR(); cprintf_P()
+*              takes a PROGMEM string.
+*
+*              Conversions: %d %u %x %X %c %s %S %%, with an optional 'l'
+*              length, '0' flag, width, and precision on integers (%.2X is
+*              the same as %02X).  %s is a RAM string, %S a flash string.
+*******************************************************************************/
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+#include <stdarg.h>
+#include <avr/pgmspace.h>
+
+#define cprintf(fmt, ...)   cprintf_P(PSTR(fmt), ##__VA_ARGS__)
+
+// global functions
+void    cprintf_P(const char *fmt, ...);
+void    cvprintf_P(const char *fmt, va_list ap);
+void    cputs_P(const char *str);
+
+
+#endif  // end __CONSOLE_H__
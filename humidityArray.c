@@ -0,0 +1,450 @@
+/*******************************************************************************
+*   File Name: humidityArray.c
+*
+* Description: Pipelined sampling of ChipCap2 sensors behind the PCA9546 mux.
+*              Each channel runs its own measurement request, wait, read
+*              sequence off the TWI queue; the waits overlap.  Retries follow
+*              humidPolicy, see humiditySensor.h.  Sensor transactions are
+*              routed, the TWI engine selects each one's channel.
+*******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "twi_utils.h"
+#include "timers.h"
+#include "humiditySensor.h"
+#include "humidityArray.h"
+#include "muxPCA9546.h"
+#include "telemetry.h"
+#include "console.h"
+
+// channel states
+#define ARRAY_IDLE      0       // not in this round
+#define ARRAY_MR        1       // measurement request queued
+#define ARRAY_WAIT      2       // conversion or retry delay
+#define ARRAY_READ      3       // read queued
+#define ARRAY_DONE      4       // result delivered
+#define ARRAY_BCAST     5       // waiting for the broadcast request
+
+/*
+ * one mux channel
+ */
+typedef struct
+{
+    twi_xfer_t  xfer;           // measurement request or read
+    twi_dev_t   dev;            // the sensor behind this channel
+    uint8_t     raw[4];
+    uint8_t     state;          // ARRAY_xxx
+    uint8_t     tries;          // retries used
+    uint16_t    delay;          // next retry delay, msec
+    uint32_t    due;            // ms_time() the read may start
+    uint32_t    mrTime;         // ms_time() of the measurement request
+    uint8_t     bcast;          // requested by the broadcast
+} array_channel_t;
+
+static array_channel_t   arrayCh[HUMID_ARRAY_CHANNELS];
+static twi_xfer_t        arrayRestore;      // mux configuration put back
+static twi_xfer_t        arrayBcastSel;     // enable every channel in the round
+static twi_xfer_t        arrayBcastMr;      // one request for all of them
+static uint8_t           arrayMask;         // channels in the round
+static uint8_t           arrayCfg;          // mux configuration before the round
+static uint8_t           arrayActive;
+static humid_sample_cb_t arrayCallback;
+
+
+/*******************************************************************************
+*                               SUBMIT CHANNEL                                 *
+********************************************************************************
+* Description: Queue a measurement request or a read to a channel's sensor
+*
+*   Arguments: ch   - mux channel
+*              read - read the sensor, else measurement request
+*
+*      Return: 0 if queued, TWI_ERR_xxx if not
+*******************************************************************************/
+static int8_t arraySubmit(uint8_t ch, uint8_t read)
+{
+    array_channel_t *c = &arrayCh[ch];
+
+    if(read)
+    {
+        twi_setup_dev_xfer(&c->xfer, &c->dev, NULL, 0, c->raw, sizeof(c->raw));
+    }
+    else
+    {
+        twi_setup_dev_xfer(&c->xfer, &c->dev, NULL, 0, NULL, 0);
+        c->mrTime = ms_time();
+    }
+    return twi_submit(&c->xfer);
+}
+
+
+/*******************************************************************************
+*                               FINISH CHANNEL                                 *
+********************************************************************************
+* Description: Deliver a channel's result
+*
+*   Arguments: ch    - mux channel
+*              error - 0, TWI_ERR_xxx, or -1 for no valid data
+*
+*      Return: None
+*******************************************************************************/
+static void arrayFinish(uint8_t ch, int8_t error)
+{
+    humid_sample_t sample;
+
+    sample.channel = ch;
+    sample.error   = error;
+    sample.time    = arrayCh[ch].mrTime;
+    if(error == 0)
+    {
+        humidityConvert(arrayCh[ch].raw, &sample.data);
+    }
+
+    arrayCh[ch].state = ARRAY_DONE;
+    if(arrayCallback != NULL)
+    {
+        arrayCallback(&sample);
+    }
+}
+
+
+/*******************************************************************************
+*                               START ROUND                                    *
+********************************************************************************
+* Description: Sample the sensors on a set of mux channels.  Measurement
+*              requests are queued for every channel at once, or sent as one
+*              broadcast; each channel is read once the conversion time has
+*              passed since its request.  The callback gets each channel's
+*              result as it completes, then NULL when the round is over.  The
+*              mux configuration is put back at the end.
+*
+*   Arguments: mask      - bit per mux channel
+*              broadcast - one measurement request for all the channels
+*              callback  - result callback, runs from the main loop
+*
+*      Return: 0 if started, -1 if busy, telemetry is streaming or the mask
+*              is empty
+*******************************************************************************/
+int8_t humidityArrayStart(uint8_t mask, uint8_t broadcast,
+                          humid_sample_cb_t callback)
+{
+    uint8_t ch;
+    int8_t  error;
+
+    mask &= HUMID_ARRAY_ALL;
+    if(arrayActive || mask == 0 || twi_xfer_pending(&arrayRestore) ||
+       humidityUpdateState() == HUMID_STATE_MR   ||
+       humidityUpdateState() == HUMID_STATE_WAIT ||
+       humidityUpdateState() == HUMID_STATE_FETCH ||
+       telemetry_active())
+    {
+        return -1;
+    }
+
+    arrayCfg      = getMuxConfiguration();
+    arrayCallback = callback;
+    arrayMask     = mask;
+    arrayActive   = 1;
+
+    if(broadcast)
+    {
+        twi_setup_xfer(&arrayBcastSel, MUX_PCA9546_I2C_ADDR, &arrayMask, 1, NULL, 0);
+        twi_setup_xfer(&arrayBcastMr, TWI_HUMIDITY_SENSOR_ADDR, NULL, 0, NULL, 0);
+        if(twi_submit(&arrayBcastSel) < 0 || twi_submit(&arrayBcastMr) < 0)
+        {
+            broadcast = 0;
+        }
+    }
+
+    for(ch = 0; ch < HUMID_ARRAY_CHANNELS; ch++)
+    {
+        arrayCh[ch].state = ARRAY_IDLE;
+        if(!(mask & (1 << ch)))
+        {
+            continue;
+        }
+
+        arrayCh[ch].dev.muxAddr = MUX_PCA9546_I2C_ADDR;
+        arrayCh[ch].dev.channel = ch;
+        arrayCh[ch].dev.addr    = TWI_HUMIDITY_SENSOR_ADDR;
+        arrayCh[ch].tries  = 0;
+        arrayCh[ch].delay  = humidPolicy.retryMs;
+        arrayCh[ch].bcast  = broadcast;
+        arrayCh[ch].mrTime = ms_time();
+        if(broadcast)
+        {
+            arrayCh[ch].state = ARRAY_BCAST;
+            continue;
+        }
+
+        arrayCh[ch].state = ARRAY_MR;
+        if((error = arraySubmit(ch, 0)) < 0)
+        {
+            arrayFinish(ch, error);
+        }
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+*                             REQUEST ALONE                                    *
+********************************************************************************
+* Description: Send a channel its own measurement request, after the
+*              broadcast failed or the sensor missed it
+*
+*   Arguments: ch - mux channel
+*
+*      Return: None
+*******************************************************************************/
+static void arrayRequestAlone(uint8_t ch)
+{
+    int8_t error;
+
+    arrayCh[ch].bcast = 0;
+    arrayCh[ch].state = ARRAY_MR;
+    if((error = arraySubmit(ch, 0)) < 0)
+    {
+        arrayFinish(ch, error);
+    }
+}
+
+
+/*******************************************************************************
+*                               ROUND ACTIVE                                   *
+********************************************************************************
+* Description: Is a sampling round running
+*
+*   Arguments: None
+*
+*      Return: non zero while running
+*******************************************************************************/
+uint8_t humidityArrayActive(void)
+{
+    return arrayActive;
+}
+
+
+/*******************************************************************************
+*                            HUMIDITY ARRAY SERVICE                            *
+********************************************************************************
+* Description: Move every channel along.  Call from the main loop.
+*
+*   Arguments: None
+*
+*      Return: None
+*******************************************************************************/
+void humidityArray_service(void)
+{
+    array_channel_t *c;
+    uint8_t          ch;
+    uint8_t          busy = 0;
+    uint8_t          status;
+    uint32_t         next;
+    int8_t           error;
+
+    if(!arrayActive)
+    {
+        return;
+    }
+
+    for(ch = 0; ch < HUMID_ARRAY_CHANNELS; ch++)
+    {
+        c = &arrayCh[ch];
+        if(c->state == ARRAY_IDLE || c->state == ARRAY_DONE)
+        {
+            continue;
+        }
+        busy = 1;
+
+        if(twi_xfer_pending(&c->xfer))
+        {
+            continue;
+        }
+
+        switch(c->state)
+        {
+            case ARRAY_BCAST:
+                if(twi_xfer_pending(&arrayBcastSel) || twi_xfer_pending(&arrayBcastMr))
+                {
+                    break;
+                }
+                if(arrayBcastSel.state != TWI_XFER_DONE || arrayBcastMr.state != TWI_XFER_DONE)
+                {
+                    arrayRequestAlone(ch);      // nobody acknowledged
+                    break;
+                }
+                c->due   = c->mrTime + humidPolicy.convMs;
+                c->state = ARRAY_WAIT;
+                break;
+
+            case ARRAY_MR:
+                error = (c->xfer.state == TWI_XFER_DONE) ? 0 : c->xfer.result;
+                if(error < 0)
+                {
+                    arrayFinish(ch, error);     // no sensor on this channel
+                    break;
+                }
+                c->due   = c->mrTime + humidPolicy.convMs;
+                c->state = ARRAY_WAIT;
+                break;
+
+            case ARRAY_WAIT:
+                if(!time_after_eq(ms_time(), c->due))
+                {
+                    break;
+                }
+                if((error = arraySubmit(ch, 1)) < 0)
+                {
+                    arrayFinish(ch, error);     // quarantined or busy
+                    break;
+                }
+                c->state = ARRAY_READ;
+                break;
+
+            case ARRAY_READ:
+                error  = (c->xfer.state == TWI_XFER_DONE) ? 0 : c->xfer.result;
+                status = c->raw[0] >> 6;
+                if(error == 0 && status == HUMIDITY_SENSOR_VALID_DATA)
+                {
+                    arrayFinish(ch, 0);
+                    break;
+                }
+
+                // the broadcast did not reach this sensor, or it is missing
+                if(c->bcast && c->tries == 0)
+                {
+                    arrayRequestAlone(ch);
+                    break;
+                }
+
+                // stale data or a failed read, read again later
+                if((error < 0 || status == HUMIDITY_SENSOR_STALE_DATA) &&
+                   c->tries < humidPolicy.retries)
+                {
+                    c->tries++;
+                    c->due   = ms_time() + c->delay;
+                    c->state = ARRAY_WAIT;
+                    next     = (uint32_t)c->delay * humidPolicy.backoff;
+                    c->delay = (next > UINT16_MAX) ? UINT16_MAX : next;
+                    break;
+                }
+                arrayFinish(ch, (error < 0) ? error : -1);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if(!busy)
+    {
+        arrayActive = 0;
+        twi_setup_xfer(&arrayRestore, MUX_PCA9546_I2C_ADDR, &arrayCfg, 1, NULL, 0);
+        twi_submit(&arrayRestore);
+        if(arrayCallback != NULL)
+        {
+            arrayCallback(NULL);
+        }
+    }
+}
+
+
+/*******************************************************************************
+*                              PRINT SAMPLE                                    *
+********************************************************************************
+* Description: Console result callback for "humid array"
+*
+*   Arguments: sample - channel result, NULL at the end of the round
+*
+*      Return: None
+*******************************************************************************/
+static void arrayPrint(const humid_sample_t *sample)
+{
+    uint16_t temp_abs;
+
+    if(sample == NULL)
+    {
+        cprintf(">");
+        return;
+    }
+
+    if(sample->error < 0)
+    {
+        cprintf("  ch %u: error %d\r\n", sample->channel, sample->error);
+        return;
+    }
+
+    temp_abs = (sample->data.temp < 0) ? -sample->data.temp : sample->data.temp;
+    cprintf("  ch %u: %lu ms  rh = %u.%02u PCT RH  temp = %S%u.%02u C\r\n",
+            sample->channel, sample->time,
+            sample->data.rh / 100, sample->data.rh % 100,
+            (sample->data.temp < 0) ? PSTR("-") : PSTR(""), temp_abs / 100, temp_abs % 100);
+}
+
+
+/*******************************************************************************
+*                           HUMIDITY ARRAY COMMAND                             *
+********************************************************************************
+* Description: "humid array [mask]", sample the sensors on the mux channels
+*              in mask, all of them by default
+*
+*   Arguments: args - parsed arguments
+*
+*      Return: None
+*******************************************************************************/
+void cmdHumidArray(cmd_args_t *args)
+{
+    int32_t mask = HUMID_ARRAY_ALL;
+
+    if(args->argc > 0)
+    {
+        mask = args->val[0];
+    }
+    if(mask <= 0 || mask > HUMID_ARRAY_ALL)
+    {
+        cprintf("ERROR - channel mask is 0x1 to 0x%X\r\n", HUMID_ARRAY_ALL);
+        return;
+    }
+
+    if(humidityArrayStart(mask, 0, arrayPrint) < 0)
+    {
+        cprintf("ERROR - sensor busy\r\n");
+        return;
+    }
+    cprintf("Sampling channels 0x%X\r\n", (uint8_t)mask);
+}
+
+
+/*******************************************************************************
+*                          HUMIDITY BROADCAST COMMAND                          *
+********************************************************************************
+* Description: "humid bcast [mask]", as "humid array" but with one broadcast
+*              measurement request, so the samples are time aligned
+*
+*   Arguments: args - parsed arguments
+*
+*      Return: None
+*******************************************************************************/
+void cmdHumidBroadcast(cmd_args_t *args)
+{
+    int32_t mask = HUMID_ARRAY_ALL;
+
+    if(args->argc > 0)
+    {
+        mask = args->val[0];
+    }
+    if(mask <= 0 || mask > HUMID_ARRAY_ALL)
+    {
+        cprintf("ERROR - channel mask is 0x1 to 0x%X\r\n", HUMID_ARRAY_ALL);
+        return;
+    }
+
+    if(humidityArrayStart(mask, 1, arrayPrint) < 0)
+    {
+        cprintf("ERROR - sensor busy\r\n");
+        return;
+    }
+    cprintf("Broadcast request to channels 0x%X\r\n", (uint8_t)mask);
+}
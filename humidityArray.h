@@ -0,0 +1,52 @@
+/*******************************************************************************
+*   File Name: humidityArray.h
+*
+* Description: Data and definitions for humidityArray.c, ChipCap2 sensors
+*              sampled on several PCA9546 channels at once.  The sensors
+*              share address TWI_HUMIDITY_SENSOR_ADDR, so every access is
+*              routed through the mux channel, which the TWI engine selects
+*              when it is not already selected.  Measurement requests go
+*              out to every channel back to back and the conversions
+*              overlap; a round takes about one conversion time however
+*              many channels there are.
+*
+*              In broadcast mode every channel in the round is enabled at
+*              once and a single measurement request starts all the
+*              sensors together.  Each channel is still read on its own;
+*              a sensor that missed the request shows up there, as a NACK
+*              or stale data, and is sent its own request.
+*******************************************************************************/
+#ifndef __HUMIDITY_ARRAY_H__
+#define __HUMIDITY_ARRAY_H__
+
+#include <inttypes.h>
+#include "humiditySensor.h"
+#include "serialPortCmd.h"
+
+#define HUMID_ARRAY_CHANNELS    4       // PCA9546 channels
+#define HUMID_ARRAY_ALL         0x0F    // channel mask
+
+/*
+ * one channel's result
+ */
+typedef struct
+{
+    uint8_t      channel;       // mux channel
+    int8_t       error;         // 0, TWI_ERR_xxx, or -1 for no valid data
+    uint32_t     time;          // ms_time() of the measurement request
+    humid_data_t data;          // valid if error is 0
+} humid_sample_t;
+
+typedef void (*humid_sample_cb_t)(const humid_sample_t *sample);
+
+
+// global functions
+int8_t  humidityArrayStart(uint8_t mask, uint8_t broadcast,
+                           humid_sample_cb_t callback);
+uint8_t humidityArrayActive(void);
+void    humidityArray_service(void);
+void    cmdHumidArray(cmd_args_t *args);
+void    cmdHumidBroadcast(cmd_args_t *args);
+
+
+#endif  // end __HUMIDITY_ARRAY_H__
@@ -8,81 +8,256 @@
 #include <stdlib.h>
 #include <avr/io.h>
 #include "twi_utils.h"
+#include "timers.h"
 #include "humiditySensor.h"
+#include "humidityArray.h"
 #include "serialPortCmd.h"
 #include "main.h"
 #include "led.h"
+#include "telemetry.h"
+#include "log.h"
+#include "console.h"
 
 
 // local functions
-uint8_t decodeStatusBits(uint8_t *ptrBuf);
-void    decodeHumidityData(uint8_t *ptrBuf, uint8_t numBytes);
-void    decodeTemperatureData(uint8_t *ptrBuf, uint8_t numBytes);
+static void   displayHumidityData(const humid_data_t *data);
+static int8_t telemStart(void *context);
+static int8_t telemPoll(void *context, uint8_t *data);
+static void   humiditySubmit(uint8_t request);
+static void   humidityTimerDone(sw_timer_t *timer);
+
+// telemetry sampling
+static twi_xfer_t     telemRead;        // data of the previous measurement
+static twi_xfer_t     telemMr;          // measurement request for the next one
+static uint8_t        telemRaw[4];
+static telem_source_t telemSource = { HUMID_TELEM_ID, telemStart, telemPoll, NULL };
+
+// measurement update
+humid_policy_t         humidPolicy = { HUMID_CONV_MS, HUMID_RETRY_MS,
+                                       NUM_SENSOR_READ_RETRIES, HUMID_BACKOFF };
+static twi_xfer_t      humidXfer;       // request or read
+static sw_timer_t      humidTimer;      // conversion and retry delays
+static uint8_t         humidRaw[4];
+static humid_reading_t humidReading;    // last valid reading
+static uint8_t         humidValid;      // humidReading is set
+static uint8_t         humidState = HUMID_STATE_IDLE;
+static uint8_t         humidTries;      // retries used
+static uint16_t        humidDelay;      // next retry delay, msec
+static uint8_t         humidNeedMr;     // retry with a new request
+static uint8_t         humidVerbose;    // print the result
 
 
 /*******************************************************************************
-*                             HUMIDITY SERIAL PORT MENU                        *
+*                           INITIALIZE HUMIDITY SENSOR                         *
 ********************************************************************************
-* Description: Read humidity from sensor
+* Description: Register the ChipCap2 bus profile.  The sensor supports fast
+*              mode (400 kHz) I2C.  The sensor is also registered as a
+*              telemetry source.
 *
 *   Arguments: None
 *
 *      Return: None
 *******************************************************************************/
-void displayHumidityMenu(void)
+void initHumiditySensor(void)
 {
-    printf("Humidity Sensor Menu:\r\n");
-    printf("  humid read  - read sensor humidity\r\n");
-    printf("  humid scan  - scans the available I2c addresses for a sensor\r\n");
-    printf("  humid mr    - issues a sleep mode measurement request\r\n");
-    printf("  humid update - issues a meas request then reads the sensor\r\n");
-    
-    return;
+    twi_register_device(TWI_HUMIDITY_SENSOR_ADDR, TWI_SCL_FAST, 0);
+    twi_setup_xfer(&telemMr, TWI_HUMIDITY_SENSOR_ADDR, NULL, 0, NULL, 0);
+    telemetry_register(&telemSource);
 }
 
 
 /*******************************************************************************
-*                             HUMIDITY SERIAL COMMANDS                         *
+*                              CONVERT SENSOR DATA                             *
 ********************************************************************************
-* Description: Parse and execute humidity sensor serial port commands
+* Description: Convert the 4 bytes read from the ChipCap2.  Both readings are
+*              14-bit counts:
 *
-*   Arguments: None
+*                %RH   = rh * 100 / 2^14
+*                deg C = temp * 165 / 2^14 - 40
+*
+*              scaled by 100 and rounded to nearest.  One 16x16->32 multiply
+*              and a shift each, no division; every count converts exactly.
 *
-*      Return: 0 if no error is detected, error code otherwise
+*   Arguments: raw  - data read from the sensor
+*              data - raw and converted values go here
+*
+*      Return: status bits, HUMIDITY_SENSOR_xxx
 *******************************************************************************/
-uint8_t humidityCmds(void)
+uint8_t humidityConvert(const uint8_t *raw, humid_data_t *data)
 {
-    uint8_t sensor_status;
-    char *cmd_token;
-    
-    cmd_token = strtok(NULL, " ");
-    
-    if((strcmp(cmd_token, "read") == STRINGS_MATCH) ||
-    (strcmp(cmd_token, "rd")   == STRINGS_MATCH))
+    data->status  = raw[0] >> 6;
+    data->rhRaw   = ((uint16_t)(raw[0] & 0x3F) << 8) | raw[1];
+    data->tempRaw = ((uint16_t)raw[2] << 6) | (raw[3] >> 2);
+
+    data->rh   = ((uint32_t)data->rhRaw * 10000U + 8192) >> 14;
+    data->temp = (int16_t)(((uint32_t)data->tempRaw * 16500U + 8192) >> 14) - 4000;
+
+    return data->status;
+}
+
+
+/*******************************************************************************
+*                              PACK RAW SENSOR DATA                            *
+********************************************************************************
+* Description: Repack the 4 bytes read from the ChipCap2 into the binary
+*              protocol layout: status bits(1), rh(2), temp(2), both raw
+*              14-bit counts, little endian.  See humidityConvert().
+*
+*   Arguments: raw  - data read from the sensor
+*              data - HUMID_PACKED_LEN bytes go here
+*
+*      Return: HUMID_PACKED_LEN
+*******************************************************************************/
+uint8_t humidityPackRaw(const uint8_t *raw, uint8_t *data)
+{
+    uint16_t rh   = ((uint16_t)(raw[0] & 0x3F) << 8) | raw[1];
+    uint16_t temp = ((uint16_t)raw[2] << 6) | (raw[3] >> 2);
+
+    data[0] = raw[0] >> 6;
+    data[1] = rh & 0xFF;
+    data[2] = rh >> 8;
+    data[3] = temp & 0xFF;
+    data[4] = temp >> 8;
+
+    return HUMID_PACKED_LEN;
+}
+
+
+/*******************************************************************************
+*                            TELEMETRY READ COMPLETE                           *
+********************************************************************************
+* Description: TWI callback, runs in interrupt context.  Wakes the sensor for
+*              the next period as soon as this period's data is in.
+*
+*   Arguments: xfer - telemRead
+*
+*      Return: None
+*******************************************************************************/
+static void telemReadDone(twi_xfer_t *xfer)
+{
+    if(!twi_xfer_pending(&telemMr))
     {
-        readSensor(&sensor_status);
+        twi_submit(&telemMr);
     }
-    else if(strcmp(cmd_token, "scan") == STRINGS_MATCH)
+}
+
+
+/*******************************************************************************
+*                             TELEMETRY START SAMPLE                           *
+********************************************************************************
+* Description: Read the measurement requested last period; the read
+*              callback then requests the next one.  The first sample after
+*              starting reads stale data, which the status bits report.
+*
+*   Arguments: context - not used
+*
+*      Return: 0 if started, TWI_ERR_BUSY if the last sample is still on
+*              the bus or an update or array round is running
+*******************************************************************************/
+static int8_t telemStart(void *context)
+{
+    if(twi_xfer_pending(&telemRead) || twi_xfer_pending(&telemMr) ||
+       humidityUpdateState() == HUMID_STATE_MR    ||
+       humidityUpdateState() == HUMID_STATE_WAIT  ||
+       humidityUpdateState() == HUMID_STATE_FETCH ||
+       humidityArrayActive())
     {
-        scanTWI();
+        return TWI_ERR_BUSY;
     }
-    else if(strcmp(cmd_token, "mr") == STRINGS_MATCH)
+
+    twi_setup_xfer(&telemRead, TWI_HUMIDITY_SENSOR_ADDR, NULL, 0, telemRaw, sizeof(telemRaw));
+    telemRead.callback = telemReadDone;
+    return twi_submit(&telemRead);
+}
+
+
+/*******************************************************************************
+*                             TELEMETRY POLL SAMPLE                            *
+********************************************************************************
+* Description: Check for the read started by telemStart()
+*
+*   Arguments: context - not used
+*              data    - packed sample goes here
+*
+*      Return: data length, 0 while the read is in progress, -1 on error
+*******************************************************************************/
+static int8_t telemPoll(void *context, uint8_t *data)
+{
+    if(twi_xfer_pending(&telemRead))
     {
-        measurementRequest();
+        return 0;
     }
-    else if((strcmp(cmd_token, "update") == STRINGS_MATCH) ||
-           ( strcmp(cmd_token, "up")     == STRINGS_MATCH))
+    if(telemRead.state != TWI_XFER_DONE)
     {
-        measurementUpdate();
+        return -1;
     }
-    else
+    return humidityPackRaw(telemRaw, data);
+}
+
+
+/*******************************************************************************
+*                             HUMIDITY SERIAL COMMANDS                         *
+********************************************************************************
+* Description: Humidity sensor serial port commands, see serialPortCmd.c
+*
+*   Arguments: args - parsed arguments
+*
+*      Return: None
+*******************************************************************************/
+void cmdHumidRead(cmd_args_t *args)
+{
+    uint8_t sensor_status;
+
+    readSensor(&sensor_status);
+}
+
+void cmdHumidScan(cmd_args_t *args)
+{
+    scanTWI();
+}
+
+void cmdHumidMr(cmd_args_t *args)
+{
+    measurementRequest();
+}
+
+void cmdHumidUpdate(cmd_args_t *args)
+{
+    if(humidityUpdateStart(1) < 0)
     {
-        // unknown humidity command
-        printf("ERROR - unknown humidity command = %s\r\n", cmd_token);
-        return 1;
+        cprintf("ERROR - update in progress\r\n");
+        return;
     }
-    
-    return 0;
+    cprintf("Updating and Reading Sensor\r\n");
+}
+
+void cmdHumidPolicy(cmd_args_t *args)
+{
+    if(args->argc == 4)
+    {
+        if(args->val[0] < 0 || args->val[0] > UINT16_MAX ||
+           args->val[1] < 0 || args->val[1] > UINT16_MAX ||
+           args->val[2] < 0 || args->val[2] > UINT8_MAX  ||
+           args->val[3] < 1 || args->val[3] > UINT8_MAX)
+        {
+            cprintf("ERROR - argument out of range\r\n");
+            return;
+        }
+        humidPolicy.convMs  = args->val[0];
+        humidPolicy.retryMs = args->val[1];
+        humidPolicy.retries = args->val[2];
+        humidPolicy.backoff = args->val[3];
+    }
+    else if(args->argc != 0)
+    {
+        cprintf("ERROR - usage: humid policy <conv_ms> <retry_ms> <retries> <backoff>\r\n");
+        return;
+    }
+
+    cprintf("  conversion = %u ms, first retry = %u ms\r\n",
+            humidPolicy.convMs, humidPolicy.retryMs);
+    cprintf("  retries = %u, backoff = x%u\r\n",
+            humidPolicy.retries, humidPolicy.backoff);
 }
 
 
@@ -105,10 +280,9 @@ uint8_t measurementRequest(void)
     uint8_t data_len = 0;
     int     ret_code = 0;
     
-    printf("Sending Measurement Request: addr = 0x%X\r\n", TWI_HUMIDITY_SENSOR_ADDR);
-    
     // send measurement request
     ret_code = twi_write_bytes(TWI_HUMIDITY_SENSOR_ADDR, data_len, data_buf);
+    LOG(HUMID, DEBUG, HUMID_MR, TWI_HUMIDITY_SENSOR_ADDR, ret_code);
     
     return ret_code;
 }
@@ -126,7 +300,7 @@ uint8_t measurementRequest(void)
 *******************************************************************************/
 uint8_t readSensor(uint8_t *ptrStatus)
 {
-    uint8_t i;
+    humid_data_t data;
     uint8_t data_buf[5];
     uint8_t data_len = 4;
     int     ret_code = 0;
@@ -134,58 +308,237 @@ uint8_t readSensor(uint8_t *ptrStatus)
     data_buf[0] = 0;
     
     setLED(1);
-    printf("Reading Humidity Sensor, addr = 0x%X\r\n", TWI_HUMIDITY_SENSOR_ADDR);
     
     // read humidity sensor
     ret_code = twi_read_bytes(TWI_HUMIDITY_SENSOR_ADDR, data_len, data_buf);
     
-    printf("  return code = %d\r\n", ret_code);
-    printf("  data: ");
-    for(i = 0; i <data_len; i++)
-    {
-        printf(" 0x%X(%d)", data_buf[i], data_buf[i]);
-    }
-    printf("\r\n");
+    LOG(HUMID, DEBUG, HUMID_READ_RAW, TWI_HUMIDITY_SENSOR_ADDR, ret_code,
+        data_buf[0], data_buf[1], data_buf[2], data_buf[3]);
     setLED(0);
-    *ptrStatus = decodeStatusBits(data_buf);
-    decodeHumidityData(data_buf, data_len);
-    decodeTemperatureData(data_buf, data_len);
+    *ptrStatus = humidityConvert(data_buf, &data);
+    displayHumidityData(&data);
     
     return ret_code;
 }
 
 
+/*******************************************************************************
+*                          MEASUREMENT UPDATE RETRY                            *
+********************************************************************************
+* Description: Schedule the next attempt after a failed or stale read, or
+*              give up once the policy's retries are used.  The retry delay
+*              grows by the backoff factor each time.
+*
+*   Arguments: request - retry with a new measurement request, else just
+*                        read again
+*
+*      Return: None
+*******************************************************************************/
+static void humidityRetry(uint8_t request)
+{
+    uint32_t next;
+
+    if(humidTries >= humidPolicy.retries)
+    {
+        humidState = HUMID_STATE_FAILED;
+        LOG(HUMID, WARN, HUMID_UPDATE_FAILED, humidTries, humidXfer.result);
+        if(humidVerbose)
+        {
+            cprintf("\r\nno valid data after %u retries\r\n>", humidTries);
+        }
+        return;
+    }
+
+    humidTries++;
+    humidNeedMr = request;
+    humidState  = HUMID_STATE_WAIT;
+    LOG(HUMID, DEBUG, HUMID_UPDATE_RETRY, humidTries, humidDelay, request);
+    swtimer_start(&humidTimer, humidDelay, 0, humidityTimerDone, NULL);
+
+    next       = (uint32_t)humidDelay * humidPolicy.backoff;
+    humidDelay = (next > UINT16_MAX) ? UINT16_MAX : next;
+}
+
+
+/*******************************************************************************
+*                           MEASUREMENT UPDATE TIMER                           *
+********************************************************************************
+* Description: Software timer callback, the conversion time or a retry delay
+*              is up
+*
+*   Arguments: timer - humidTimer
+*
+*      Return: None
+*******************************************************************************/
+static void humidityTimerDone(sw_timer_t *timer)
+{
+    humiditySubmit(humidNeedMr);
+}
+
+
+/*******************************************************************************
+*                          MEASUREMENT UPDATE SUBMIT                           *
+********************************************************************************
+* Description: Queue a measurement request or a read on the bus
+*
+*   Arguments: request - measurement request, else read
+*
+*      Return: None
+*******************************************************************************/
+static void humiditySubmit(uint8_t request)
+{
+    if(request)
+    {
+        twi_setup_xfer(&humidXfer, TWI_HUMIDITY_SENSOR_ADDR, NULL, 0, NULL, 0);
+        humidState = HUMID_STATE_MR;
+    }
+    else
+    {
+        twi_setup_xfer(&humidXfer, TWI_HUMIDITY_SENSOR_ADDR, NULL, 0, humidRaw, sizeof(humidRaw));
+        humidState = HUMID_STATE_FETCH;
+    }
+
+    if(twi_submit(&humidXfer) < 0)
+    {
+        humidityRetry(request);
+    }
+}
+
+
 /*******************************************************************************
 *                              MEASUREMENT UPDATE                              *
 ********************************************************************************
-* Description: Combines a measurement request with a read data.  
+* Description: Start a measurement update: measurement request, wait for the
+*              conversion, read, check the status bits and publish.  It runs
+*              from humidity_service() and the software timers, so the
+*              console stays live.  Retries follow humidPolicy.
+*
+*   Arguments: verbose - print the result, or the failure, when done
+*
+*      Return: 0 if started, -1 if an update or a humidityArray round is
+*              already running or telemetry is streaming
+*******************************************************************************/
+int8_t humidityUpdateStart(uint8_t verbose)
+{
+    if(humidState == HUMID_STATE_MR   ||
+       humidState == HUMID_STATE_WAIT ||
+       humidState == HUMID_STATE_FETCH || humidityArrayActive() ||
+       telemetry_active())
+    {
+        return -1;
+    }
+
+    humidVerbose = verbose;
+    humidTries   = 0;
+    humidDelay   = humidPolicy.retryMs;
+    humiditySubmit(1);
+    return 0;
+}
+
+
+/*******************************************************************************
+*                           MEASUREMENT UPDATE STATE                           *
+********************************************************************************
+* Description: Where the measurement update is
 *
 *   Arguments: None
 *
-*      Return: 0 if no error is detected
+*      Return: HUMID_STATE_xxx
 *******************************************************************************/
-uint8_t measurementUpdate(void)
+uint8_t humidityUpdateState(void)
 {
-    uint8_t ret_code     = 0;
-    uint8_t read_retries = 0;
-    uint8_t read_status  = HUMIDITY_SENSOR_STALE_DATA;
-    
-    printf("\r\nUpdating and Reading Sensor\r\n");
-    
-    // send measurement request
-    measurementRequest();
-    
-    // read until we get good data or time out
-    while((read_status == HUMIDITY_SENSOR_STALE_DATA) && 
-         (read_retries < NUM_SENSOR_READ_RETRIES))
+    return humidState;
+}
+
+
+/*******************************************************************************
+*                                LATEST READING                                *
+********************************************************************************
+* Description: Get the last reading published by a measurement update
+*
+*   Arguments: reading - copied here
+*
+*      Return: 0 if there is one, -1 if no update has succeeded yet
+*******************************************************************************/
+int8_t humidityLatest(humid_reading_t *reading)
+{
+    if(!humidValid)
     {
-        printf("\r\n");
-        readSensor(&read_status);
-        read_retries++;
+        return -1;
+    }
+    *reading = humidReading;
+    return 0;
+}
+
+
+/*******************************************************************************
+*                               HUMIDITY SERVICE                               *
+********************************************************************************
+* Description: Advance the measurement update when its bus transfer
+*              finishes.  Call from the main loop.
+*
+*   Arguments: None
+*
+*      Return: None
+*******************************************************************************/
+void humidity_service(void)
+{
+    humid_data_t data;
+    uint8_t      status;
+
+    if(twi_xfer_pending(&humidXfer))
+    {
+        return;
+    }
+
+    switch(humidState)
+    {
+        case HUMID_STATE_MR:
+            if(humidXfer.state != TWI_XFER_DONE)
+            {
+                humidityRetry(1);
+                break;
+            }
+            humidState = HUMID_STATE_WAIT;
+            humidNeedMr = 0;
+            swtimer_start(&humidTimer, humidPolicy.convMs, 0, humidityTimerDone, NULL);
+            break;
+
+        case HUMID_STATE_FETCH:
+            if(humidXfer.state != TWI_XFER_DONE)
+            {
+                humidityRetry(0);
+                break;
+            }
+
+            status = humidRaw[0] >> 6;
+            if(status == HUMIDITY_SENSOR_STALE_DATA)
+            {
+                humidityRetry(0);       // conversion not finished
+                break;
+            }
+            if(status != HUMIDITY_SENSOR_VALID_DATA)
+            {
+                humidityRetry(1);       // command mode, request again
+                break;
+            }
+
+            memcpy(humidReading.raw, humidRaw, sizeof(humidRaw));
+            humidReading.time = ms_time();
+            humidValid = 1;
+            humidState = HUMID_STATE_DONE;
+            if(humidVerbose)
+            {
+                humidityConvert(humidRaw, &data);
+                cprintf("\r\n");
+                displayHumidityData(&data);
+                cprintf(">");
+            }
+            break;
+
+        default:
+            break;
     }
-    
-        
-    return ret_code;
 }
 
 
@@ -216,11 +569,11 @@ uint8_t scanTWI(void)
     data_buf[0] = 0;
     
     setLED(1);
-    printf("Scanning for I2C Devices on the Bus:\r\n");
+    cprintf("Scanning for I2C Devices on the Bus:\r\n");
     
     for(twi_addr = 0; twi_addr <= 0x7F; twi_addr++)
     {
-        printf("  reading device at address = 0x%X\r\n", twi_addr);
+        cprintf("  reading device at address = 0x%X\r\n", twi_addr);
         
         ret_code = twi_read_bytes(twi_addr, data_len, data_buf);
 
@@ -228,14 +581,14 @@ uint8_t scanTWI(void)
         {
            dev_addr = twi_addr;
            num_found++; 
-           printf("  num found = %d\r\n", num_found);
-           printf("  ret_code = %d\r\n", ret_code);
-           printf("  addr = 0x%X\r\n", twi_addr);
+           cprintf("  num found = %d\r\n", num_found);
+           cprintf("  ret_code = %d\r\n", ret_code);
+           cprintf("  addr = 0x%X\r\n", twi_addr);
         }
     }
     
-    printf("TWI Address Found = 0x%X\r\n", dev_addr);
-    printf("Number Found = %d\r\n", num_found);
+    cprintf("TWI Address Found = 0x%X\r\n", dev_addr);
+    cprintf("Number Found = %d\r\n", num_found);
     setLED(0);
     
     return 0;
@@ -243,116 +596,34 @@ uint8_t scanTWI(void)
 
 
 /******************************************************************************
-*                             DECODE STATUS BITS                              *
+*                            DISPLAY SENSOR DATA                              *
 *******************************************************************************
-* Description: Decodes and displays status bits from the ChipCap2 sensor read
-*              data.  Possible values:
+* Description: Displays converted ChipCap2 data.  Possible status values:
 *                00b - valid data, data has not been read since last update
 *                01b - stale data, data has been read and not updated
 *                10b - ChipCap2 is in command mode
 *                11b - not used
 *
-*   Arguments: ptrBuf - pointer to buffer containing the data to decode
-*
-*      Return: decoded status bits
-******************************************************************************/
-uint8_t decodeStatusBits(uint8_t *ptrBuf)
-{
-    uint8_t status_bits = 0;
-    
-    printf("Decoding Status Information:\r\n");
-    
-    // get status information from the first byte
-    status_bits = (ptrBuf[0] & 0xC0) >> 6;
-    
-    if(status_bits == HUMIDITY_SENSOR_VALID_DATA)
-        printf("  status = 0x%X (VALID DATA)\r\n", status_bits);
-    else if(status_bits == HUMIDITY_SENSOR_STALE_DATA)
-        printf("  status = 0x%X (STALE DATA)\r\n", status_bits);
-    else
-       printf("  status = 0x%X\r\n", status_bits); 
-        
-    return status_bits;
-}
-
-
-/******************************************************************************
-*                            DECODE HUMIDITY DATA                             *
-*******************************************************************************
-* Description: Decodes and displays humidity data from the ChipCap2 sensor
-*
-*   Arguments: ptrBuf   - pointer to buffer containing the data to decode
-*              numBytes - number of bytes of data to decode
+*   Arguments: data - see humidityConvert()
 *
 *      Return: None
 ******************************************************************************/
-void decodeHumidityData(uint8_t *ptrBuf, uint8_t numBytes)
+static void displayHumidityData(const humid_data_t *data)
 {
-    int32_t rh_low;
-    int32_t rh_high;
-    int32_t humidity_value = 0;
-    
-    printf("Decoding Humidity Data:\r\n");
-    
-    // get humidity value from the first two bytes
-    rh_high = (ptrBuf[0] & 0x3F) * 256;
-    rh_low  =  ptrBuf[1];
-    
-    printf("  rh high = %ld\r\n", rh_high);
-    printf("  rh low  = %ld\r\n", rh_low);
-    
-    humidity_value  = ((rh_high + rh_low) * 100) / 16384;
-    printf("  humidity = %ld PCT RH\r\n", humidity_value);
-    
-    return;    
-}  
+    uint16_t temp_abs = (data->temp < 0) ? -data->temp : data->temp;
 
+    LOG(HUMID, DEBUG, HUMID_STATUS, data->status);
+    LOG(HUMID, DEBUG, HUMID_RH_RAW, data->rhRaw, data->rh);
+    LOG(HUMID, DEBUG, HUMID_TEMP_RAW, data->tempRaw, data->temp);
 
-/******************************************************************************
-*                           DECODE TEMPERATURE DATA                           *
-*******************************************************************************
-* Description: Decodes and displays temperature data from the ChipCap2 sensor
-*
-*   Arguments: ptrBuf   - pointer to buffer containing the data to decode
-*              numBytes - number of bytes of data to decode
-*
-*      Return:
-******************************************************************************/
-void decodeTemperatureData(uint8_t *ptrBuf, uint8_t numBytes)
-{
-    int32_t temp_high = 0;
-    int32_t temp_low  = 0;
-    int32_t buf_value;
-    int32_t temperature_value = 0;
-    
-    
-    printf("Decoding Temperature Data:\r\n");
-    
-    // return if there is no temperature data
-    if(numBytes < 3)
-    {
-        printf("  no temperature data to decode\r\n");
-        return; 
-    }        
-    
-    // get the first byte of temperature data
-    buf_value = ptrBuf[2];
-    temp_high = (((buf_value * 64) * 165) / 16384) - 40;
-    printf("  temp_high = %ld\r\n", temp_high);
-    
-    
-    // get the 2nd byte of temperature data if there is any
-    if(numBytes == 4)
-    {
-        buf_value = (ptrBuf[3] & 0xFC) >> 2;
-        temp_low = ((buf_value / 4) * 165) / 16384;
-        printf("  temp_low = %ld\r\n", temp_low);
-    }
-    
-    temperature_value = temp_high + temp_low;
-    printf("  temperature = %ld C\r\n", temperature_value);
- 
-    return;   
-}    
-
+    if(data->status == HUMIDITY_SENSOR_VALID_DATA)
+        cprintf("  status = 0x%X (VALID DATA)\r\n", data->status);
+    else if(data->status == HUMIDITY_SENSOR_STALE_DATA)
+        cprintf("  status = 0x%X (STALE DATA)\r\n", data->status);
+    else
+       cprintf("  status = 0x%X\r\n", data->status);
 
+    cprintf("  humidity = %u.%02u PCT RH\r\n", data->rh / 100, data->rh % 100);
+    cprintf("  temperature = %s%u.%02u C\r\n", (data->temp < 0) ? "-" : "",
+            temp_abs / 100, temp_abs % 100);
+}
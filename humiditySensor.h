@@ -5,6 +5,9 @@
 *******************************************************************************/
 #ifndef __HUMIDITY_SENSOR_H__
 #define __HUMIDITY_SENSOR_H__
+
+#include <inttypes.h>
+#include "serialPortCmd.h"
   
 
 #define HUMID_SENSOR_ADDR       0x1E    // 7-bit sensor address
@@ -13,21 +16,82 @@
 
 #define TWI_START_CONDITION_TRANSMITTED     0x08
 #define TWI_HUMIDITY_SENSOR_ADDR            0x28
-#define TOKEN_DELIM                         " "
 
-#define NUM_SENSOR_READ_RETRIES             10
+/*
+ * measurement update defaults, see humid_policy_t.  ChipCap2 conversion
+ * takes 36.65 ms typical with 14-bit humidity and temperature.
+ */
+#define NUM_SENSOR_READ_RETRIES             4
+#define HUMID_CONV_MS                       45
+#define HUMID_RETRY_MS                      10
+#define HUMID_BACKOFF                       2
+
+#define HUMID_TELEM_ID                      1   // telemetry source id
+#define HUMID_PACKED_LEN                    5   // humidityPackRaw() output
 
 // sensor data states
 #define HUMIDITY_SENSOR_VALID_DATA      0   // measurement data has not been read
 #define HUMIDITY_SENSOR_STALE_DATA      1   // measurement data has been read
+
+// measurement update states
+#define HUMID_STATE_IDLE        0   // never run
+#define HUMID_STATE_MR          1   // measurement request on the bus
+#define HUMID_STATE_WAIT        2   // waiting for the conversion or a retry
+#define HUMID_STATE_FETCH       3   // reading the measurement
+#define HUMID_STATE_DONE        4   // valid reading published
+#define HUMID_STATE_FAILED      5   // out of retries
+
+/*
+ * measurement update retry policy.  A stale or failed read is retried
+ * retryMs later, the delay multiplied by backoff for each further retry.
+ */
+typedef struct
+{
+    uint16_t convMs;        // measurement request to first read
+    uint16_t retryMs;       // delay before the first retry
+    uint8_t  retries;       // retries after the first read
+    uint8_t  backoff;       // delay multiplier, 1 for a fixed delay
+} humid_policy_t;
+
+/*
+ * converted sensor data, see humidityConvert()
+ */
+typedef struct
+{
+    uint8_t  status;        // HUMIDITY_SENSOR_xxx
+    uint16_t rhRaw;         // 14-bit counts
+    uint16_t tempRaw;
+    uint16_t rh;            // 0.01 %RH, 0 - 9999
+    int16_t  temp;          // 0.01 deg C, -4000 - 12499
+} humid_data_t;
+
+/*
+ * last valid reading
+ */
+typedef struct
+{
+    uint8_t  raw[4];        // as read from the sensor
+    uint32_t time;          // ms_time() of the read
+} humid_reading_t;
+
+extern humid_policy_t humidPolicy;
   
 // public function definitions   
-void    displayHumidityMenu(void);
-uint8_t humidityCmds(void);
+void    initHumiditySensor(void);
+void    cmdHumidRead(cmd_args_t *args);
+void    cmdHumidScan(cmd_args_t *args);
+void    cmdHumidMr(cmd_args_t *args);
+void    cmdHumidUpdate(cmd_args_t *args);
+void    cmdHumidPolicy(cmd_args_t *args);
 uint8_t measurementRequest(void);
 uint8_t readSensor(uint8_t *ptrStatus); 
 uint8_t scanTWI(void);
-uint8_t measurementUpdate(void);
+int8_t  humidityUpdateStart(uint8_t verbose);
+uint8_t humidityUpdateState(void);
+int8_t  humidityLatest(humid_reading_t *reading);
+void    humidity_service(void);
+uint8_t humidityConvert(const uint8_t *raw, humid_data_t *data);
+uint8_t humidityPackRaw(const uint8_t *raw, uint8_t *data);
 
 
   
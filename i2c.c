@@ -2,33 +2,38 @@
 #include <avr/pgmspace.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
 #include "led.h"
+#include "twi_utils.h"
 #include "serialPortCmd.h"
 #include "i2c.h"
+#include "timers.h"
+#include "console.h"
+#include "log.h"
 
 uint8_t i2cscan(void);
 
-#define TOKEN_DELIMINATORS (" ")
-
-const char s_i2c_start_error[]   PROGMEM = "I2C START CONDITION ERROR";
-const char s_i2c_sla_w_error[]   PROGMEM = "I2C SLAVE ADDRESS ERROR";
-const char s_i2c_data_tx_error[] PROGMEM = "I2C DATA TX ERROR";
-const char s_i2c_data_rx_error[] PROGMEM = "I2C DATA RX ERROR";
-const char s_i2c_timeout[]       PROGMEM = "I2C TIMEOUT";
-const char s_i2c_error[]         PROGMEM = "I2C ERROR\n";
-const char s_fmt_i2c_error[]     PROGMEM = " TWCR=%02x STATUS=%02x\n";
-
-extern volatile uint16_t ms_count;
-
 
 /*
- * signal the end of an I2C bus transfer
+ * signal the end of an I2C bus transfer.  If the STOP does not go out within
+ * I2C_STOP_TIMEOUT_US the TWI is reset, which releases the bus.
  */
 int8_t i2c_stop(void)
 {
+  uint32_t deadline;
+
+  deadline = timer_deadline(I2C_STOP_TIMEOUT_US);
+
   TWCR = _BV(TWINT)|_BV(TWEN)|_BV(TWSTO);
-  while (TWCR & _BV(TWSTO))
+  while ((TWCR & _BV(TWSTO)) && !timer_expired(deadline))
     ;
+
+  if (TWCR & _BV(TWSTO)) {
+    TWCR = 0;
+    TWCR = _BV(TWEN);
+    return -1;
+  }
   return 0;
 }
 
@@ -36,11 +41,10 @@ int8_t i2c_stop(void)
 /*
  * display the I2C status and error message and release the I2C bus
  */
-void i2c_error(const char * message, uint8_t cr, uint8_t status)
+void i2c_error(uint8_t msg, uint8_t cr, uint8_t status)
 {
   i2c_stop();
-  printf_P(message);
-  printf_P(s_fmt_i2c_error, cr, status);
+  LOG_ID(I2C, ERROR, msg, cr, status);
 }
 
 
@@ -51,18 +55,19 @@ void i2c_error(const char * message, uint8_t cr, uint8_t status)
 int8_t i2c_start(uint8_t expected_status, uint8_t verbose)
 {
   uint8_t status;
+  uint32_t deadline;
 
-  ms_count = 0;
+  deadline = timer_deadline(I2C_TIMEOUT_US);
 
   /* send start condition to take control of the bus */
   TWCR = I2C_START;
-  while (!(TWCR & _BV(TWINT)) && (ms_count < I2C_TIMEOUT))
+  while (!(TWCR & _BV(TWINT)) && !timer_expired(deadline))
     ;
 
-  if (ms_count >= I2C_TIMEOUT) {
+  if (!(TWCR & _BV(TWINT))) {
     if (verbose) {
-      i2c_error(s_i2c_start_error, TWCR, TWSR);
-      i2c_error(s_i2c_timeout, TWCR, TWSR);
+      i2c_error(LOG_ID_I2C_START_ERROR, TWCR, TWSR);
+      i2c_error(LOG_ID_I2C_TIMEOUT, TWCR, TWSR);
     }
     return -1;
   }
@@ -71,7 +76,7 @@ int8_t i2c_start(uint8_t expected_status, uint8_t verbose)
   status = TWSR;
   if (status != expected_status) {
     if (verbose) {
-      i2c_error(s_i2c_start_error, TWCR, status);
+      i2c_error(LOG_ID_I2C_START_ERROR, TWCR, status);
     }
     return -1;
   }
@@ -88,20 +93,21 @@ int8_t i2c_sla_rw(uint8_t device, uint8_t op, uint8_t expected_status,
 {
   uint8_t sla_w;
   uint8_t status;
+  uint32_t deadline;
 
-  ms_count = 0;
+  deadline = timer_deadline(I2C_TIMEOUT_US);
 
   /* slave address + read/write operation */
   sla_w = (device << 1) | op;
   TWDR  = sla_w;
   TWCR  = I2C_MASTER_TX;
-  while (!(TWCR & _BV(TWINT)) && (ms_count < I2C_TIMEOUT))
+  while (!(TWCR & _BV(TWINT)) && !timer_expired(deadline))
     ;
 
-  if (ms_count >= I2C_TIMEOUT) {
+  if (!(TWCR & _BV(TWINT))) {
     if (verbose) {
-      i2c_error(s_i2c_sla_w_error, TWCR, TWSR);
-      i2c_error(s_i2c_timeout, TWCR, TWSR);
+      i2c_error(LOG_ID_I2C_SLA_W_ERROR, TWCR, TWSR);
+      i2c_error(LOG_ID_I2C_TIMEOUT, TWCR, TWSR);
     }
     return -1;
   }
@@ -109,7 +115,7 @@ int8_t i2c_sla_rw(uint8_t device, uint8_t op, uint8_t expected_status,
   status = TWSR;
   if ((status & 0xf8) != expected_status) {
     if (verbose) {
-      i2c_error(s_i2c_sla_w_error, TWCR, status);
+      i2c_error(LOG_ID_I2C_SLA_W_ERROR, TWCR, status);
     }
     return -1;
   }
@@ -124,19 +130,20 @@ int8_t i2c_sla_rw(uint8_t device, uint8_t op, uint8_t expected_status,
 int8_t i2c_data_tx(uint8_t data, uint8_t expected_status, uint8_t verbose)
 {
   uint8_t status;
+  uint32_t deadline;
 
-  ms_count = 0;
+  deadline = timer_deadline(I2C_TIMEOUT_US);
 
   /* send data byte */
   TWDR = data;
   TWCR = I2C_MASTER_TX;
-  while (!(TWCR & _BV(TWINT)) && (ms_count < I2C_TIMEOUT))
+  while (!(TWCR & _BV(TWINT)) && !timer_expired(deadline))
     ;
 
-  if (ms_count >= I2C_TIMEOUT) {
+  if (!(TWCR & _BV(TWINT))) {
     if (verbose) {
-      i2c_error(s_i2c_data_tx_error, TWCR, TWSR);
-      i2c_error(s_i2c_timeout, TWCR, TWSR);
+      i2c_error(LOG_ID_I2C_DATA_TX_ERROR, TWCR, TWSR);
+      i2c_error(LOG_ID_I2C_TIMEOUT, TWCR, TWSR);
     }
     return -1;
   }
@@ -144,7 +151,7 @@ int8_t i2c_data_tx(uint8_t data, uint8_t expected_status, uint8_t verbose)
   status = TWSR;
   if ((status & 0xf8) != expected_status) {
     if (verbose) {
-      i2c_error(s_i2c_data_tx_error, TWCR, status);
+      i2c_error(LOG_ID_I2C_DATA_TX_ERROR, TWCR, status);
     }
     return -1;
   }
@@ -161,8 +168,9 @@ int8_t i2c_data_rx(uint8_t * data, uint8_t ack, uint8_t expected_status,
 {
   uint8_t status;
   uint8_t b;
+  uint32_t deadline;
 
-  ms_count = 0;
+  deadline = timer_deadline(I2C_TIMEOUT_US);
 
   if (ack) {
     TWCR = _BV(TWINT)|_BV(TWEN)|_BV(TWEA);
@@ -170,13 +178,13 @@ int8_t i2c_data_rx(uint8_t * data, uint8_t ack, uint8_t expected_status,
   else {
     TWCR = _BV(TWINT)|_BV(TWEN);
   }
-  while (!(TWCR & _BV(TWINT)) && (ms_count < I2C_TIMEOUT))
+  while (!(TWCR & _BV(TWINT)) && !timer_expired(deadline))
     ;
 
-  if (ms_count >= I2C_TIMEOUT) {
+  if (!(TWCR & _BV(TWINT))) {
     if (verbose) {
-      i2c_error(s_i2c_data_rx_error, TWCR, TWSR);
-      i2c_error(s_i2c_timeout, TWCR, TWSR);
+      i2c_error(LOG_ID_I2C_DATA_RX_ERROR, TWCR, TWSR);
+      i2c_error(LOG_ID_I2C_TIMEOUT, TWCR, TWSR);
     }
     return -1;
   }
@@ -184,7 +192,7 @@ int8_t i2c_data_rx(uint8_t * data, uint8_t ack, uint8_t expected_status,
   status = TWSR;
   if ((status & 0xf8) != expected_status) {
     if (verbose) {
-      i2c_error(s_i2c_data_rx_error, TWCR, status);
+      i2c_error(LOG_ID_I2C_DATA_RX_ERROR, TWCR, status);
     }
     return -1;
   }
@@ -215,13 +223,13 @@ uint8_t i2cscan(void)
             break;
         }
         
-        printf(" %.2X", i);
+        cprintf(" %.2X", i);
         if(i % 0x20 == 0)
-        printf("\r\n");
+        cprintf("\r\n");
         
         /* address slave device, write */
         if (!i2c_sla_rw(i, 0, TW_MT_SLA_ACK, 0)) {
-            printf("\r\nfound device at address 0x%02x\r\n", i);
+            cprintf("\r\nfound device at address 0x%02x\r\n", i);
             n++;
         }
         
@@ -235,54 +243,124 @@ uint8_t i2cscan(void)
 
 
 /*******************************************************************************
-*                             DISPLAY SERIAL COMMANDS                          *
+*                             I2C SERIAL COMMANDS                              *
 ********************************************************************************
-* Description: Display MUX serial command help
+* Description: I2C serial port commands, see serialPortCmd.c
 *
 *      Global: None
 *
-*   Arguments: None
+*   Arguments: args - parsed arguments
 *
 *      Return: None
 *******************************************************************************/
-void displayI2cSerialCmdHelp(void)
+void cmdI2cScan(cmd_args_t *args)
+{
+    int n;
+
+    cprintf("\r\n\r\nI2C bus scanner starting ...\r\n\r\n");
+    n = i2cscan();
+    cprintf("\r\n%u devices found\r\n", n);
+    cprintf("scan complete\r\n");
+}
+
+void cmdI2cTmo(cmd_args_t *args)
+{
+    twi_latency_t lat[TWI_TMO_PHASES];
+    uint8_t       addr;
+    uint8_t       i;
+    uint8_t       p;
+
+    if(args->argc > 0)
+    {
+        if(strcmp_P(args->argv[0], PSTR("save")) == STRINGS_MATCH)
+        {
+            cprintf("  %d devices saved\r\n", twi_timeouts_save());
+        }
+        else if(strcmp_P(args->argv[0], PSTR("load")) == STRINGS_MATCH)
+        {
+            cprintf("  %d devices loaded\r\n", twi_timeouts_load());
+        }
+        else if(strcmp_P(args->argv[0], PSTR("reset")) == STRINGS_MATCH)
+        {
+            twi_timeouts_reset();
+        }
+        else
+        {
+            cprintf("ERROR - usage: i2c tmo [save|load|reset]\r\n");
+            return;
+        }
+    }
+
+    cprintf("  dev   phase  samples  p99 us  timeout us  expired\r\n");
+    for(i = 0; twi_latency_get(i, &addr, lat) == 0; i++)
+    {
+        for(p = 0; p < TWI_TMO_PHASES; p++)
+        {
+            cprintf("  0x%02X  %S  %7u  %6lu  %10lu  %7u\r\n", addr,
+                    (p == TWI_TMO_START) ? PSTR("start") : PSTR("xfer "),
+                    lat[p].samples, twi_latency_p99(&lat[p]),
+                    lat[p].timeoutUs ? lat[p].timeoutUs : TWI_TIMEOUT_US,
+                    lat[p].timeouts);
+        }
+    }
+    cprintf("  dev 0x00 is every device without a profile\r\n");
+}
+
+void cmdI2cRecover(cmd_args_t *args)
 {
-    printf("I2C Serial Commands:\r\n");
-    printf("  i2c scan - scan all addresses and report active ones\r\n");
-    return;
+    twi_recovery_t stats;
+
+    if(args->argc > 0 && strcmp_P(args->argv[0], PSTR("run")) == STRINGS_MATCH)
+    {
+        cprintf("  recovery %s\r\n", (twi_bus_recover() == 0) ? "ok" : "failed, bus still low");
+    }
+
+    twi_recovery_stats(&stats, args->argc > 0 && strcmp_P(args->argv[0], PSTR("clear")) == STRINGS_MATCH);
+    cprintf("  recoveries = %u, failed = %u, SCL pulses = %u\r\n",
+            stats.count, stats.failed, stats.pulses);
+    cprintf("  last = %lu us, longest = %lu us\r\n", stats.lastUs, stats.maxUs);
+}
+
+void cmdI2cSpeed(cmd_args_t *args)
+{
+    uint32_t target = 0;
+
+    if(args->argc > 0)
+    {
+        target = args->val[0];
+        if(twi_set_speed(target) == 0)
+        {
+            cprintf("ERROR - SCL %lu Hz out of range\r\n", target);
+            return;
+        }
+    }
+    displayI2cSpeed(target);
 }
 
 
 /*******************************************************************************
-*                             PROCESS SERIAL COMMANDS                          *
+*                              DISPLAY I2C SPEED                               *
 ********************************************************************************
-* Description: Process Serial commands.  If we are here the first, mux, part
-*              of the command has been processed
+* Description: Display the bus SCL frequency and its error against a target
 *
 *      Global: None
 *
-*   Arguments: serCmd
+*   Arguments: target - requested SCL frequency, 0 if none
 *
 *      Return: None
 *******************************************************************************/
-void processI2cSerialCmd(char *serCmd)
+void displayI2cSpeed(uint32_t target)
 {
-    char *ptr_cmd;
-    int   int_val;
-    int   n;
-
-    ptr_cmd = strtok(NULL, TOKEN_DELIMINATORS);
+    uint32_t actual = twi_get_speed();
+    int32_t  error;
 
-    if(strcmp(ptr_cmd, "scan") == STRINGS_MATCH)
-    {
-          printf("\r\n\r\nI2C bus scanner starting ...\r\n\r\n");
-          n = i2cscan();
-          printf("\r\n%u devices found\r\n", n);
-          printf("scan complete\r\n");
-    }
-    else
+    cprintf("  SCL = %lu Hz\r\n", actual);
+    if(target > 0)
     {
-        printf("ERROR - unknown serial command = %s\r\n", serCmd);
+        // error in 0.1% units
+        error = ((int32_t)actual - (int32_t)target) * 1000 / (int32_t)target;
+        cprintf("  target = %lu Hz, error = %c%ld.%ld%%\r\n", target,
+               (error < 0) ? '-' : '+', labs(error) / 10, labs(error) % 10);
     }
 }
 
@@ -2,6 +2,7 @@
 #define __i2c_h__
 
 #include <inttypes.h>
+#include "serialPortCmd.h"
 
 /*
  * define some handy I2C constants
@@ -9,12 +10,14 @@
 #define I2C_START     (_BV(TWINT)|_BV(TWSTA)|_BV(TWEN))
 #define I2C_MASTER_TX (_BV(TWINT)|_BV(TWEN))
 #define I2C_TIMEOUT   1000
+#define I2C_TIMEOUT_US (I2C_TIMEOUT * 1000UL)   // usec
+#define I2C_STOP_TIMEOUT_US 1000UL              // usec
 #define I2C_ACK       1
 #define I2C_NACK      0
 
 int8_t i2c_stop(void);
 
-void i2c_error(const char * message, uint8_t cr, uint8_t status);
+void i2c_error(uint8_t msg, uint8_t cr, uint8_t status);
 
 int8_t i2c_start(uint8_t expected_status, uint8_t verbose);
 
@@ -27,7 +30,10 @@ int8_t i2c_data_rx(uint8_t * data, uint8_t ack, uint8_t expected_status,
                    uint8_t verbose);
                    
                    
-void displayI2cSerialCmdHelp(void);
-void processI2cSerialCmd(char *ptrCmd);
+void cmdI2cScan(cmd_args_t *args);
+void cmdI2cRecover(cmd_args_t *args);
+void cmdI2cSpeed(cmd_args_t *args);
+void cmdI2cTmo(cmd_args_t *args);
+void displayI2cSpeed(uint32_t target);
 
 #endif
@@ -0,0 +1,169 @@
+/*******************************************************************************
+*   File Name: log.c
+*
+* Description: Diagnostic log output.  A record is a message ID and its
+*              arguments; the text lives in logMessages.h and is expanded on
+*              the host.  See log.h.
+*******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <avr/pgmspace.h>
+#include "log.h"
+#include "binaryCmd.h"
+#include "uart.h"
+#include "serialPortCmd.h"
+#include "console.h"
+
+#define LOG_MIN(a, b)       (((a) < (b)) ? (a) : (b))
+
+// largest record: id plus LOG_MAX_ARGS 5 byte varints
+#define LOG_REC_MAX         (1 + 5 * LOG_MAX_ARGS)
+#define LOG_FRAME_MAX       (LOG_REC_MAX + BIN_HDR_LEN + BIN_CRC_LEN + 2)
+
+
+/*
+ * runtime levels, never above the compile time level.  TWI errors start off,
+ * as the old verbose flag did.
+ */
+uint8_t logLevel[LOG_SUB_COUNT] =
+{
+    LOG_NONE,                               // LOG_SUB_TWI
+    LOG_MIN(LOG_ERROR, LOG_LEVEL_I2C),      // LOG_SUB_I2C
+    LOG_MIN(LOG_INFO,  LOG_LEVEL_HUMID),    // LOG_SUB_HUMID
+    LOG_MIN(LOG_INFO,  LOG_LEVEL_MUX),      // LOG_SUB_MUX
+};
+
+static const uint8_t logLevelMax[LOG_SUB_COUNT] =
+{
+    LOG_LEVEL_TWI, LOG_LEVEL_I2C, LOG_LEVEL_HUMID, LOG_LEVEL_MUX
+};
+
+#define LOG_NAME_LEN        6
+
+static const char logSubName[LOG_SUB_COUNT][LOG_NAME_LEN] PROGMEM =
+{
+    "twi", "i2c", "humid", "mux"
+};
+static const char logLevelName[LOG_DEBUG + 1][LOG_NAME_LEN] PROGMEM =
+{
+    "none", "error", "warn", "info", "debug"
+};
+
+static uint8_t  logSeq;             // binary record sequence number
+static uint16_t logDropped;         // binary records lost to a full UART
+
+
+/******************************************************************************
+*                                 EMIT RECORD                                 *
+*******************************************************************************
+* Description: Send one log record.  In binary mode it is dropped and
+*              counted if the transmit ring is full, logging never stalls a
+*              driver there.  On the text console it is sent like any other
+*              output.
+*
+*   Arguments: id    - LOG_ID_xxx
+*              args  - arguments
+*              count - number of arguments
+*
+*      Return: None
+******************************************************************************/
+void log_emit(uint8_t id, const int32_t *args, uint8_t count)
+{
+    uint8_t  rec[LOG_REC_MAX];
+    uint8_t  len = 0;
+    uint8_t  i;
+    uint32_t zz;
+
+    if(count > LOG_MAX_ARGS)
+    {
+        count = LOG_MAX_ARGS;
+    }
+
+    if(!binaryCmdActive())
+    {
+        cprintf("~%u", id);
+        for(i = 0; i < count; i++)
+        {
+            cprintf(" %ld", args[i]);
+        }
+        cprintf("\r\n");
+        return;
+    }
+
+    rec[len++] = id;
+    for(i = 0; i < count; i++)
+    {
+        // zigzag, so small negative numbers are short too
+        zz = ((uint32_t)args[i] << 1) ^ (uint32_t)(args[i] >> 31);
+        while(zz >= 0x80)
+        {
+            rec[len++] = (zz & 0x7F) | 0x80;
+            zz >>= 7;
+        }
+        rec[len++] = zz;
+    }
+
+    if(uart_tx_free() < LOG_FRAME_MAX)
+    {
+        logDropped++;
+        return;
+    }
+    binarySendPacket(BIN_EVT_LOG, logSeq++, rec, len);
+}
+
+
+/******************************************************************************
+*                             LOG SERIAL COMMAND                              *
+*******************************************************************************
+* Description: "log [sub level]", display the log levels after setting one
+*
+*      Global: logLevel
+*
+*   Arguments: args - parsed arguments
+*
+*      Return: None
+******************************************************************************/
+void cmdLog(cmd_args_t *args)
+{
+    uint8_t  sub;
+    uint8_t  level;
+
+    if(args->argc > 0)
+    {
+        for(sub = 0; sub < LOG_SUB_COUNT; sub++)
+        {
+            if(strcmp_P(args->argv[0], logSubName[sub]) == STRINGS_MATCH)
+            {
+                break;
+            }
+        }
+        for(level = 0; args->argc > 1 && level <= LOG_DEBUG; level++)
+        {
+            if(strcmp_P(args->argv[1], logLevelName[level]) == STRINGS_MATCH)
+            {
+                break;
+            }
+        }
+
+        if(sub == LOG_SUB_COUNT || args->argc < 2 || level > LOG_DEBUG)
+        {
+            cprintf("ERROR - usage: log <twi|i2c|humid|mux> <none|error|warn|info|debug>\r\n");
+            return;
+        }
+        if(level > logLevelMax[sub])
+        {
+            cprintf("  %S is limited to %S at compile time\r\n",
+                    logSubName[sub], logLevelName[logLevelMax[sub]]);
+            level = logLevelMax[sub];
+        }
+        logLevel[sub] = level;
+    }
+
+    for(sub = 0; sub < LOG_SUB_COUNT; sub++)
+    {
+        cprintf("  %S = %S (max %S)\r\n", logSubName[sub],
+                logLevelName[logLevel[sub]], logLevelName[logLevelMax[sub]]);
+    }
+    cprintf("  binary records dropped = %u\r\n", logDropped);
+}
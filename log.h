@@ -0,0 +1,97 @@
+/*******************************************************************************
+*   File Name: log.h
+*
+* Description: Data and definitions for log.c, per subsystem diagnostics.
+*
+*              LOG(sub, level, msg, args...) logs message LOG_ID_msg from
+*              logMessages.h.  A level above the subsystem's compile time
+*              LOG_LEVEL_sub is compiled out completely, arguments included.
+*              Below that the runtime level, set with the "log" command,
+*              decides.
+*
+*              Only the message ID and the arguments are sent.  In binary
+*              mode that is a BIN_EVT_LOG event:
+*
+*                msg id(1)  args...     each arg a zigzag varint, 1-5 bytes
+*
+*              and on the text console a line "~<id> <arg> ...".  The host
+*              expands either from logMessages.h.
+*******************************************************************************/
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <inttypes.h>
+#include "binaryCmd.h"
+#include "serialPortCmd.h"
+
+#define BIN_EVT_LOG     (BIN_EVT_BASE + 1)
+
+#define LOG_NONE        0
+#define LOG_ERROR       1
+#define LOG_WARN        2
+#define LOG_INFO        3
+#define LOG_DEBUG       4
+
+/*
+ * subsystems
+ */
+#define LOG_SUB_TWI     0
+#define LOG_SUB_I2C     1
+#define LOG_SUB_HUMID   2
+#define LOG_SUB_MUX     3
+#define LOG_SUB_COUNT   4
+
+/*
+ * compile time levels, override with -DLOG_LEVEL_xxx=n
+ */
+#ifndef LOG_LEVEL_TWI
+#define LOG_LEVEL_TWI   LOG_ERROR
+#endif
+#ifndef LOG_LEVEL_I2C
+#define LOG_LEVEL_I2C   LOG_ERROR
+#endif
+#ifndef LOG_LEVEL_HUMID
+#define LOG_LEVEL_HUMID LOG_DEBUG
+#endif
+#ifndef LOG_LEVEL_MUX
+#define LOG_LEVEL_MUX   LOG_DEBUG
+#endif
+
+#define LOG_MAX_ARGS    6
+
+/*
+ * message IDs
+ */
+enum
+{
+#define LOG_MSG(id, fmt)    LOG_ID_##id,
+#include "logMessages.h"
+#undef LOG_MSG
+    LOG_ID_COUNT
+};
+
+#define LOG_ENABLED(sub, level)  (LOG_LEVEL_##sub >= (level) && \
+                                  logLevel[LOG_SUB_##sub] >= (level))
+
+#define LOG_ID(sub, level, id, ...)                                         \
+    do                                                                      \
+    {                                                                       \
+        if(LOG_ENABLED(sub, LOG_##level))                                   \
+        {                                                                   \
+            const int32_t log_args_[] = { 0, ##__VA_ARGS__ };               \
+            log_emit((id), &log_args_[1],                                   \
+                     sizeof(log_args_) / sizeof(log_args_[0]) - 1);         \
+        }                                                                   \
+    } while(0)
+
+#define LOG(sub, level, msg, ...)   LOG_ID(sub, level, LOG_ID_##msg, ##__VA_ARGS__)
+
+
+extern uint8_t logLevel[LOG_SUB_COUNT];
+
+// global functions
+void    log_emit(uint8_t id, const int32_t *args, uint8_t count);
+void    cmdLog(cmd_args_t *args);
+
+
+#endif  // end __LOG_H__
@@ -0,0 +1,48 @@
+/*******************************************************************************
+*   File Name: logMessages.h
+*
+* Description: Log message table.  Included by log.h to number the messages;
+*              the text never goes into the firmware.  tools/mfgproto.py reads
+*              this file to expand log records on the host, so keep one
+*              LOG_MSG() per line.  Message IDs are assigned in the order
+*              listed: append new messages at the end.
+*
+*              Format conversions are the console.h set; every argument is
+*              widened to 32 bits, so %d and %ld are the same.
+*******************************************************************************/
+
+// twi_utils.c
+LOG_MSG(TWI_START_ERROR,    "TWI START CONDITION ERROR TWCR=%02x STATUS=%02x")
+LOG_MSG(TWI_START_TIMEOUT,  "TWI START CONDITION TIMEOUT TWCR=%02x STATUS=%02x")
+LOG_MSG(TWI_STOP_TIMEOUT,   "TWI STOP TIMEOUT TWCR=%02x STATUS=%02x")
+LOG_MSG(TWI_XFER_ERROR,     "TWI transfer to 0x%02x failed: result=%d phase=%d TWCR=%02x STATUS=%02x")
+
+// i2c.c
+LOG_MSG(I2C_START_ERROR,    "I2C START CONDITION ERROR TWCR=%02x STATUS=%02x")
+LOG_MSG(I2C_SLA_W_ERROR,    "I2C SLAVE ADDRESS ERROR TWCR=%02x STATUS=%02x")
+LOG_MSG(I2C_DATA_TX_ERROR,  "I2C DATA TX ERROR TWCR=%02x STATUS=%02x")
+LOG_MSG(I2C_DATA_RX_ERROR,  "I2C DATA RX ERROR TWCR=%02x STATUS=%02x")
+LOG_MSG(I2C_TIMEOUT,        "I2C TIMEOUT TWCR=%02x STATUS=%02x")
+
+// humiditySensor.c
+LOG_MSG(HUMID_MR,           "measurement request addr=0x%02x result=%d")
+LOG_MSG(HUMID_READ_RAW,     "sensor read addr=0x%02x result=%d data=%02x %02x %02x %02x")
+LOG_MSG(HUMID_STATUS,       "sensor status=%d")
+LOG_MSG(HUMID_RH_RAW,       "rh raw=%u, %d centi-%%RH")
+LOG_MSG(HUMID_TEMP_RAW,     "temp raw=%u, %d centi-C")
+
+// muxPCA9546.c
+LOG_MSG(MUX_RESET,          "mux reset")
+LOG_MSG(MUX_CONFIG,         "mux config=0x%02x status=%d")
+LOG_MSG(MUX_ENABLE,         "mux enable channel %d cmd=0x%02x status=%d")
+LOG_MSG(MUX_DISABLE,        "mux disable channel %d cmd=0x%02x status=%d")
+
+// humiditySensor.c, measurement update
+LOG_MSG(HUMID_UPDATE_RETRY, "update retry %d in %d ms, new request=%d")
+LOG_MSG(HUMID_UPDATE_FAILED, "update failed after %d retries, result=%d")
+
+// muxPCA9546.c, tree discovery
+LOG_MSG(MUX_FOUND,          "mux 0x%02x behind 0x%02x channel %d, %d channels")
+
+// twi_utils.c, stuck bus recovery
+LOG_MSG(TWI_BUS_RECOVERY,   "bus recovery pulses=%d us=%ld status=%d")
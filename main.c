@@ -15,29 +15,26 @@
 #include "main.h"
 #include <util/delay.h>
 #include "HumiditySensor.h"
+#include "humidityArray.h"
 #include "serialPortCmd.h"
 #include "led.h"
 #include "twi_utils.h"
 #include "timers.h"
 #include "muxPCA9546.h"
+#include "uart.h"
+#include "binaryCmd.h"
+#include "telemetry.h"
+#include "console.h"
 
 
 // global data
-volatile uint16_t ms_count;
-
-// serial port input circular buffer
-uint8_t           data;
-uint8_t           rxBuf[RX_BUFFER_SIZE];
-uint8_t           ptrRxBufStart;
-uint8_t           ptrRxBufEnd;
+sw_timer_t        ledTimer;
 
 // serial port command
-uint8_t           cmdBuf[CMD_BUFFER_SIZE];
-uint8_t           ptrCmdBuf;
-
-// printf support
-FILE uartstr = FDEV_SETUP_STREAM(UartPutChar, UartGetChar, _FDEV_SETUP_RW);
+cmd_line_t        cmdLine;
 
+// local functions
+static void blinkLED(sw_timer_t *timer);
 
 
 /******************************************************************************
@@ -52,74 +49,42 @@ FILE uartstr = FDEV_SETUP_STREAM(UartPutChar, UartGetChar, _FDEV_SETUP_RW);
 ******************************************************************************/
 int main(void)
 {    
-    ptrRxBufStart  = 0;
-    ptrRxBufEnd    = 0;
-    ptrCmdBuf      = 0;
-    rxBuf[0]       = '\0';
+    cmdLineReset(&cmdLine);
         
     init_timers();
     init_usart0();
     init_twi();
+    initHumiditySensor();
     
-    // enable printf
-    stdout=stdin=&uartstr;
-      
     // enable interrupts
     sei();
     
     initMux();
+    twi_timeouts_load();    // seed the learned TWI timeouts, devices are registered
 
-    DDRB = 0x01;    // enable PORTB 1 as an output (LED)
+    DDRB |= _BV(PB0);   // LED output; leave the UART CTS pin (PB4) alone
     
-    printf("\r\n\r\nAerosole Devices Manufacturing Test Program\r\n");
+    cprintf("\r\n\r\nAerosole Devices Manufacturing Test Program\r\n");
     displaySerialCmdHelp();
-    printf(">");
+    cprintf(">");
+
+    // blink LED
+    swtimer_start(&ledTimer, 250, 250, blinkLED, NULL);
 
     while (1)
     {
-        // blink LED if time has elapsed
-        if(ms_count > 250)
-        {
-            ms_count = 0;
-            toggleLED(); 
-        } 
-        
+        swtimer_service();
+        uart_service();
+        twi_service();
+        humidity_service();
+        humidityArray_service();
+        telemetry_service();
         getCommandData();           
     }
     
     return 0;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-////////////////////////////// INTERRUPT HANDLERS /////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-
-/******************************************************************************
-*                               USART0 RXC ISR                                *
-*******************************************************************************
-* Description: UART 0 receive complete interrupt service routine
-*
-*      Global: uint8_t rx_buf[RX_BUFFER_SIZE] - receive character buffer
-******************************************************************************/
-ISR(USART0_RX_vect)
-{
-    // read received character
-    data = UDR0;
-    
-    // echo the received character back
-    UDR0 = data;
-    
-    // copy received character to circular buffer
-    rxBuf[ptrRxBufEnd++] = data;
-    if(ptrRxBufEnd == RX_BUFFER_SIZE)
-    {
-        ptrRxBufEnd = 0;
-    }
-    rxBuf[ptrRxBufEnd] = '\0';
-}
-
-
-
 ///////////////////////////////////////////////////////////////////////////////
 //////////////////////////// PUBLIC MEMBER FUNCTIONS //////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
@@ -127,20 +92,16 @@ ISR(USART0_RX_vect)
 /******************************************************************************
 *                            GET SERIAL COMMAND DATA                          *
 *******************************************************************************
-* Description: Moves any new serial command data from serial data buffer to 
-*              command buffer then checks for end of command ("\n").  If end
-*              of command is found then the command is processed.
+* Description: Feeds any new serial command data to the command line, which
+*              tokenizes it as it arrives, then processes the command at the
+*              end of the line.  While a baud rate change waits for the
+*              host to confirm it the data goes to uart_baud_rx() instead.
 *
 *              Supported special characters:
-*                '\n'   10(0x0A) line feed
+*                '\n'   10(0x0A) line feed       - word separator
 *                '\r'   13(0x0D) carriage return - end of command
-*                
 *
-*      Global: cmdBuf[CMD_BUFFER_SIZE];
-*              ptrCmdBuf
-*              rxBuf[RX_BUFFER_SIZE] - circular buffer for RX data
-*              ptrRxBufStart         - data extraction point in RX buffer
-*              ptrRxBufEnd           - next insert point in RX buffer
+*      Global: cmdLine
 *
 *   Arguments: None
 *
@@ -150,34 +111,28 @@ void getCommandData(void)
 {   
     uint8_t ser_data;
     
-    while(ptrRxBufStart != ptrRxBufEnd)
+    while(uart_rx_get(&ser_data))
     {
-        // get data byte
-        ser_data = rxBuf[ptrRxBufStart++];
-        if(ptrRxBufStart == RX_BUFFER_SIZE)
-            ptrRxBufStart = 0;
-            
-        // process special characters
-        if(ser_data == '\r')    // carriage return
+        if(uart_baud_pending())
+        {
+            uart_baud_rx(ser_data);
+            continue;
+        }
+
+        if(binaryCmdActive())
+        {
+            binaryCmdRxByte(ser_data);
+            continue;
+        }
+
+        if(cmdLinePut(&cmdLine, ser_data) == CMD_LINE_DONE)
         {
             // end of command
-            printf("\r\n>");
-            cmdBuf[ptrCmdBuf] = '\0';
-            processSerialCommand((char *)cmdBuf);
-            ptrCmdBuf = 0;
-            cmdBuf[0] = '\0';
+            cprintf("\r\n>");
+            processSerialCommand(&cmdLine);
+            cmdLineReset(&cmdLine);
+            toggleLED();
         }
-        else
-        { 
-        // move data to command buffer
-        cmdBuf[ptrCmdBuf++] = ser_data;
-        if(ptrCmdBuf == CMD_BUFFER_SIZE)
-            ptrCmdBuf = 0;
-            
-        // terminate command string
-        cmdBuf[ptrCmdBuf] = '\0';
-        }               
-        toggleLED();
     }     
 }
 
@@ -203,140 +158,20 @@ void writeToSerialPort(char *msg)
    
 
 
-/******************************************************************************
-*                              INITIALIZE UART                                *
-*******************************************************************************
-* Description: Initialize USART0: 9600, 8, N, 1 with no flow control.
-
-*              UBRR0L - USART0 baud rate register low
-*              UBRR0H - USART0 baud rate register high
-*              UCSR0A - USART0 control and status register A. p188
-*              UCSR0B - USART0 control and status register B, p189
-*              UCSR0C - USART0 control and status register C
-*              DDRE   - Data Direction Register Port E
-*
-*              Processor Parameters:
-*              clock - 16MHz
-*              RXD0/(PDI)  - PE0 - Pen  2
-*              TXD0/(PDO)  - PE1 - Pen  3 - 
-*              XCK0/(AIN0) - PE2 - Pen  4
-*              OC0         - PB4 - Pen 14
-*
-*   Arguments: None
-*
-*      Return: None
-******************************************************************************/
-void init_usart0(void)
-{
-    // Initialize the baud rate registers for 9600
-    UBRR0H = (UBRR) >> 8; 
-    UBRR0L = (UBRR) &  0xFF;
-    
-    // Enable the receiver, transmitter, and receive complete interrupt
-    UCSR0B = (1 << RXEN0)  | (1 << TXEN0) | (1 << RXCIE0);
-     
-    // Set the USART data size to 8b, no parity, one stop bit
-    UCSR0C = (1 << UCSZ00) | (1 << UCSZ01);
-    
-    // Set the TX line (PE1) to be an output.      
-    DDRE  |= (1 << 1);                      
-}
-
+///////////////////////////////////////////////////////////////////////////////
+/////////////////////////// PRIVATE MEMBER FUNCTIONS //////////////////////////
+///////////////////////////////////////////////////////////////////////////////
 
 /******************************************************************************
-*                               TRANSMIT UART                                 *
+*                                  BLINK LED                                  *
 *******************************************************************************
-* Description: Blocking single byte transmit on USART0
-*              UCSR0A - UART0 Control and Status Register A, p188
-*              UDR0   - UART0 I/O Data Register, p188
+* Description: LED blink timer callback
 *
-*   Arguments: data - data to transmit
+*   Arguments: timer - LED timer
 *
 *      Return: None
 ******************************************************************************/
-void transmit_usart0(uint8_t data)
-{   
-    // wait until the UDRE0 flag (data register empty) in the UCSRA0 register 
-    // is set.
-    while(!(UCSR0A & (1 << UDRE0)))
-    ; 
-    
-    // Start next transmission by writing to UDR0
-    UDR0 = data;
-    //_delay_ms(2);                    
-}
-
-
-/******************************************************************************
-*                              UART HAS RX DATA                               *
-*******************************************************************************
-* Description: Checks the USART0 Rx complete status flag 
-*
-*   Arguments: None
-*
-*      Return: true if there is RX data in the buffer
-******************************************************************************/
-uint8_t usart0_has_rx_data(void)
-{
-    return (UCSR0A & (1 << RXC0)) != 0;
-}
-
-
-/******************************************************************************
-*                               RECEIVE UART                                  *
-*******************************************************************************
-* Description: Reads data from the USART receive buffer 
-*              UDR0 - UART0 Data Register
-*
-*   Arguments: None
-*
-*      Return: character received (8bits)
-******************************************************************************/
-uint8_t receive_usart0(void)
-{
-    uint8_t ret_val = UDR0; // Read data register
-    return ret_val;         // Return read value
-}
-
-
-/******************************************************************************
-*                            UART PUT CHARACTER                               *
-*******************************************************************************
-* Description: Implementation of putc so that printf with work.  UART0 is used 
-*              for output.
-*
-*   Arguments: c      - char to send to UART0
-*              stream - 
-*
-*      Return: 0
-******************************************************************************/
-int UartPutChar(char c, FILE* stream) 
-{
-    while(!(UCSR0A & (1 << UDRE0)));
-    UDR0 = c;
-    return 0;
-}
-
-
-/******************************************************************************
-*                            UART GET CHARACTER                               *
-*******************************************************************************
-* Description: Implementation of getc so that printf with work.  UART0 is used
-*              for input.
-*
-*   Arguments: stream -
-*
-*      Return: character read from UART0
-******************************************************************************/
-int UartGetChar(FILE* stream) 
+static void blinkLED(sw_timer_t *timer)
 {
-    char c;
-    while(!(UCSR0A & (1 << RXC0)));
-    c = UDR0;
-    return c;
+    toggleLED();
 }
-
-
-///////////////////////////////////////////////////////////////////////////////
-/////////////////////////// PRIVATE MEMBER FUNCTIONS //////////////////////////
-///////////////////////////////////////////////////////////////////////////////
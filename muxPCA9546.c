@@ -11,6 +11,8 @@
 #include "twi_utils.h"
 #include "muxPCA9546.h"
 #include "timers.h"
+#include "console.h"
+#include "log.h"
  
  
 //-----------------------------------------------------------------------------
@@ -32,7 +34,13 @@
 // Private Data and Definitions
 //-----------------------------------------------------------------------------
 
-#define STRINGS_MATCH    0
+// the control register shadow is kept by the TWI engine, twi_mux_cached(),
+// from every transaction to the mux, whoever sends it
+static mux_stats_t  muxStats;
+
+// tree from muxDiscover(), main bus muxes first, then breadth first
+static mux_node_t   muxTree[MUX_MAX_NODES];
+static uint8_t      muxNodes;
 
 
 
@@ -52,7 +60,9 @@
 *******************************************************************************/
 void resetMux(void)
 {
-    printf("Resetting MUX\r\n");
+    uint8_t i;
+
+    LOG(MUX, INFO, MUX_RESET);
     
     // reset MUX to power on state
     PORTD &= ~0x10;     // set output low for 5msec
@@ -60,14 +70,52 @@ void resetMux(void)
     PORTD |= 0x10;      // set output high
     ms_sleep(5);
     
-    getMuxConfiguration();
+    for(i = 0; i < muxNodes; i++)
+    {
+        twi_mux_invalidate(muxTree[i].addr);
+    }
+    twi_mux_invalidate(MUX_PCA9546_I2C_ADDR);
+    muxSync();
+}
+
+
+/*******************************************************************************
+*                          RESET MUX AFTER BUS RECOVERY                        *
+********************************************************************************
+* Description: TWI bus recovery hook.  Pulses the same PD4 reset line as
+*              resetMux(), only briefly, /RESET low needs 6 nsec: every
+*              channel is deselected so a slave behind the mux can no
+*              longer hold the main bus.  No bus traffic, the recovery
+*              holds the TWI queue; the control registers are read again
+*              when next needed.
+*
+*      Global: muxTree, muxNodes
+*
+*   Arguments: None
+*
+*      Return: None
+*******************************************************************************/
+static void muxRecoverReset(void)
+{
+    uint8_t i;
+
+    PORTD &= ~0x10;
+    us_sleep(1);
+    PORTD |= 0x10;
+
+    for(i = 0; i < muxNodes; i++)
+    {
+        twi_mux_invalidate(muxTree[i].addr);
+    }
+    twi_mux_invalidate(MUX_PCA9546_I2C_ADDR);
 }
 
 
 /*******************************************************************************
 *                                INITIALIZE MUX                                *
 ********************************************************************************
-* Description: Configures MUX
+* Description: Configures MUX and discovers the mux tree for routed
+*              transactions
 *
 *      Global: None
 *
@@ -81,7 +129,12 @@ void initMux(void)
     DDRD  |= 0x10;      // port direction is output
     PORTD |= 0x10;      // set output high
     
+    // PCA9546 supports fast mode (400 kHz) I2C
+    twi_register_device(MUX_PCA9546_I2C_ADDR, TWI_SCL_FAST, 0);
+    twi_set_recover_hook(muxRecoverReset);
+    
     resetMux();         // reset MUX to power on state
+    muxDiscover();
     
     // enable MUX channel for humidity sensor: either 2 or 3
     enableMuxOutputChannel(2);      // enable channel 2
@@ -89,30 +142,90 @@ void initMux(void)
 }
 
 
+/*******************************************************************************
+*                               SYNC MUX SHADOW                                *
+********************************************************************************
+* Description: Read the control register, which refreshes the shadow copy
+*
+*      Global: muxStats
+*
+*   Arguments: None
+*
+*      Return: 0 or a TWI error, the shadow stays invalid on error
+*******************************************************************************/
+int8_t muxSync(void)
+{
+    uint8_t data_buf[1];
+    int     ret_code;
+
+    data_buf[0] = 0;
+    ret_code = twi_read_bytes(MUX_PCA9546_I2C_ADDR, 1, data_buf);
+    LOG(MUX, DEBUG, MUX_CONFIG, data_buf[0], ret_code);
+    muxStats.reads++;
+
+    return (ret_code < 0) ? ret_code : 0;
+}
+
+
 /*******************************************************************************
 *                             GET MUX CONFIGURATION                            *
 ********************************************************************************
-* Description: Sets MUX output channel state: either on or off.  Each channel
-*              consists of a data and clock line.  Uses I2C to
-*              control MUX.
-*              Note: multiple channels can be enabled
+* Description: Get the MUX output channel state, one bit per channel.  Comes
+*              from the shadow copy; the device is read only when the shadow
+*              is not valid.
 *
-*      Global: None
+*      Global: muxStats
 *
-*   Arguments: channelID
+*   Arguments: None
 *
-*      Return: None
+*      Return: control register, 0 if it cannot be read
 *******************************************************************************/
 uint8_t getMuxConfiguration(void)
 {
-    uint8_t data_buf[5];
-    uint8_t data_len = 1;
-    int     ret_code = 0;
+    uint8_t cfg = 0;
+
+    if(twi_mux_cached(MUX_PCA9546_I2C_ADDR, &cfg) > 0)
+    {
+        muxStats.saved++;
+    }
+    else if(muxSync() == 0)
+    {
+        twi_mux_cached(MUX_PCA9546_I2C_ADDR, &cfg);
+    }
+    return cfg;
+}
+
+
+/*******************************************************************************
+*                             SELECT MUX CHANNELS                              *
+********************************************************************************
+* Description: Enable exactly the channels in mask, one bit per channel, in
+*              a single write.  Nothing is written if the shadow says the
+*              mux is already set that way.
+*
+*      Global: muxStats
+*
+*   Arguments: mask - channels to enable
+*
+*      Return: 0 or a TWI error
+*******************************************************************************/
+int8_t muxSelectChannels(uint8_t mask)
+{
+    uint8_t data_buf[1];
+    uint8_t cfg;
+    int     ret_code;
 
-    ret_code = twi_read_bytes(MUX_PCA9546_I2C_ADDR, data_len, data_buf);
-    printf("  mux config = 0x%X, status = %d\r\n", data_buf[0], ret_code);
+    if(twi_mux_cached(MUX_PCA9546_I2C_ADDR, &cfg) > 0 && cfg == mask)
+    {
+        muxStats.saved++;
+        return 0;
+    }
+
+    data_buf[0] = mask;
+    ret_code = twi_write_bytes(MUX_PCA9546_I2C_ADDR, 1, data_buf);
+    muxStats.writes++;
 
-    return data_buf[0];
+    return (ret_code < 0) ? ret_code : 0;
 }
 
  
@@ -128,25 +241,15 @@ uint8_t getMuxConfiguration(void)
 *  
 *   Arguments: channelID
 *  
-*      Return: None
+*      Return: 0 or a TWI error
 *******************************************************************************/
 int8_t enableMuxOutputChannel(uint8_t channelID)
 {
-    uint8_t data_buf[2];
-    uint8_t data_len     = 1;
-    int     ret_code     = 0;
-    uint8_t channel_bit  = 1 << channelID;
+    int8_t ret_code;
+    uint8_t config = getMuxConfiguration() | (1 << channelID);
 
-    printf("enableMuxOutputChannel(chan = %d)\r\n", channelID);
-
-    data_buf[0]  = 0;
-    data_buf[0]  = getMuxConfiguration();
-    data_buf[0] |= channel_bit;
-
-    ret_code = twi_write_bytes(MUX_PCA9546_I2C_ADDR, data_len, data_buf);
-    printf("  enable mux channel %d, cmd = 0x%X, status = %d\r\n", channelID, data_buf[0], ret_code);
-    
-    getMuxConfiguration();
+    ret_code = muxSelectChannels(config);
+    LOG(MUX, DEBUG, MUX_ENABLE, channelID, config, ret_code);
     return ret_code;
 }
 
@@ -160,133 +263,485 @@ int8_t enableMuxOutputChannel(uint8_t channelID)
 *  
 *   Arguments: channelID - channel to disable
 *  
-*      Return: None
+*      Return: 0 or a TWI error
 *******************************************************************************/
 int8_t disableMuxOutputChannel(uint8_t channelID)
 {
-    uint8_t data_buf[5];
-    uint8_t data_len     = 1;
-    int     ret_code     = 0;
-    uint8_t channel_bit  = 1 << channelID;
-    
-    printf("disableMuxOutputChannel(chan = %d)\r\n", channelID);
-
-    data_buf[0]   = getMuxConfiguration();
-    data_buf[0]  &= ~channel_bit; 
+    int8_t ret_code;
+    uint8_t config = getMuxConfiguration() & ~(1 << channelID);
 
-    ret_code = twi_write_bytes(MUX_PCA9546_I2C_ADDR, data_len, data_buf);
-    printf("disable mux channel %d, cmd = 0x%X, status = %d\r\n", channelID, data_buf[0], ret_code);
-
-    getMuxConfiguration();
+    ret_code = muxSelectChannels(config);
+    LOG(MUX, DEBUG, MUX_DISABLE, channelID, config, ret_code);
     return ret_code;
 }
 
 
 /*******************************************************************************
-*                      CONFIGURE MUX FOR PRESSURE MEASUREMENT                  *
+*                              MUX STATISTICS                                  *
 ********************************************************************************
-* Description: Configures the MUX for pressure measurements with the specified
-*              transducer.  This is necessary because both pressure transducers
-*              (NPA700) are on I2C address 0x28.  So, to avoid address
-*              conflicts the differential pressure transducer is attached to
-*              MUX channel 0 and the absolute pressure transducer is attached
-*              to channel1.
+* Description: Bus traffic counters for the shadow register
 *
-*      Global: None
+*      Global: muxStats
 *
-*   Arguments: channelID - pressure channel to enable
+*   Arguments: stats - copied here
+*              clear - clear the counters after copying
 *
 *      Return: None
 *******************************************************************************/
-void setMuxPressureMeasurement(uint8_t pressureMeas)
+void muxGetStats(mux_stats_t *stats, uint8_t clear)
 {
-    if(pressureMeas == MUX_DIFF_PRESSURE)
+    *stats = muxStats;
+    if(clear)
     {
-       disableMuxOutputChannel(MUX_ABS_PRESSURE);
-       enableMuxOutputChannel(MUX_DIFF_PRESSURE);
+        memset(&muxStats, 0, sizeof(muxStats));
     }
-    else if(pressureMeas == MUX_ABS_PRESSURE) 
+}
+
+
+/*******************************************************************************
+*                                 PROBE ADDRESS                                *
+********************************************************************************
+* Description: Address a device behind a mux channel, or on the main bus,
+*              with an empty write.  The route to it is set up first, so
+*              nothing from another branch answers.
+*
+*   Arguments: parent  - mux in front of the device, 0 for the main bus
+*              channel - parent channel
+*              addr    - 7-bit address
+*
+*      Return: non zero if the device acknowledged
+*******************************************************************************/
+static uint8_t muxProbe(uint8_t parent, uint8_t channel, uint8_t addr)
+{
+    twi_dev_t  dev;
+    twi_xfer_t xfer;
+
+    dev.muxAddr = parent;
+    dev.channel = channel;
+    dev.addr    = addr;
+    twi_setup_dev_xfer(&xfer, &dev, NULL, 0, NULL, 0);
+    xfer.flags = TWI_XFER_PROBE;
+    return twi_transfer(&xfer) >= 0;
+}
+
+
+/*******************************************************************************
+*                             WRITE TREE MUX                                   *
+********************************************************************************
+* Description: Write a mux's control register through its parent's channel,
+*              or read it back
+*
+*   Arguments: node - mux
+*              cfg  - value to write, read back here if read is set
+*              read - read instead of write
+*
+*      Return: 0 or a TWI error
+*******************************************************************************/
+static int8_t muxNodeAccess(const mux_node_t *node, uint8_t *cfg, uint8_t read)
+{
+    twi_dev_t  dev;
+    twi_xfer_t xfer;
+    int        ret_code;
+
+    dev.muxAddr = node->parent;
+    dev.channel = node->parentChannel;
+    dev.addr    = node->addr;
+    if(read)
     {
-        disableMuxOutputChannel(MUX_DIFF_PRESSURE);
-        enableMuxOutputChannel(MUX_ABS_PRESSURE);  
+        twi_setup_dev_xfer(&xfer, &dev, NULL, 0, cfg, 1);
     }
     else
     {
-        printf("ERROR - invalid pressure meas spec = %d\r\n", pressureMeas);
+        twi_setup_dev_xfer(&xfer, &dev, cfg, 1, NULL, 0);
     }
+    ret_code = twi_transfer(&xfer);
+    return (ret_code < 0) ? ret_code : 0;
 }
 
 
 /*******************************************************************************
-*                             DISPLAY SERIAL COMMANDS                          *
+*                                ADD TREE MUX                                  *
 ********************************************************************************
-* Description: Display MUX serial command help
-*  
-*      Global: None
-*  
-*   Arguments: None
-*  
+* Description: Register a mux found behind parent's channel and size it.  A
+*              PCA9548 keeps control register bits 4 - 7, a PCA9546 has no
+*              such channels and reads them back as 0.  The mux is left with
+*              every channel disabled.
+*
+*      Global: muxTree, muxNodes
+*
+*   Arguments: addr    - 7-bit mux address
+*              parent  - mux in front of it, 0 for the main bus
+*              channel - parent channel
+*
 *      Return: None
 *******************************************************************************/
-void displayMuxSerialCmdHelp(void)
+static void muxAddNode(uint8_t addr, uint8_t parent, uint8_t channel)
 {
-    printf("MUX Serial Commands:\r\n");
-    printf("  mux cfg   - display mux configuration\r\n");
-    printf("  mux ena n - enable channel n\r\n");
-    printf("  mux dis n - disable channel n\r\n");
-    printf("  mux reset - reset mux\r\n");
-    printf("  mux pres n - set mux pressure measurement\r\n");
-    return;
+    mux_node_t *node;
+    uint8_t     cfg;
+
+    if(muxNodes >= MUX_MAX_NODES ||
+       twi_register_mux(addr, parent, channel) < 0)
+    {
+        return;
+    }
+    twi_register_device(addr, TWI_SCL_FAST, 0);
+
+    node                = &muxTree[muxNodes++];
+    node->addr          = addr;
+    node->parent        = parent;
+    node->parentChannel = channel;
+    node->channels      = 4;
+
+    cfg = 0xF0;
+    if(muxNodeAccess(node, &cfg, 0) == 0 && muxNodeAccess(node, &cfg, 1) == 0 &&
+       cfg == 0xF0)
+    {
+        node->channels = 8;
+    }
+    cfg = 0;
+    muxNodeAccess(node, &cfg, 0);
+
+    LOG(MUX, INFO, MUX_FOUND, addr, parent, channel, node->channels);
 }
 
 
 /*******************************************************************************
-*                             PROCESS SERIAL COMMANDS                          *
+*                               KNOWN MUX                                      *
 ********************************************************************************
-* Description: Process Serial commands.  If we are here the first, mux, part
-*              of the command has been processed
+* Description: Has a mux at this address already been found
+*
+*      Global: muxTree, muxNodes
+*
+*   Arguments: addr - 7-bit address
+*
+*      Return: non zero if found
+*******************************************************************************/
+static uint8_t muxKnown(uint8_t addr)
+{
+    uint8_t i;
+
+    for(i = 0; i < muxNodes; i++)
+    {
+        if(muxTree[i].addr == addr)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+*                              DISCOVER MUX TREE                               *
+********************************************************************************
+* Description: Find every mux at MUX_ADDR_FIRST - MUX_ADDR_LAST, including
+*              muxes cascaded behind other muxes' channels, and register the
+*              tree with the TWI engine so routed transactions can reach any
+*              channel.  Every mux address is first written 0, so a mux that
+*              kept channels enabled does not make the muxes behind it look
+*              like they are on the main bus.  Then the main bus is probed,
+*              and each channel of each mux found, breadth first; an address
+*              already in the tree is not probed again.  Every mux is left
+*              with its channels disabled.
+*
+*              Mux addresses must be unique across the tree and nothing but
+*              muxes may use them.  Muxes deeper in the tree are expected to
+*              share the PD4 reset, see resetMux().  Blocking, run at boot or
+*              from the console.
+*
+*      Global: muxTree, muxNodes
+*
+*   Arguments: None
+*
+*      Return: number of muxes found
+*******************************************************************************/
+uint8_t muxDiscover(void)
+{
+    twi_xfer_t xfer;
+    uint8_t    off = 0;
+    uint8_t    addr;
+    uint8_t    ch;
+    uint8_t    i;
+
+    twi_clear_muxes();
+    muxNodes = 0;
+
+    for(addr = MUX_ADDR_FIRST; addr <= MUX_ADDR_LAST; addr++)
+    {
+        twi_setup_xfer(&xfer, addr, &off, 1, NULL, 0);
+        xfer.flags = TWI_XFER_PROBE;
+        twi_transfer(&xfer);
+    }
+
+    for(addr = MUX_ADDR_FIRST; addr <= MUX_ADDR_LAST; addr++)
+    {
+        if(muxProbe(0, 0, addr))
+        {
+            muxAddNode(addr, 0, 0);
+        }
+    }
+
+    // muxNodes grows as muxes are found, so this is breadth first
+    for(i = 0; i < muxNodes; i++)
+    {
+        for(ch = 0; ch < muxTree[i].channels; ch++)
+        {
+            for(addr = MUX_ADDR_FIRST; addr <= MUX_ADDR_LAST; addr++)
+            {
+                if(!muxKnown(addr) && muxProbe(muxTree[i].addr, ch, addr))
+                {
+                    muxAddNode(addr, muxTree[i].addr, ch);
+                }
+            }
+        }
+    }
+    return muxNodes;
+}
+
+
+/*******************************************************************************
+*                              LEAF CHANNEL                                    *
+********************************************************************************
+* Description: Is a mux channel a sensor position, one with no mux behind it
+*
+*      Global: muxTree, muxNodes
+*
+*   Arguments: node    - mux
+*              channel - its channel
+*
+*      Return: non zero if no mux sits behind the channel
+*******************************************************************************/
+static uint8_t muxLeaf(const mux_node_t *node, uint8_t channel)
+{
+    uint8_t i;
+
+    for(i = 0; i < muxNodes; i++)
+    {
+        if(muxTree[i].parent == node->addr && muxTree[i].parentChannel == channel)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*******************************************************************************
+*                              POSITION COUNT                                  *
+********************************************************************************
+* Description: Number of sensor positions, leaf channels, in the tree
+*
+*      Global: muxTree, muxNodes
+*
+*   Arguments: None
+*
+*      Return: positions
+*******************************************************************************/
+uint8_t muxPositionCount(void)
+{
+    uint8_t n = 0;
+    uint8_t i;
+    uint8_t ch;
+
+    for(i = 0; i < muxNodes; i++)
+    {
+        for(ch = 0; ch < muxTree[i].channels; ch++)
+        {
+            n += muxLeaf(&muxTree[i], ch);
+        }
+    }
+    return n;
+}
+
+
+/*******************************************************************************
+*                                 POSITION                                     *
+********************************************************************************
+* Description: Route to a sensor position.  Positions number the leaf
+*              channels in tree order, so a single PCA9546 fixture has
+*              positions 0 - 3 on channels 0 - 3.
+*
+*      Global: muxTree, muxNodes
+*
+*   Arguments: position - 0 to muxPositionCount() - 1
+*              dev      - muxAddr and channel are set, addr is left alone
+*
+*      Return: 0, -1 if there is no such position
+*******************************************************************************/
+int8_t muxPosition(uint8_t position, twi_dev_t *dev)
+{
+    uint8_t i;
+    uint8_t ch;
+
+    for(i = 0; i < muxNodes; i++)
+    {
+        for(ch = 0; ch < muxTree[i].channels; ch++)
+        {
+            if(!muxLeaf(&muxTree[i], ch))
+            {
+                continue;
+            }
+            if(position-- == 0)
+            {
+                dev->muxAddr = muxTree[i].addr;
+                dev->channel = ch;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+
+/*******************************************************************************
+*                      CONFIGURE MUX FOR PRESSURE MEASUREMENT                  *
+********************************************************************************
+* Description: Configures the MUX for pressure measurements with the specified
+*              transducer.  This is necessary because both pressure transducers
+*              (NPA700) are on I2C address 0x28.  So, to avoid address
+*              conflicts the differential pressure transducer is attached to
+*              MUX channel 0 and the absolute pressure transducer is attached
+*              to channel1.
+*
+*      Global: None
+*
+*   Arguments: channelID - pressure channel to enable
+*
+*      Return: 0 or a TWI error
+*******************************************************************************/
+int8_t setMuxPressureMeasurement(uint8_t pressureMeas)
+{
+    uint8_t config = getMuxConfiguration() &
+                     ~((1 << MUX_DIFF_PRESSURE) | (1 << MUX_ABS_PRESSURE));
+
+    if(pressureMeas != MUX_DIFF_PRESSURE && pressureMeas != MUX_ABS_PRESSURE)
+    {
+        cprintf("ERROR - invalid pressure meas spec = %d\r\n", pressureMeas);
+        return 0;
+    }
+    return muxSelectChannels(config | (1 << pressureMeas));
+}
+
+
+/*******************************************************************************
+*                             MUX SERIAL COMMANDS                              *
+********************************************************************************
+* Description: MUX serial port commands, see serialPortCmd.c.  Each one ends
+*              with the mux configuration.
 *  
 *      Global: None
 *  
-*   Arguments: serCmd
+*   Arguments: args - parsed arguments
 *  
 *      Return: None
 *******************************************************************************/
-void processMuxSerialCmd(char *serCmd)
+static void displayMuxStatus(int8_t retCode)
+{
+    if(retCode < 0)
+    {
+        cprintf("  status = %d\r\n", retCode);
+    }
+    cprintf("  mux config = 0x%X\r\n", getMuxConfiguration());
+}
+
+void cmdMuxCfg(cmd_args_t *args)
+{
+    displayMuxStatus(0);
+}
+
+void cmdMuxEna(cmd_args_t *args)
+{
+    displayMuxStatus(enableMuxOutputChannel(args->val[0]));
+}
+
+void cmdMuxDis(cmd_args_t *args)
+{
+    displayMuxStatus(disableMuxOutputChannel(args->val[0]));
+}
+
+void cmdMuxReset(cmd_args_t *args)
+{
+    resetMux();
+    displayMuxStatus(0);
+}
+
+void cmdMuxPres(cmd_args_t *args)
+{
+    displayMuxStatus(setMuxPressureMeasurement(args->val[0]));
+}
+
+void cmdMuxSel(cmd_args_t *args)
 {
-    char *ptr_cmd;
-    int   int_val;
+    displayMuxStatus(muxSelectChannels(args->val[0]));
+}
 
-    ptr_cmd = strtok(NULL, TOKEN_DELIMINATORS);
+void cmdMuxTree(cmd_args_t *args)
+{
+    uint8_t i;
 
-    if(strcmp(ptr_cmd, "cfg")        == STRINGS_MATCH)
+    if(args->argc > 0 && strcmp_P(args->argv[0], PSTR("scan")) == STRINGS_MATCH)
     {
-        getMuxConfiguration();
+        muxDiscover();
     }
-    else if(strcmp(ptr_cmd, "ena")   == STRINGS_MATCH)
+
+    for(i = 0; i < muxNodes; i++)
     {
-        ptr_cmd = strtok(NULL, TOKEN_DELIMINATORS);
-        int_val = atoi(ptr_cmd);
-        enableMuxOutputChannel(int_val);
+        if(muxTree[i].parent == 0)
+        {
+            cprintf("  0x%02X: %u channels, main bus\r\n",
+                    muxTree[i].addr, muxTree[i].channels);
+        }
+        else
+        {
+            cprintf("  0x%02X: %u channels, behind 0x%02X channel %u\r\n",
+                    muxTree[i].addr, muxTree[i].channels,
+                    muxTree[i].parent, muxTree[i].parentChannel);
+        }
     }
-    else if(strcmp(ptr_cmd, "dis")   == STRINGS_MATCH)
+    cprintf("  %u muxes, %u positions\r\n", muxNodes, muxPositionCount());
+}
+
+void cmdMuxHealth(cmd_args_t *args)
+{
+    twi_health_t h;
+    uint8_t      i;
+    int32_t      wait;
+
+    if(args->argc > 0 && strcmp_P(args->argv[0], PSTR("clear")) == STRINGS_MATCH)
     {
-        ptr_cmd = strtok(NULL, TOKEN_DELIMINATORS);
-        int_val = atoi(ptr_cmd);
-        disableMuxOutputChannel(int_val);
+        twi_health_clear();
     }
-    else if(strcmp(ptr_cmd, "reset") == STRINGS_MATCH)
+
+    for(i = 0; twi_health_get(i, &h) == 0; i++)
     {
-        resetMux();
+        cprintf("  0x%02X ch %u dev 0x%02X: %u fails, last %d after %lu us",
+                h.muxAddr, h.channel, h.addr, h.fails, h.lastError, h.failUs);
+        if(h.quarantined)
+        {
+            wait = (int32_t)(h.retryAt - ms_time());
+            cprintf(", quarantined, re-probe in %ld ms, %u refused",
+                    (wait > 0) ? wait : 0L, h.refused);
+        }
+        cprintf("\r\n");
     }
-    else if(strcmp(ptr_cmd, "pres") == STRINGS_MATCH)
+    if(i == 0)
     {
-        ptr_cmd = strtok(NULL, TOKEN_DELIMINATORS);
-        int_val = atoi(ptr_cmd);
-        setMuxPressureMeasurement(int_val);
+        cprintf("  no routed device has failed\r\n");
     }
-    else
+}
+
+void cmdMuxStats(cmd_args_t *args)
+{
+    mux_stats_t stats;
+    twi_mux_t   route;
+
+    muxGetStats(&stats, args->argc > 0 && strcmp_P(args->argv[0], PSTR("clear")) == STRINGS_MATCH);
+    cprintf("  writes = %u, reads = %u, saved = %u\r\n",
+            stats.writes, stats.reads, stats.saved);
+    if(twi_mux_info(MUX_PCA9546_I2C_ADDR, &route) == 0)
     {
-        printf("ERROR - unknown serial command = %s\r\n", serCmd);
+        cprintf("  routed: switches = %u, no switch = %u\r\n",
+                route.switches, route.hits);
     }
 }
@@ -5,9 +5,18 @@
 *******************************************************************************/
 #ifndef __MUX_PCA9546_H__
 #define __MUX_PCA9546_H__
+
+#include <inttypes.h>
+#include "serialPortCmd.h"
+#include "twi_utils.h"
   
 
-#define MUX_PCA9546_I2C_ADDR    0x70
+#define MUX_PCA9546_I2C_ADDR    0x70    // primary mux, the legacy calls use it
+
+#define MUX_ADDR_FIRST      0x70    // PCA9546/PCA9548 address range
+#define MUX_ADDR_LAST       0x77
+#define MUX_MAX_NODES       TWI_MAX_MUXES
+#define MUX_MAX_POSITIONS   64      // leaf channels
 
 #define MUX_CHANNEL_0       0
 #define MUX_CHANNEL_1       1
@@ -17,7 +26,26 @@
 #define MUX_DIFF_PRESSURE   0   // differential pressure transducer is behind MUX channel 0
 #define MUX_ABS_PRESSURE    1   // absolute pressure transducer is behind MUX channel 1
 
-#define TOKEN_DELIMINATORS  (" ")
+/*
+ * bus traffic counters, see muxGetStats()
+ */
+typedef struct
+{
+    uint16_t writes;        // control register writes
+    uint16_t reads;         // control register reads, shadow syncs
+    uint16_t saved;         // reads and writes the shadow made unnecessary
+} mux_stats_t;
+
+/*
+ * a mux found by muxDiscover()
+ */
+typedef struct
+{
+    uint8_t addr;
+    uint8_t channels;       // 4 for a PCA9546, 8 for a PCA9548
+    uint8_t parent;         // mux in front of this one, 0 for the main bus
+    uint8_t parentChannel;
+} mux_node_t;
 
   
 // Global Function Definitions
@@ -26,9 +54,22 @@ void    resetMux(void);
 int8_t  enableMuxOutputChannel(uint8_t channelID);
 int8_t  disableMuxOutputChannel(uint8_t channelID);
 uint8_t getMuxConfiguration(void);
-void    resetMux(void);
-void    displayMuxSerialCmdHelp(void);
-void    processMuxSerialCmd(char *serCmd);
+int8_t  muxSelectChannels(uint8_t mask);
+int8_t  muxSync(void);
+void    muxGetStats(mux_stats_t *stats, uint8_t clear);
+int8_t  setMuxPressureMeasurement(uint8_t pressureMeas);
+uint8_t muxDiscover(void);
+uint8_t muxPositionCount(void);
+int8_t  muxPosition(uint8_t position, twi_dev_t *dev);
+void    cmdMuxCfg(cmd_args_t *args);
+void    cmdMuxEna(cmd_args_t *args);
+void    cmdMuxDis(cmd_args_t *args);
+void    cmdMuxReset(cmd_args_t *args);
+void    cmdMuxPres(cmd_args_t *args);
+void    cmdMuxSel(cmd_args_t *args);
+void    cmdMuxHealth(cmd_args_t *args);
+void    cmdMuxStats(cmd_args_t *args);
+void    cmdMuxTree(cmd_args_t *args);
   
   
 #endif  // end __MUX_PCA9546_H__
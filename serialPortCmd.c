@@ -1,52 +1,600 @@
 /*******************************************************************************
 *   File Name: serialPortCmd.c
-*  
-* Description: Process serial port command from the user 
+*
+* Description: Process serial port command from the user.  The command set is
+*              the table below, see serialPortCmd.h.
 *******************************************************************************/
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <avr/pgmspace.h>
 #include "serialPortCmd.h"
 #include "HumiditySensor.h"
+#include "humidityArray.h"
 #include "muxPCA9546.h"
 #include "i2c.h"
+#include "uart.h"
+#include "binaryCmd.h"
+#include "telemetry.h"
+#include "log.h"
+#include "console.h"
+
+#define CMD_COUNT(table)    (sizeof(table) / sizeof((table)[0]))
+#define CMD_HELP_COLUMN     24      // help text starts here
+
+static void cmdBin(cmd_args_t *args);
+static void cmdHelp(cmd_args_t *args);
+
+
+/*
+ * command tables, each sorted by name (strcmp order) for the binary search
+ */
+static const cmd_entry_t humidCmds[] PROGMEM =
+{
+    { "array",  "",   "N",    cmdHumidArray,     NULL, 0, "sample the sensors on mux channels, mask 0x1-0xF" },
+    { "bcast",  "",   "N",    cmdHumidBroadcast, NULL, 0, "as array, one broadcast measurement request" },
+    { "mr",     "",   "",     cmdHumidMr,        NULL, 0, "issue a sleep mode measurement request" },
+    { "policy", "",   "NNNN", cmdHumidPolicy,    NULL, 0, "display or set conv_ms retry_ms retries backoff" },
+    { "read",   "rd", "",     cmdHumidRead,      NULL, 0, "read sensor humidity" },
+    { "scan",   "",   "",     cmdHumidScan,      NULL, 0, "scan the I2C addresses for a sensor" },
+    { "update", "up", "",     cmdHumidUpdate,    NULL, 0, "measurement request then read the sensor" },
+};
+
+static const cmd_entry_t i2cCmds[] PROGMEM =
+{
+    { "recover", "",  "W",    cmdI2cRecover,     NULL, 0, "bus recovery counters, \"run\" or \"clear\"" },
+    { "scan",   "",   "",     cmdI2cScan,        NULL, 0, "scan all addresses and report active ones" },
+    { "speed",  "",   "N",    cmdI2cSpeed,       NULL, 0, "display or set the bus SCL frequency" },
+    { "tmo",    "",   "W",    cmdI2cTmo,         NULL, 0, "learned timeouts, \"save\", \"load\" or \"reset\"" },
+};
+
+static const cmd_entry_t muxCmds[] PROGMEM =
+{
+    { "cfg",    "",   "",     cmdMuxCfg,         NULL, 0, "display mux configuration" },
+    { "dis",    "",   "n",    cmdMuxDis,         NULL, 0, "disable channel n" },
+    { "ena",    "",   "n",    cmdMuxEna,         NULL, 0, "enable channel n" },
+    { "health", "",   "W",    cmdMuxHealth,      NULL, 0, "routed device health, \"clear\" lifts quarantine" },
+    { "pres",   "",   "n",    cmdMuxPres,        NULL, 0, "set mux pressure measurement" },
+    { "reset",  "",   "",     cmdMuxReset,       NULL, 0, "reset mux" },
+    { "sel",    "",   "n",    cmdMuxSel,         NULL, 0, "enable exactly the channels in mask n" },
+    { "stats",  "",   "W",    cmdMuxStats,       NULL, 0, "shadow register traffic counters" },
+    { "tree",   "",   "W",    cmdMuxTree,        NULL, 0, "mux tree, \"scan\" to discover it again" },
+};
+
+static const cmd_entry_t telemCmds[] PROGMEM =
+{
+    { "start",  "",   "N",    cmdTelemStart,     NULL, 0, "switch to binary mode and stream sensor records" },
+};
+
+static const cmd_entry_t uartCmds[] PROGMEM =
+{
+    { "baud",   "",   "N",    cmdUartBaud,       NULL, 0, "display or change the console baud rate" },
+    { "flow",   "",   "W",    cmdUartFlow,       NULL, 0, "display or set flow control, none|xon|rts" },
+    { "stats",  "",   "W",    cmdUartStats,      NULL, 0, "receive error and transmit drop counts" },
+};
+
+static const cmd_entry_t serialCmds[] PROGMEM =
+{
+    { "bin",    "",   "",   cmdBin,  NULL,      0,                    "switch to the binary protocol, see binaryCmd.h" },
+    { "help",   "?",  "",   cmdHelp, NULL,      0,                    "display this help" },
+    { "humid",  "hu", "",   NULL,    humidCmds, CMD_COUNT(humidCmds), "Humidity Sensor Commands" },
+    { "i2c",    "",   "",   NULL,    i2cCmds,   CMD_COUNT(i2cCmds),   "I2C Commands" },
+    { "log",    "",   "WW", cmdLog,  NULL,      0,                    "display log levels, or set <sub> <level>" },
+    { "mux",    "",   "",   NULL,    muxCmds,   CMD_COUNT(muxCmds),   "MUX Commands" },
+    { "telem",  "",   "",   NULL,    telemCmds, CMD_COUNT(telemCmds), "Telemetry Commands" },
+    { "uart",   "",   "",   NULL,    uartCmds,  CMD_COUNT(uartCmds),  "UART Commands" },
+};
 
 
 
 /*******************************************************************************
-*                        PROCESS SERIAL COMMAND STRING                         *
+*                              RESET COMMAND LINE                              *
 ********************************************************************************
-* Description: Process a serial port command string from the user.
-*  
-*   Arguments: ptrCmd - points to serial port command string
-*  
+* Description: Empty the line, ready for the next one
+*
+*   Arguments: line - command line
+*
 *      Return: None
 *******************************************************************************/
-void processSerialCommand(char *ptrCmd)
+void cmdLineReset(cmd_line_t *line)
 {
-    char *ptr_cmd = strtok(ptrCmd, TOKEN_DELIM);
+    line->len    = 0;
+    line->count  = 0;
+    line->isNum  = 0;
+    line->error  = 0;
+    line->inWord = 0;
+}
+
 
-    if((strcmp(ptr_cmd, "humid") == STRINGS_MATCH) ||
-      ( strcmp(ptr_cmd, "hu")    == STRINGS_MATCH))
+/*******************************************************************************
+*                                 END WORD                                     *
+********************************************************************************
+* Description: Terminate the current word and keep its value if it is a
+*              number
+*
+*   Arguments: line - command line
+*
+*      Return: None
+*******************************************************************************/
+static void cmdLineEndWord(cmd_line_t *line)
+{
+    if(!line->inWord)
     {
-        humidityCmds();
+        return;
     }
-    else if(strcmp(ptr_cmd, "mux") == STRINGS_MATCH)
 
+    line->buf[line->len++] = '\0';
+    if(line->numOk && line->numDigits > 0)
     {
-        processMuxSerialCmd(ptrCmd);
+        line->isNum |= 1 << line->count;
+        line->val[line->count] = line->numNeg ? -(int32_t)line->num : (int32_t)line->num;
     }
-    else if(strcmp(ptr_cmd, "i2c") == STRINGS_MATCH)
+    line->count++;
+    line->inWord = 0;
+}
 
+
+/*******************************************************************************
+*                                NUMBER DIGIT                                  *
+********************************************************************************
+* Description: Add one character to the number conversion of the current
+*              word.  Decimal, or hex after "0x"; anything else, or a value
+*              that does not fit in an int32_t, and the word is not a number.
+*
+*   Arguments: line - command line
+*              c    - character, not the first '-'
+*
+*      Return: None
+*******************************************************************************/
+static void cmdLineDigit(cmd_line_t *line, char c)
+{
+    uint8_t digit;
+
+    if(!line->numOk)
+    {
+        return;
+    }
+
+    if((c == 'x' || c == 'X') && line->numBase == 10 &&
+       line->numDigits == 1 && line->num == 0)
     {
-        processI2cSerialCmd(ptrCmd);
+        line->numBase   = 16;
+        line->numDigits = 0;
+        return;
+    }
+
+    if(c >= '0' && c <= '9')
+    {
+        digit = c - '0';
+    }
+    else if(line->numBase == 16 && (c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+    {
+        digit = (c | 0x20) - 'a' + 10;
     }
     else
+    {
+        line->numOk = 0;
+        return;
+    }
+
+    if(line->num > (INT32_MAX - digit) / line->numBase)
+    {
+        line->numOk = 0;
+        return;
+    }
+    line->num = line->num * line->numBase + digit;
+    line->numDigits++;
+}
+
+
+/*******************************************************************************
+*                               REOPEN WORD                                    *
+********************************************************************************
+* Description: Make the last word of the line the current one again after a
+*              backspace and convert what is left of it from the start
+*
+*   Arguments: line - command line, len just past the word's last character
+*
+*      Return: None
+*******************************************************************************/
+static void cmdLineReopen(cmd_line_t *line)
+{
+    uint8_t i = line->start[line->count];
+
+    line->isNum    &= ~(1 << line->count);
+    line->inWord    = 1;
+    line->num       = 0;
+    line->numBase   = 10;
+    line->numDigits = 0;
+    line->numNeg    = (line->buf[i] == '-');
+    line->numOk     = 1;
+
+    for(i += line->numNeg; i < line->len; i++)
+    {
+        cmdLineDigit(line, line->buf[i]);
+    }
+}
+
+
+/*******************************************************************************
+*                                BACKSPACE                                     *
+********************************************************************************
+* Description: Take back the last byte of the line.  Separators are kept in
+*              the buffer as terminators so a backspace over one can reopen
+*              the word in front of it.
+*
+*   Arguments: line - command line
+*
+*      Return: None
+*******************************************************************************/
+static void cmdLineBackspace(cmd_line_t *line)
+{
+    if(line->len == 0)
+    {
+        return;
+    }
+    line->len--;
+
+    if(line->inWord)
+    {
+        if(line->len == line->start[line->count])
+        {
+            line->inWord = 0;       // the word is gone
+        }
+        else
+        {
+            cmdLineReopen(line);
+        }
+    }
+    else if(line->len > 0 && line->buf[line->len - 1] != '\0')
+    {
+        // that was the terminator of the word in front
+        line->count--;
+        cmdLineReopen(line);
+    }
+}
+
+
+/*******************************************************************************
+*                             PUT COMMAND LINE BYTE                            *
+********************************************************************************
+* Description: Add a received byte to the command line.  Space, tab and line
+*              feed separate words, '\r' ends the line, backspace or DEL
+*              takes back the last byte.  Once a line is too long, or has
+*              too many words, the rest of it is discarded and the error is
+*              reported when it ends.
+*
+*   Arguments: line - command line
+*              c    - received byte
+*
+*      Return: CMD_LINE_DONE at the end of the line, CMD_LINE_MORE otherwise
+*******************************************************************************/
+int8_t cmdLinePut(cmd_line_t *line, char c)
+{
+    if(c == '\r')
+    {
+        if(!line->error)
+        {
+            cmdLineEndWord(line);
+        }
+        return CMD_LINE_DONE;
+    }
+
+    if(line->error)
+    {
+        return CMD_LINE_MORE;
+    }
+
+    if(c == CMD_BACKSPACE || c == CMD_DELETE)
+    {
+        cmdLineBackspace(line);
+        return CMD_LINE_MORE;
+    }
+
+    // room for this byte and the terminator
+    if(line->len >= CMD_BUFFER_SIZE - 1)
+    {
+        line->error = CMD_LINE_TOO_LONG;
+        return CMD_LINE_MORE;
+    }
+
+    if(c == ' ' || c == '\t' || c == '\n')
+    {
+        if(line->inWord)
+        {
+            cmdLineEndWord(line);
+        }
+        else
+        {
+            line->buf[line->len++] = '\0';
+        }
+        return CMD_LINE_MORE;
+    }
+
+    if(!line->inWord)
+    {
+        if(line->count == CMD_MAX_TOKENS)
+        {
+            line->error = CMD_LINE_TOO_MANY;
+            return CMD_LINE_MORE;
+        }
+
+        line->start[line->count] = line->len;
+        line->inWord    = 1;
+        line->num       = 0;
+        line->numBase   = 10;
+        line->numDigits = 0;
+        line->numNeg    = (c == '-');
+        line->numOk     = 1;
+        line->buf[line->len++] = c;
+        if(line->numNeg)
+        {
+            return CMD_LINE_MORE;
+        }
+    }
+    else
+    {
+        line->buf[line->len++] = c;
+    }
+
+    cmdLineDigit(line, c);
+    return CMD_LINE_MORE;
+}
+
+
+/*******************************************************************************
+*                               FIND COMMAND                                   *
+********************************************************************************
+* Description: Look a command word up in a table.  Names are found with a
+*              binary search, an alias only if that misses.
+*
+*   Arguments: table - sorted command table in flash
+*              count - number of rows
+*              word  - command word
+*
+*      Return: row in flash, NULL if the word is not a command
+*******************************************************************************/
+static const cmd_entry_t *findCommand(const cmd_entry_t *table, uint8_t count,
+                                      const char *word)
+{
+    uint8_t lo = 0;
+    uint8_t hi = count;
+    uint8_t mid;
+    int     cmp;
+
+    while(lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        cmp = strcmp_P(word, table[mid].name);
+        if(cmp == STRINGS_MATCH)
+        {
+            return &table[mid];
+        }
+        if(cmp < 0)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+
+    for(mid = 0; mid < count; mid++)
+    {
+        if(pgm_read_byte(table[mid].alias) != '\0' &&
+           strcmp_P(word, table[mid].alias) == STRINGS_MATCH)
+        {
+            return &table[mid];
+        }
+    }
+    return NULL;
+}
+
+
+/*******************************************************************************
+*                              PARSE ARGUMENTS                                 *
+********************************************************************************
+* Description: Collect the rest of the command line against an argument spec,
+*              see serialPortCmd.h.  Errors are reported here.
+*
+*   Arguments: spec  - argument spec in flash
+*              line  - command line
+*              first - first argument word
+*              args  - parsed arguments
+*
+*      Return: 0 if the arguments match the spec, -1 if not
+*******************************************************************************/
+static int8_t parseArguments(const char *spec, cmd_line_t *line, uint8_t first,
+                             cmd_args_t *args)
+{
+    char    type;
+    uint8_t word;
+
+    args->argc = 0;
+    while((type = pgm_read_byte(spec++)) != '\0')
+    {
+        word = first + args->argc;
+        if(word >= line->count)
+        {
+            if(type == 'n' || type == 'w')
+            {
+                cprintf("ERROR - missing argument\r\n");
+                return -1;
+            }
+            return 0;
+        }
+
+        args->argv[args->argc] = &line->buf[line->start[word]];
+        args->val[args->argc]  = 0;
+        if(type == 'n' || type == 'N')
+        {
+            if(!(line->isNum & (1 << word)))
+            {
+                cprintf("ERROR - %s is not a number\r\n", args->argv[args->argc]);
+                return -1;
+            }
+            args->val[args->argc] = line->val[word];
+        }
+        args->argc++;
+    }
+
+    if(first + args->argc < line->count)
+    {
+        cprintf("ERROR - too many arguments\r\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+*                             DISPLAY COMMAND LINE                             *
+********************************************************************************
+* Description: One help line: the command, its arguments and what it does
+*
+*   Arguments: group - parent command word in flash, NULL for a top level row
+*              entry - command row in flash
+*
+*      Return: None
+*******************************************************************************/
+static void displayCommandHelp(const char *group, const cmd_entry_t *entry)
+{
+    const char *spec = entry->args;
+    uint8_t     col  = 2;
+    char        type;
+
+    cprintf("  ");
+    if(group != NULL)
+    {
+        cputs_P(group);
+        cprintf(" ");
+        col += strlen_P(group) + 1;
+    }
+    cputs_P(entry->name);
+    col += strlen_P(entry->name);
+
+    while((type = pgm_read_byte(spec++)) != '\0')
+    {
+        switch(type)
+        {
+            case 'n':
+                cprintf(" <n>");
+                col += 4;
+                break;
+
+            case 'N':
+                cprintf(" [n]");
+                col += 4;
+                break;
+
+            case 'w':
+                cprintf(" <word>");
+                col += 7;
+                break;
+
+            default:
+                cprintf(" [word]");
+                col += 7;
+                break;
+        }
+    }
+    if(pgm_read_byte(entry->alias) != '\0')
+    {
+        cprintf(" (%S)", entry->alias);
+        col += strlen_P(entry->alias) + 3;
+    }
+
+    do
+    {
+        cprintf(" ");
+    } while(++col < CMD_HELP_COLUMN);
+    cprintf("- %S\r\n", entry->help);
+}
+
+
+/*******************************************************************************
+*                        PROCESS SERIAL COMMAND STRING                         *
+********************************************************************************
+* Description: Process a serial port command string from the user.  An
+*              empty line lists every command, a group word on its own lists
+*              the group's.  There is no prompt once the command has
+*              switched to binary mode.
+*
+*   Arguments: line - complete command line
+*
+*      Return: None
+*******************************************************************************/
+void processSerialCommand(cmd_line_t *line)
+{
+    const cmd_entry_t *table = serialCmds;
+    const cmd_entry_t *entry;
+    const char        *group = NULL;
+    uint8_t            count = CMD_COUNT(serialCmds);
+    uint8_t            word  = 0;
+    cmd_handler_t      handler;
+    cmd_args_t         args;
+    char              *ptr_cmd;
+
+    if(line->error == CMD_LINE_TOO_LONG)
+    {
+        cprintf("ERROR - line too long, %u characters max\r\n", CMD_BUFFER_SIZE - 1);
+        word = line->count;
+    }
+    else if(line->error == CMD_LINE_TOO_MANY)
+    {
+        cprintf("ERROR - more than %u words\r\n", CMD_MAX_TOKENS);
+        word = line->count;
+    }
+    else if(line->count == 0)
     {
         displaySerialCmdHelp();
     }
- 
-    printf(">"); 
+
+    while(word < line->count)
+    {
+        ptr_cmd = &line->buf[line->start[word++]];
+        entry   = findCommand(table, count, ptr_cmd);
+        if(entry == NULL)
+        {
+            cprintf("ERROR - unknown serial command = %s\r\n", ptr_cmd);
+            if(group == NULL)
+            {
+                displaySerialCmdHelp();
+            }
+            break;
+        }
+
+        handler = (cmd_handler_t)pgm_read_word(&entry->handler);
+        if(handler != NULL)
+        {
+            if(parseArguments(entry->args, line, word, &args) == 0)
+            {
+                handler(&args);
+            }
+            break;
+        }
+
+        // sub command next
+        group = entry->name;
+        table = (const cmd_entry_t *)pgm_read_word(&entry->sub);
+        count = pgm_read_byte(&entry->subCount);
+        if(word == line->count)
+        {
+            // just the group word, list its commands
+            cprintf("%S:\r\n", entry->help);
+            for(entry = table; entry < table + count; entry++)
+            {
+                displayCommandHelp(group, entry);
+            }
+        }
+    }
+
+    if(binaryCmdActive())
+    {
+        return;     // no prompt in binary mode
+    }
+    cprintf(">");
     return;
 }
 
@@ -55,16 +603,67 @@ void processSerialCommand(char *ptrCmd)
 /*******************************************************************************
 *                        DISPLAY SERIAL PORT COMMAND HELP                      *
 ********************************************************************************
-* Description: Displays serial port command help 
-*  
+* Description: Displays serial port command help, generated from the command
+*              tables
+*
 *   Arguments: None
-*  
+*
 *      Return: None
 *******************************************************************************/
 void displaySerialCmdHelp(void)
 {
-    displayHumidityMenu();
-    displayMuxSerialCmdHelp();
-    displayI2cSerialCmdHelp();
+    const cmd_entry_t *entry;
+    const cmd_entry_t *sub;
+    const cmd_entry_t *table;
+    uint8_t            count;
+
+    cprintf("Commands:\r\n");
+    for(entry = serialCmds; entry < serialCmds + CMD_COUNT(serialCmds); entry++)
+    {
+        if(pgm_read_word(&entry->handler) != 0)
+        {
+            displayCommandHelp(NULL, entry);
+        }
+    }
+
+    for(entry = serialCmds; entry < serialCmds + CMD_COUNT(serialCmds); entry++)
+    {
+        table = (const cmd_entry_t *)pgm_read_word(&entry->sub);
+        if(table == NULL)
+        {
+            continue;
+        }
+
+        count = pgm_read_byte(&entry->subCount);
+        cprintf("%S", entry->help);
+        if(pgm_read_byte(entry->alias) != '\0')
+        {
+            cprintf(" (%S)", entry->alias);
+        }
+        cprintf(":\r\n");
+        for(sub = table; sub < table + count; sub++)
+        {
+            displayCommandHelp(entry->name, sub);
+        }
+    }
 }
 
+
+/*******************************************************************************
+*                             COMMAND HANDLERS                                 *
+********************************************************************************
+* Description: Commands that belong to no other module
+*
+*   Arguments: args - parsed arguments
+*
+*      Return: None
+*******************************************************************************/
+static void cmdBin(cmd_args_t *args)
+{
+    binaryCmdStart();
+}
+
+static void cmdHelp(cmd_args_t *args)
+{
+    displaySerialCmdHelp();
+}
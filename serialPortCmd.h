@@ -1,17 +1,106 @@
 /*******************************************************************************
-*   File Name: serialPortCmd.h 
-*  
+*   File Name: serialPortCmd.h
+*
 * Description: Data and definitions for serialPortCommand.c
+*
+*              Commands are rows of a table in flash, one per command word,
+*              sorted by name so a word is found with a binary search.  A
+*              row either runs a handler or points to a table of sub
+*              commands, "mux" -> "ena" for example.  The help text is
+*              generated from the same rows.
+*
+*              Arguments are checked against the row's spec before the
+*              handler runs, one character per argument:
+*
+*                n - number, decimal or 0x hex      N - optional number
+*                w - word                           W - optional word
+*
+*              optional arguments come last.
+*
+*              The line is tokenized as it arrives, cmdLinePut() one byte at
+*              a time: words are terminated in place and numbers converted
+*              digit by digit, so nothing is scanned again when the '\r'
+*              comes.  Separators stay in the buffer as terminators, so
+*              backspace can be taken back across them.  A line longer than
+*              CMD_BUFFER_SIZE or with more than CMD_MAX_TOKENS words is
+*              rejected as a whole.
 *******************************************************************************/
 #ifndef __SERIAL_PORT_COMMAND_H__
 #define __SERIAL_PORT_COMMAND_H__
-  
-#define STRINGS_MATCH    0
-  
+
+#include <inttypes.h>
+
+#define STRINGS_MATCH       0
+
+#define CMD_BUFFER_SIZE     128     // longest line, terminators included
+#define CMD_BACKSPACE       0x08
+#define CMD_DELETE          0x7F    // what most terminals send for backspace
+
+#define CMD_NAME_LEN        8       // including the terminator
+#define CMD_ALIAS_LEN       4
+#define CMD_MAX_ARGS        4
+#define CMD_HELP_LEN        56
+#define CMD_MAX_TOKENS      (2 + CMD_MAX_ARGS)  // group, command, arguments
+
+// cmdLinePut() results and cmd_line_t errors
+#define CMD_LINE_MORE       0       // line not finished
+#define CMD_LINE_DONE       1       // '\r' seen, line ready
+#define CMD_LINE_TOO_LONG   2
+#define CMD_LINE_TOO_MANY   3
+
+/*
+ * command line being received, tokenized in place
+ */
+typedef struct
+{
+    char     buf[CMD_BUFFER_SIZE];      // words, each one NUL terminated
+    uint8_t  len;
+    uint8_t  count;                     // words
+    uint8_t  start[CMD_MAX_TOKENS];     // offset of each word in buf
+    int32_t  val[CMD_MAX_TOKENS];       // value of number words
+    uint8_t  isNum;                     // bit per word, is a number
+    uint8_t  error;                     // CMD_LINE_TOO_xxx, 0 if none
+    uint8_t  inWord;                    // inside a word
+
+    // number conversion of the current word
+    uint32_t num;
+    uint8_t  numBase;
+    uint8_t  numDigits;
+    uint8_t  numNeg;
+    uint8_t  numOk;
+} cmd_line_t;
+
+/*
+ * parsed arguments, argc counts the optional ones actually given
+ */
+typedef struct
+{
+    uint8_t  argc;
+    char    *argv[CMD_MAX_ARGS];        // every argument as typed
+    int32_t  val[CMD_MAX_ARGS];         // value of number arguments
+} cmd_args_t;
+
+typedef void (*cmd_handler_t)(cmd_args_t *args);
+
+/*
+ * command table row, lives in flash
+ */
+typedef struct cmd_entry
+{
+    char                     name[CMD_NAME_LEN];
+    char                     alias[CMD_ALIAS_LEN];  // short form, may be ""
+    char                     args[CMD_MAX_ARGS + 1];
+    cmd_handler_t            handler;               // NULL if sub is used
+    const struct cmd_entry  *sub;                   // sub command table
+    uint8_t                  subCount;
+    char                     help[CMD_HELP_LEN];
+} cmd_entry_t;
+
 // Global Function Prototypes
-void processSerialCommand(char *ptrCmd);
-void displaySerialCmdHelp(void);
-  
-  
-#endif  // end __SERIAL_PORT_COMMAND_H__
+void   cmdLineReset(cmd_line_t *line);
+int8_t cmdLinePut(cmd_line_t *line, char c);
+void   processSerialCommand(cmd_line_t *line);
+void   displaySerialCmdHelp(void);
+
 
+#endif  // end __SERIAL_PORT_COMMAND_H__
@@ -0,0 +1,256 @@
+/*******************************************************************************
+*   File Name: telemetry.c
+*
+* Description: Continuous telemetry.  Every registered source is sampled at a
+*              fixed period off a software timer and each completed sample is
+*              sent as one binary protocol event.  Nothing here blocks: a
+*              record that does not fit in the transmit ring is dropped and
+*              counted rather than stalling the sampling.
+*******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "telemetry.h"
+#include "binaryCmd.h"
+#include "timers.h"
+#include "uart.h"
+#include "serialPortCmd.h"
+#include "console.h"
+
+// worst case encoded record: packet header, crc, COBS code byte, delimiter
+#define TELEM_FRAME_MAX     (TELEM_REC_MAX + BIN_HDR_LEN + BIN_CRC_LEN + 2)
+
+
+static telem_source_t  *sources;        // registry
+static sw_timer_t       telemTimer;     // sample period
+static telem_stats_t    telemStats;
+static uint8_t          telemActive;
+
+
+/******************************************************************************
+*                                SAMPLE TICK                                  *
+*******************************************************************************
+* Description: Software timer callback, start a sample on every source.  A
+*              source that is still busy with the previous sample loses this
+*              period.
+*
+*   Arguments: timer - telemTimer
+*
+*      Return: None
+******************************************************************************/
+static void telemetryTick(sw_timer_t *timer)
+{
+    telem_source_t *src;
+
+    for(src = sources; src != NULL; src = src->next)
+    {
+        if(src->busy)
+        {
+            telemStats.dropped++;
+            src->seq++;
+            continue;
+        }
+
+        src->time = ms_time();
+        if(src->start(src->context) < 0)
+        {
+            telemStats.errors++;
+            src->seq++;
+        }
+        else
+        {
+            src->busy = 1;
+        }
+    }
+}
+
+
+/******************************************************************************
+*                              REGISTER SOURCE                                *
+*******************************************************************************
+* Description: Add a sensor to the set that is sampled while streaming
+*
+*   Arguments: src - source, caller owns the storage
+*
+*      Return: None
+******************************************************************************/
+void telemetry_register(telem_source_t *src)
+{
+    src->busy = 0;
+    src->seq  = 0;
+    src->next = sources;
+    sources   = src;
+}
+
+
+/******************************************************************************
+*                              START STREAMING                                *
+*******************************************************************************
+* Description: Start sampling every registered source.  Records go out as
+*              binary protocol events, so the serial port should be in
+*              binary mode.
+*
+*   Arguments: period_ms - sample period, at least TELEM_PERIOD_MIN_MS
+*
+*      Return: 0 if started, -1 if the period is too short or there is
+*              nothing to sample
+******************************************************************************/
+int8_t telemetry_start(uint16_t period_ms)
+{
+    telem_source_t *src;
+
+    if(period_ms < TELEM_PERIOD_MIN_MS || sources == NULL)
+    {
+        return -1;
+    }
+
+    memset(&telemStats, 0, sizeof(telemStats));
+    for(src = sources; src != NULL; src = src->next)
+    {
+        src->busy = 0;
+        src->seq  = 0;
+    }
+
+    telemActive = 1;
+    swtimer_start(&telemTimer, 0, period_ms, telemetryTick, NULL);
+    return 0;
+}
+
+
+/******************************************************************************
+*                              STOP STREAMING                                 *
+*******************************************************************************
+* Description: Stop sampling.  A sample still in progress is abandoned.
+*
+*   Arguments: stats - final counters go here, may be NULL
+*
+*      Return: None
+******************************************************************************/
+void telemetry_stop(telem_stats_t *stats)
+{
+    telem_source_t *src;
+
+    swtimer_stop(&telemTimer);
+    telemActive = 0;
+
+    for(src = sources; src != NULL; src = src->next)
+    {
+        src->busy = 0;
+    }
+
+    if(stats != NULL)
+    {
+        *stats = telemStats;
+    }
+}
+
+
+/******************************************************************************
+*                              STREAMING ACTIVE                               *
+*******************************************************************************
+* Description: Is telemetry running
+*
+*   Arguments: None
+*
+*      Return: non zero while streaming
+******************************************************************************/
+uint8_t telemetry_active(void)
+{
+    return telemActive;
+}
+
+
+/******************************************************************************
+*                             TELEMETRY SERVICE                               *
+*******************************************************************************
+* Description: Collect finished samples and send them.  Call from the main
+*              loop.
+*
+*   Arguments: None
+*
+*      Return: None
+******************************************************************************/
+void telemetry_service(void)
+{
+    telem_source_t *src;
+    uint8_t         rec[TELEM_REC_MAX];
+    int8_t          len;
+
+    if(!telemActive)
+    {
+        return;
+    }
+
+    for(src = sources; src != NULL; src = src->next)
+    {
+        if(!src->busy)
+        {
+            continue;
+        }
+
+        len = src->poll(src->context, &rec[TELEM_HDR_LEN]);
+        if(len == 0)
+        {
+            continue;
+        }
+
+        src->busy = 0;
+        if(len < 0)
+        {
+            telemStats.errors++;
+        }
+        else if(uart_tx_free() < TELEM_FRAME_MAX)
+        {
+            telemStats.dropped++;
+        }
+        else
+        {
+            rec[0] = src->id;
+            rec[1] = src->seq & 0xFF;
+            rec[2] = src->seq >> 8;
+            rec[3] = src->time & 0xFF;
+            rec[4] = (src->time >> 8)  & 0xFF;
+            rec[5] = (src->time >> 16) & 0xFF;
+            rec[6] = src->time >> 24;
+            binarySendPacket(BIN_EVT_TELEMETRY, src->seq & 0xFF, rec, TELEM_HDR_LEN + len);
+            telemStats.sent++;
+        }
+        src->seq++;
+    }
+}
+
+
+/******************************************************************************
+*                          TELEMETRY SERIAL COMMAND                           *
+*******************************************************************************
+* Description: "telem start [ms]", switch to binary mode and start streaming.
+*              Streaming is stopped with the binary BIN_CMD_TELEM_STOP
+*              command.
+*
+*      Global: None
+*
+*   Arguments: args - parsed arguments
+*
+*      Return: None
+******************************************************************************/
+void cmdTelemStart(cmd_args_t *args)
+{
+    int32_t period = TELEM_PERIOD_DEFAULT_MS;
+
+    if(args->argc > 0)
+    {
+        period = args->val[0];
+    }
+
+    if(period < TELEM_PERIOD_MIN_MS || period > UINT16_MAX)
+    {
+        cprintf("ERROR - period is %d to %u ms\r\n", TELEM_PERIOD_MIN_MS, UINT16_MAX);
+        return;
+    }
+
+    binaryCmdStart();
+    if(binaryCmdActive())
+    {
+        telemetry_start(period);
+    }
+}
@@ -0,0 +1,70 @@
+/*******************************************************************************
+*   File Name: telemetry.h
+*
+* Description: Data and definitions for telemetry.c, continuous sampling of
+*              registered sensors streamed as binary protocol events.
+*
+*              Record, sent as event BIN_EVT_TELEMETRY (packet seq is the low
+*              byte of the record seq):
+*
+*                source id(1)  seq(2)  time ms(4)  source data...
+*
+*              seq counts sample periods per source, so a gap is a lost
+*              sample.  time is ms_time() when the sample was started.
+*******************************************************************************/
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <inttypes.h>
+#include "binaryCmd.h"
+#include "serialPortCmd.h"
+
+#define BIN_EVT_TELEMETRY       (BIN_EVT_BASE + 0)
+
+#define TELEM_HDR_LEN           7       // id, seq, time
+#define TELEM_DATA_MAX          8       // source data
+#define TELEM_REC_MAX           (TELEM_HDR_LEN + TELEM_DATA_MAX)
+
+#define TELEM_PERIOD_MIN_MS     50      // ChipCap2 sleep mode measurement is ~45 ms
+#define TELEM_PERIOD_DEFAULT_MS 100
+
+typedef struct telem_source telem_source_t;
+
+/*
+ * sensor that can be sampled without blocking.  start() begins a sample,
+ * poll() is called from telemetry_service() until it returns non zero.
+ */
+struct telem_source
+{
+    uint8_t           id;           // record source id
+    int8_t          (*start)(void *context);            // 0 or < 0 on error
+    int8_t          (*poll)(void *context, uint8_t *data); // data length, 0 = busy, < 0 error
+    void             *context;      // passed to start and poll
+
+    // telemetry private
+    uint8_t           busy;         // sample in progress
+    uint16_t          seq;          // next record seq
+    uint32_t          time;         // start time of the sample in progress
+    telem_source_t   *next;         // registry link
+};
+
+/*
+ * counters, reported when streaming stops
+ */
+typedef struct
+{
+    uint32_t          sent;         // records sent
+    uint32_t          dropped;      // sample periods lost: UART full or overrun
+    uint32_t          errors;       // samples that failed on the bus
+} telem_stats_t;
+
+// global functions
+void    telemetry_register(telem_source_t *src);
+int8_t  telemetry_start(uint16_t period_ms);
+void    telemetry_stop(telem_stats_t *stats);
+uint8_t telemetry_active(void);
+void    telemetry_service(void);
+void    cmdTelemStart(cmd_args_t *args);
+
+
+#endif  // end __TELEMETRY_H__
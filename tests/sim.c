@@ -0,0 +1,327 @@
+/*******************************************************************************
+*   File Name: sim.c
+*
+* Description: host simulator, register storage and the clock.  See sim.h.
+*******************************************************************************/
+#include <string.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/twi.h>
+#include "uart.h"
+#include "sim.h"
+
+extern volatile uint32_t ms_tickCount;  // timers.c
+
+volatile uint8_t TWSR, TWBR, TWDR, TWAR;
+volatile uint8_t UDR0, UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+volatile uint8_t PORTB, DDRB, PINB, PORTD, DDRD, PIND, PORTE, DDRE, PINE;
+volatile uint8_t TCCR0A, TCCR0B, OCR0A, TIMSK0, TIFR0;
+volatile uint8_t TCCR1A, TCCR1B, OCR1BL, OCR1CL;
+volatile uint16_t OCR1A;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, TIMSK2, TIFR2;
+volatile uint8_t TCCR3A, TCCR3B, OCR3BL, OCR3CL;
+volatile uint8_t SREG;
+
+static volatile uint8_t simTwcr;
+static volatile uint8_t simTcnt0;
+
+uint32_t  sim_us;
+sim_twi_t sim_twi;
+
+// TWI bus
+#define SIM_BUS_IDLE    0       // no START
+#define SIM_BUS_SLA     1       // START sent, TWDR is the address
+#define SIM_BUS_MT      2       // master transmitter
+#define SIM_BUS_MR      3       // master receiver
+#define SIM_BUS_NACKED  4       // address not acknowledged
+
+static sim_twi_dev_t  simDev[SIM_TWI_DEVICES];
+static uint8_t        simNumDev;
+static sim_twi_dev_t *simSlave;         // addressed slave
+static uint8_t        simBus;           // SIM_BUS_xxx
+static uint8_t        simOwned;         // we are bus master
+
+// Timer2 clock select to prescaler
+static const uint16_t simT2Div[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+
+
+/*******************************************************************************
+*                                 RESET                                        *
+********************************************************************************
+* Description: Power on state: registers cleared, clock at 0, interrupts
+*              enabled, SCL and SDA idle high, UART data register empty.
+*******************************************************************************/
+void sim_reset(void)
+{
+    simTwcr = 0;
+    TWSR    = 0;
+    TWDR    = 0;
+    TCCR2B  = 0;
+    TIMSK2  = 0;
+    PIND    = _BV(PD0) | _BV(PD1);
+    UCSR0A  = _BV(UDRE0);
+    UCSR0B  = 0;
+    SREG    = _BV(SREG_I);
+
+    sim_us       = 0;
+    ms_tickCount = 0;
+
+    memset(&sim_twi, 0, sizeof(sim_twi));
+    sim_twi.eventUs = SIM_TWI_EVENT_US;
+    simNumDev = 0;
+    simSlave  = NULL;
+    simBus    = SIM_BUS_IDLE;
+    simOwned  = 0;
+}
+
+
+/*******************************************************************************
+*                              ADVANCE CLOCK                                   *
+*******************************************************************************/
+void sim_advance_us(uint32_t us)
+{
+    sim_us      += us;
+    ms_tickCount = sim_us / 1000;
+}
+
+
+/*******************************************************************************
+*                                 TCNT0                                        *
+********************************************************************************
+* Description: Timer0 count.  Looking at the clock costs one tick.
+*******************************************************************************/
+volatile uint8_t *sim_tcnt0(void)
+{
+    sim_advance_us(SIM_TICK_US);
+    simTcnt0 = (sim_us % 1000) / SIM_TICK_US;
+    return &simTcnt0;
+}
+
+
+/*******************************************************************************
+*                                 TWCR                                         *
+********************************************************************************
+* Description: TWI control register.  A STOP the engine asked for goes out
+*              the next time it is looked at, unless the bus is stuck; TWSTO
+*              and TWINT then clear as on the real part.
+*******************************************************************************/
+volatile uint8_t *sim_twcr(void)
+{
+    if((simTwcr & (_BV(TWSTO) | _BV(TWEN))) == (_BV(TWSTO) | _BV(TWEN)) &&
+       !sim_twi.stopStuck)
+    {
+        simTwcr &= ~(_BV(TWSTO) | _BV(TWINT));
+        simBus   = SIM_BUS_IDLE;
+        simOwned = 0;
+        sim_twi.stops++;
+    }
+    if(!(simTwcr & _BV(TWEN)))
+    {
+        // disabling the TWI resets it and lets go of the bus
+        simBus   = SIM_BUS_IDLE;
+        simOwned = 0;
+    }
+    return &simTwcr;
+}
+
+
+/*******************************************************************************
+*                              ADD TWI SLAVE                                   *
+*******************************************************************************/
+sim_twi_dev_t *sim_twi_add(uint8_t addr)
+{
+    sim_twi_dev_t *dev = &simDev[simNumDev++];
+
+    memset(dev, 0, sizeof(*dev));
+    dev->addr = addr;
+    return dev;
+}
+
+
+/*******************************************************************************
+*                              FIND TWI SLAVE                                  *
+*******************************************************************************/
+static sim_twi_dev_t *sim_twi_find(uint8_t addr)
+{
+    uint8_t i;
+
+    for(i = 0; i < simNumDev; i++)
+    {
+        if(simDev[i].addr == addr)
+        {
+            return &simDev[i];
+        }
+    }
+    return NULL;
+}
+
+
+/*******************************************************************************
+*                              TWI BUS EVENT                                   *
+********************************************************************************
+* Description: Carry out the action the engine wrote to TWCR: a START, the
+*              address, a data byte either way.  Then set TWSR and, with
+*              TWIE set, run TWI_vect().
+*
+*      Return: 1 if there was an event, 0 if the TWI is idle, waiting on an
+*              inter-byte delay or the bus is stalled
+*******************************************************************************/
+uint8_t sim_twi_step(void)
+{
+    uint8_t cr = TWCR;
+    uint8_t status;
+    uint8_t data;
+    uint8_t ack;
+
+    if((cr & (_BV(TWINT) | _BV(TWEN))) != (_BV(TWINT) | _BV(TWEN)) || sim_twi.stall)
+    {
+        return 0;
+    }
+
+    if(cr & _BV(TWSTA))
+    {
+        status   = simOwned ? TW_REP_START : TW_START;
+        simOwned = 1;
+        simBus   = SIM_BUS_SLA;
+        sim_twi.starts++;
+    }
+    else if(simBus == SIM_BUS_SLA && sim_twi.arbLose > 0)
+    {
+        // another master won the address phase
+        sim_twi.arbLose--;
+        status   = TW_MT_ARB_LOST;
+        simOwned = 0;
+        simBus   = SIM_BUS_IDLE;
+    }
+    else if(simBus == SIM_BUS_SLA)
+    {
+        simSlave = sim_twi_find(TWDR >> 1);
+        ack      = (simSlave != NULL && simSlave->nackSla == 0);
+        if(simSlave != NULL && simSlave->nackSla > 0)
+        {
+            simSlave->nackSla--;
+        }
+
+        if(TWDR & TW_READ)
+        {
+            status = ack ? TW_MR_SLA_ACK : TW_MR_SLA_NACK;
+            simBus = ack ? SIM_BUS_MR : SIM_BUS_NACKED;
+        }
+        else
+        {
+            status = ack ? TW_MT_SLA_ACK : TW_MT_SLA_NACK;
+            simBus = ack ? SIM_BUS_MT : SIM_BUS_NACKED;
+        }
+        if(ack && simSlave->muxMask == 0 && (TWDR & TW_READ))
+        {
+            simSlave->rdIdx = 0;
+        }
+    }
+    else if(simBus == SIM_BUS_MT)
+    {
+        data = TWDR;
+        if(simSlave->wrLen < SIM_TWI_WR_MAX)
+        {
+            simSlave->wr[simSlave->wrLen] = data;
+        }
+        simSlave->wrLen++;
+        if(simSlave->muxMask != 0)
+        {
+            simSlave->cfg = data & simSlave->muxMask;
+        }
+        status = (simSlave->nackByte == simSlave->wrLen) ? TW_MT_DATA_NACK : TW_MT_DATA_ACK;
+    }
+    else if(simBus == SIM_BUS_MR)
+    {
+        if(simSlave->muxMask != 0)
+        {
+            TWDR = simSlave->cfg;
+        }
+        else
+        {
+            TWDR = (simSlave->rdIdx < simSlave->rdLen) ? simSlave->rd[simSlave->rdIdx] : 0xFF;
+            simSlave->rdIdx++;
+        }
+        status = (cr & _BV(TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+    }
+    else
+    {
+        status = TW_BUS_ERROR;
+    }
+
+    sim_advance_us(sim_twi.eventUs + sim_twi.stretchUs);
+    TWSR    = status | (TWSR & (_BV(TWPS1) | _BV(TWPS0)));
+    simTwcr = cr & ~_BV(TWINT);
+    sim_twi.events++;
+    if(cr & _BV(TWIE))
+    {
+        TWI_vect();
+    }
+    return 1;
+}
+
+
+/*******************************************************************************
+*                           TIMER 2 COMPARE                                    *
+********************************************************************************
+* Description: Run a pending Timer2 compare: move the clock to the match
+*              and call the interrupt
+*
+*      Return: 1 if there was one, 0 if Timer2 is stopped
+*******************************************************************************/
+uint8_t sim_timer2_step(void)
+{
+    uint16_t div = simT2Div[TCCR2B & 0x07];
+
+    if(div == 0 || !(TIMSK2 & _BV(OCIE2A)))
+    {
+        return 0;
+    }
+    sim_advance_us(((uint32_t)OCR2A + 1 - TCNT2) * div / 16);
+    TIMER2_COMPA_vect();
+    return 1;
+}
+
+
+/*******************************************************************************
+*                              DRAIN UART                                      *
+********************************************************************************
+* Description: Run the UDRE interrupt until the transmit ring is empty,
+*              collecting what it writes to UDR0.  Flow control must be off.
+*
+*   Arguments: buf  - sent bytes go here
+*              size - room in buf, the rest is dropped
+*
+*      Return: number of bytes sent
+*******************************************************************************/
+uint16_t sim_uart_drain(uint8_t *buf, uint16_t size)
+{
+    uint16_t n = 0;
+
+    while(uart_tx_free() < UART_TX_BUFFER_SIZE)
+    {
+        USART0_UDRE_vect();
+        if(n < size)
+        {
+            buf[n] = UDR0;
+        }
+        n++;
+    }
+    return (n < size) ? n : size;
+}
+
+
+/*******************************************************************************
+*                                EEPROM                                        *
+********************************************************************************
+* Description: EEMEM objects are ordinary memory on the host
+*******************************************************************************/
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    memcpy(dst, src, n);
+}
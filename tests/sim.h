@@ -0,0 +1,75 @@
+/*******************************************************************************
+*   File Name: sim.h
+*
+* Description: host simulator for the registers the firmware touches.
+*              Every read of TCNT0 moves the clock on by one Timer0 tick, so
+*              busy waits on time_us() finish; tests move it further with
+*              sim_advance_us().
+*
+*              The TWI runs one bus event per sim_twi_step(): the action the
+*              engine last asked for in TWCR is carried out against the
+*              simulated slaves, TWSR is set and TWI_vect() called.  A STOP
+*              goes out the next time TWCR is looked at.
+*******************************************************************************/
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <inttypes.h>
+
+#define SIM_TICK_US         4       // one TCNT0 count, prescaler 64
+
+#define SIM_TWI_DEVICES     8
+#define SIM_TWI_WR_MAX      64
+#define SIM_TWI_EVENT_US    90      // one byte and its ACK at 100 kHz
+
+/*
+ * simulated TWI slave.  A mux keeps the last byte written to it, masked to
+ * its writable bits, and returns it on a read.
+ */
+typedef struct
+{
+    uint8_t        addr;
+    uint8_t        muxMask;         // writable control bits, 0 if not a mux
+    uint8_t        cfg;
+    uint16_t       nackSla;         // SLAs to NACK before answering
+    uint8_t        nackByte;        // NACK the write byte with this count, 0 never
+    const uint8_t *rd;              // read data, 0xFF past rdLen
+    uint8_t        rdLen;
+    uint8_t        rdIdx;
+    uint8_t        wr[SIM_TWI_WR_MAX]; // bytes written, every transaction
+    uint8_t        wrLen;
+} sim_twi_dev_t;
+
+/*
+ * the bus: timing, faults and what went over it
+ */
+typedef struct
+{
+    uint32_t       eventUs;         // bus time of a START or a byte
+    uint32_t       stretchUs;       // added to each event, SCL held by a slave
+    uint16_t       arbLose;         // SLAs to lose arbitration on
+    uint8_t        stall;           // bus hung: events never complete
+    uint8_t        stopStuck;       // STOP never goes out
+    uint16_t       starts;          // START and repeated START conditions
+    uint16_t       stops;
+    uint16_t       events;          // TWI interrupts raised
+} sim_twi_t;
+
+extern uint32_t  sim_us;            // simulated time since sim_reset()
+extern sim_twi_t sim_twi;
+
+void           sim_reset(void);
+void           sim_advance_us(uint32_t us);
+uint16_t       sim_uart_drain(uint8_t *buf, uint16_t size);
+sim_twi_dev_t *sim_twi_add(uint8_t addr);
+uint8_t        sim_twi_step(void);
+uint8_t        sim_timer2_step(void);
+
+// interrupt vectors, see the ISR() stub
+void TIMER0_COMPA_vect(void);
+void TIMER2_COMPA_vect(void);
+void TWI_vect(void);
+void USART0_RX_vect(void);
+void USART0_UDRE_vect(void);
+
+#endif
@@ -0,0 +1,2 @@
+// serialPortCmd.c and main.c include it by this name, fine on Windows
+#include "humiditySensor.h"
@@ -0,0 +1,16 @@
+/*******************************************************************************
+*   File Name: avr/eeprom.h
+*
+* Description: host stand-in, EEMEM objects are ordinary memory
+*******************************************************************************/
+#ifndef __stub_avr_eeprom_h__
+#define __stub_avr_eeprom_h__
+
+#include <stddef.h>
+
+#define EEMEM
+
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#endif
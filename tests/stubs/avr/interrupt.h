@@ -0,0 +1,15 @@
+/*******************************************************************************
+*   File Name: avr/interrupt.h
+*
+* Description: host stand-in.  An ISR is a plain function the tests call.
+*******************************************************************************/
+#ifndef __stub_avr_interrupt_h__
+#define __stub_avr_interrupt_h__
+
+#include <avr/io.h>
+
+#define ISR(vector)     void vector(void); void vector(void)
+#define sei()           (SREG |= _BV(SREG_I))
+#define cli()           (SREG &= ~_BV(SREG_I))
+
+#endif
@@ -0,0 +1,114 @@
+/*******************************************************************************
+*   File Name: avr/io.h
+*
+* Description: host stand-in for the ATmega2561 registers the firmware uses.
+*              Plain registers are variables in sim.c; TWCR and TCNT0 go
+*              through accessors so the simulator sees the bus and moves
+*              time on, see sim.h.
+*******************************************************************************/
+#ifndef __stub_avr_io_h__
+#define __stub_avr_io_h__
+
+#include <inttypes.h>
+
+#define _BV(bit)    (1U << (bit))
+
+#define SIM_REG8(name)  extern volatile uint8_t name;
+#define SIM_REG16(name) extern volatile uint16_t name;
+
+SIM_REG8(TWSR) SIM_REG8(TWBR) SIM_REG8(TWDR) SIM_REG8(TWAR)
+SIM_REG8(UDR0) SIM_REG8(UCSR0A) SIM_REG8(UCSR0B) SIM_REG8(UCSR0C)
+SIM_REG8(UBRR0H) SIM_REG8(UBRR0L)
+SIM_REG8(PORTB) SIM_REG8(DDRB) SIM_REG8(PINB)
+SIM_REG8(PORTD) SIM_REG8(DDRD) SIM_REG8(PIND)
+SIM_REG8(PORTE) SIM_REG8(DDRE) SIM_REG8(PINE)
+SIM_REG8(TCCR0A) SIM_REG8(TCCR0B) SIM_REG8(OCR0A) SIM_REG8(TIMSK0) SIM_REG8(TIFR0)
+SIM_REG8(TCCR1A) SIM_REG8(TCCR1B) SIM_REG16(OCR1A) SIM_REG8(OCR1BL) SIM_REG8(OCR1CL)
+SIM_REG8(TCCR2A) SIM_REG8(TCCR2B) SIM_REG8(TCNT2) SIM_REG8(OCR2A) SIM_REG8(TIMSK2)
+SIM_REG8(TIFR2)
+SIM_REG8(TCCR3A) SIM_REG8(TCCR3B) SIM_REG8(OCR3BL) SIM_REG8(OCR3CL)
+SIM_REG8(SREG)
+
+volatile uint8_t *sim_twcr(void);
+volatile uint8_t *sim_tcnt0(void);
+
+#define TWCR        (*sim_twcr())
+#define TCNT0       (*sim_tcnt0())
+
+// TWCR
+#define TWINT   7
+#define TWEA    6
+#define TWSTA   5
+#define TWSTO   4
+#define TWWC    3
+#define TWEN    2
+#define TWIE    0
+
+// TWSR
+#define TWPS1   1
+#define TWPS0   0
+
+// UCSR0A, UCSR0B, UCSR0C
+#define RXC0    7
+#define TXC0    6
+#define UDRE0   5
+#define FE0     4
+#define DOR0    3
+#define UPE0    2
+#define U2X0    1
+#define MPCM0   0
+#define RXCIE0  7
+#define TXCIE0  6
+#define UDRIE0  5
+#define RXEN0   4
+#define TXEN0   3
+#define UCSZ01  2
+#define UCSZ00  1
+
+// timers
+#define OCF0A   1
+#define OCIE0A  1
+#define WGM02   3
+#define WGM01   1
+#define WGM00   0
+#define CS02    2
+#define CS01    1
+#define CS00    0
+#define COM1A1  7
+#define COM1B1  5
+#define COM1C1  3
+#define WGM12   3
+#define WGM10   0
+#define CS11    1
+#define CS10    0
+#define WGM21   1
+#define CS22    2
+#define CS21    1
+#define CS20    0
+#define OCIE2A  1
+#define OCF2A   1
+#define COM3A1  7
+#define COM3B1  5
+#define COM3C1  3
+#define WGM32   3
+#define CS31    1
+#define CS30    0
+
+// SREG
+#define SREG_I  7
+
+// ports
+#define PB0     0
+#define PB4     4
+#define PB5     5
+#define PB6     6
+#define PB7     7
+#define PD0     0
+#define PD1     1
+#define PD4     4
+#define PE2     2
+#define PE3     3
+#define PE4     4
+#define PE5     5
+
+#endif
@@ -0,0 +1,22 @@
+/*******************************************************************************
+*   File Name: avr/pgmspace.h
+*
+* Description: host stand-in, flash is ordinary memory.  pgm_read_word()
+*              reads the object's own size so tables of pointers work with
+*              64-bit host pointers.
+*******************************************************************************/
+#ifndef __stub_avr_pgmspace_h__
+#define __stub_avr_pgmspace_h__
+
+#include <inttypes.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P               const char *
+#define PSTR(s)             (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(addr))
+#define strcmp_P            strcmp
+#define strlen_P            strlen
+
+#endif
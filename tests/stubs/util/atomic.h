@@ -0,0 +1,19 @@
+/*******************************************************************************
+*   File Name: util/atomic.h
+*
+* Description: host stand-in.  Clears SREG_I for the block and puts it back
+*              after, like ATOMIC_RESTORESTATE.
+*******************************************************************************/
+#ifndef __stub_util_atomic_h__
+#define __stub_util_atomic_h__
+
+#include <avr/io.h>
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON      1
+
+#define ATOMIC_BLOCK(type) \
+    for(uint8_t sim_sreg = SREG, sim_once = (SREG &= ~_BV(SREG_I), 1); \
+        sim_once; SREG = (type) ? (sim_sreg | _BV(SREG_I)) : sim_sreg, sim_once = 0)
+
+#endif
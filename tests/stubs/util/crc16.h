@@ -0,0 +1,23 @@
+/*******************************************************************************
+*   File Name: util/crc16.h
+*
+* Description: host stand-in, the avr-libc reference C versions
+*******************************************************************************/
+#ifndef __stub_util_crc16_h__
+#define __stub_util_crc16_h__
+
+#include <inttypes.h>
+
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+    uint8_t i;
+
+    crc ^= (uint16_t)data << 8;
+    for(i = 0; i < 8; i++)
+    {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+}
+
+#endif
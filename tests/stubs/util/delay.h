@@ -0,0 +1,12 @@
+/*******************************************************************************
+*   File Name: util/delay.h
+*
+* Description: host stand-in
+*******************************************************************************/
+#ifndef __stub_util_delay_h__
+#define __stub_util_delay_h__
+
+#define _delay_us(us)   ((void)(us))
+#define _delay_ms(ms)   ((void)(ms))
+
+#endif
@@ -0,0 +1,246 @@
+/*******************************************************************************
+*   File Name: test_cmdline.c
+*
+* Description: cmdLinePut() against a reference that keeps the line as typed,
+*              applies backspaces to it, then splits it with strtok() and
+*              converts numbers with strtoll().  Random byte streams mix
+*              words, numbers near the int32_t limits, separators,
+*              backspaces and lines well past CMD_BUFFER_SIZE.
+*******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "unit.h"
+#include "serialPortCmd.h"
+
+#define LINES   200000
+
+/*
+ * reference line: the bytes as typed with backspaces applied, and the error
+ * the rules in serialPortCmd.h give
+ */
+typedef struct
+{
+    char    text[512];
+    int     len;
+    int     error;
+} ref_line_t;
+
+static int isSep(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+static int refWords(const ref_line_t *ref)
+{
+    int words = 0;
+    int i;
+
+    for(i = 0; i < ref->len; i++)
+    {
+        if(!isSep(ref->text[i]) && (i == 0 || isSep(ref->text[i - 1])))
+        {
+            words++;
+        }
+    }
+    return words;
+}
+
+static void refPut(ref_line_t *ref, char c)
+{
+    if(ref->error)
+    {
+        return;
+    }
+    if(c == CMD_BACKSPACE || c == CMD_DELETE)
+    {
+        if(ref->len > 0)
+        {
+            ref->len--;
+        }
+        return;
+    }
+    if(ref->len >= CMD_BUFFER_SIZE - 1)
+    {
+        ref->error = CMD_LINE_TOO_LONG;
+        return;
+    }
+    if(!isSep(c) && (ref->len == 0 || isSep(ref->text[ref->len - 1])) &&
+       refWords(ref) == CMD_MAX_TOKENS)
+    {
+        ref->error = CMD_LINE_TOO_MANY;
+        return;
+    }
+    ref->text[ref->len++] = c;
+}
+
+/*
+ * number rule: optional '-', then decimal digits or 0x and hex digits, value
+ * at most INT32_MAX
+ */
+static int refNumber(const char *word, long *val)
+{
+    const char *p   = word;
+    int         neg = 0;
+    int         base = 10;
+    long long   v;
+    char       *end;
+
+    if(*p == '-')
+    {
+        neg = 1;
+        p++;
+    }
+    if(p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    {
+        base = 16;
+        p += 2;
+    }
+    // strtoll() would also take a sign, blanks or a second 0x
+    if(*p == '\0' ||
+       p[strspn(p, (base == 16) ? "0123456789abcdefABCDEF" : "0123456789")] != '\0')
+    {
+        return 0;
+    }
+    v = strtoll(p, &end, base);
+    if(*end != '\0' || v > INT32_MAX)
+    {
+        return 0;
+    }
+    *val = neg ? -v : v;
+    return 1;
+}
+
+static void compare(cmd_line_t *line, ref_line_t *ref)
+{
+    char *word[CMD_BUFFER_SIZE];
+    char *w;
+    int   count = 0;
+    long  val;
+    int   i;
+
+    CHECK_EQ(line->error, ref->error);
+    if(ref->error || line->error)
+    {
+        return;
+    }
+
+    ref->text[ref->len] = '\0';
+    for(w = strtok(ref->text, " \t\n"); w != NULL; w = strtok(NULL, " \t\n"))
+    {
+        word[count++] = w;
+    }
+
+    CHECK_EQ(line->count, count);
+    for(i = 0; i < count && i < line->count; i++)
+    {
+        CHECK(strcmp(&line->buf[line->start[i]], word[i]) == 0);
+        if(refNumber(word[i], &val))
+        {
+            CHECK((line->isNum >> i) & 1);
+            CHECK_EQ(line->val[i], val);
+        }
+        else
+        {
+            CHECK_EQ((line->isNum >> i) & 1, 0);
+        }
+    }
+}
+
+static const char *const pieces[] =
+{
+    " ", " ", "  ", "\t", "\n", "\b", "\x7f", "\b\b",
+    "a", "mux", "sel", "x", "X", "-", "0", "7", "42", "ff", "0x", "0X1f",
+    "-0x7FFFFFFF", "2147483647", "2147483648", "-2147483647", "0x80000000",
+    "99999999999", "00x5", "0xg", "--1", "1-",
+};
+
+static void putStr(cmd_line_t *line, ref_line_t *ref, const char *s)
+{
+    for(; *s; s++)
+    {
+        CHECK_EQ(cmdLinePut(line, *s), CMD_LINE_MORE);
+        refPut(ref, *s);
+    }
+}
+
+static void endLine(cmd_line_t *line, ref_line_t *ref)
+{
+    CHECK_EQ(cmdLinePut(line, '\r'), CMD_LINE_DONE);
+    compare(line, ref);
+}
+
+int main(void)
+{
+    static cmd_line_t line;
+    ref_line_t        ref;
+    int               n;
+    int               pieceCount;
+    int               i;
+    int               tooLong = 0;
+
+    srand(14);
+
+    // backspace over a separator reopens the word in front
+    cmdLineReset(&line);
+    memset(&ref, 0, sizeof(ref));
+    putStr(&line, &ref, "12 \b3");
+    endLine(&line, &ref);
+    CHECK_EQ(line.count, 1);
+    CHECK_EQ(line.val[0], 123);
+
+    cmdLineReset(&line);
+    memset(&ref, 0, sizeof(ref));
+    putStr(&line, &ref, "ab  \b\bc 0x1\b\b\b-5");
+    endLine(&line, &ref);
+    CHECK_EQ(line.count, 2);
+    CHECK(strcmp(&line.buf[line.start[0]], "abc") == 0);
+    CHECK_EQ(line.val[1], -5);
+
+    // a word taken back to nothing, then a number in its place
+    cmdLineReset(&line);
+    memset(&ref, 0, sizeof(ref));
+    putStr(&line, &ref, "mux x\b7");
+    endLine(&line, &ref);
+    CHECK_EQ(line.count, 2);
+    CHECK_EQ(line.isNum, 0x02);
+
+    // longest line fits, one more byte does not, backspace cannot undo it
+    cmdLineReset(&line);
+    memset(&ref, 0, sizeof(ref));
+    for(i = 0; i < CMD_BUFFER_SIZE - 1; i++)
+    {
+        putStr(&line, &ref, (i % 25 == 24) ? " " : "a");
+    }
+    endLine(&line, &ref);
+    CHECK_EQ(line.error, 0);
+
+    cmdLineReset(&line);
+    memset(&ref, 0, sizeof(ref));
+    for(i = 0; i < CMD_BUFFER_SIZE; i++)
+    {
+        putStr(&line, &ref, (i % 25 == 24) ? " " : "a");
+    }
+    putStr(&line, &ref, "\b\b\b");
+    endLine(&line, &ref);
+    CHECK_EQ(line.error, CMD_LINE_TOO_LONG);
+
+    for(n = 0; n < LINES; n++)
+    {
+        cmdLineReset(&line);
+        memset(&ref, 0, sizeof(ref));
+
+        // every tenth line is long enough to overflow most of the time
+        pieceCount = rand() % ((n % 10 == 0) ? 120 : 16);
+        for(i = 0; i < pieceCount; i++)
+        {
+            putStr(&line, &ref, pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))]);
+        }
+        tooLong += (ref.error == CMD_LINE_TOO_LONG);
+        endLine(&line, &ref);
+    }
+
+    // the long lines must actually have gone over
+    CHECK(tooLong > LINES / 50);
+
+    return unit_report("test_cmdline");
+}
@@ -0,0 +1,101 @@
+/*******************************************************************************
+*   File Name: test_cobs.c
+*
+* Description: the firmware's COBS and packet code as a filter for
+*              test_cobs.py, which checks it against tools/mfgproto.py.  One
+*              request per line, data in hex, one line of hex back:
+*
+*                  e <data>     cobs_encode()
+*                  d <data>     cobs_decode(), "error" if it is invalid
+*                  s <packet>   binarySendPacket(cmd, seq, data...), the
+*                               frame as sent, delimiter included
+*                  r <bytes>    binaryCmdRxByte() for each byte, whatever
+*                               the firmware sends back
+*******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "sim.h"
+#include "uart.h"
+#include "binaryCmd.h"
+
+#define MAX_BYTES   1024
+
+static uint16_t parseHex(const char *s, uint8_t *out)
+{
+    uint16_t n = 0;
+    unsigned byte;
+
+    while(n < MAX_BYTES && sscanf(s, "%2x", &byte) == 1)
+    {
+        out[n++] = byte;
+        s += 2;
+    }
+    return n;
+}
+
+static void printHex(const uint8_t *buf, uint16_t n)
+{
+    uint16_t i;
+
+    for(i = 0; i < n; i++)
+    {
+        printf("%02x", buf[i]);
+    }
+    printf("\n");
+}
+
+int main(void)
+{
+    static char    line[2 * MAX_BYTES + 8];
+    static uint8_t in[MAX_BYTES];
+    static uint8_t out[MAX_BYTES];
+    uint16_t       n;
+    uint16_t       i;
+    int16_t        len;
+
+    sim_reset();
+    init_usart0();
+    uart_set_echo(0);
+
+    while(fgets(line, sizeof(line), stdin) != NULL)
+    {
+        n = parseHex(line + 2, in);
+        switch(line[0])
+        {
+            case 'e':
+                printHex(out, cobs_encode(in, n, out));
+                break;
+
+            case 'd':
+                len = cobs_decode(in, n, out);
+                if(len < 0)
+                {
+                    printf("error\n");
+                }
+                else
+                {
+                    printHex(out, len);
+                }
+                break;
+
+            case 's':
+                binarySendPacket(in[0], in[1], &in[2], n - 2);
+                printHex(out, sim_uart_drain(out, sizeof(out)));
+                break;
+
+            case 'r':
+                for(i = 0; i < n; i++)
+                {
+                    binaryCmdRxByte(in[i]);
+                }
+                printHex(out, sim_uart_drain(out, sizeof(out)));
+                break;
+
+            default:
+                printf("?\n");
+                break;
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Check the firmware's COBS and packet code (test_cobs.c) against the host
+reference in tools/mfgproto.py, both ways round.
+
+Usage: test_cobs.py PATH_TO_TEST_COBS
+"""
+import os
+import random
+import struct
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools"))
+import mfgproto  # noqa: E402
+
+MAX_DATA = mfgproto.MAX_PAYLOAD - 4     # cmd, seq, crc16
+
+
+class Firmware:
+    def __init__(self, path):
+        self.proc = subprocess.Popen([path], stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                                     universal_newlines=True)
+
+    def call(self, op, data=b""):
+        self.proc.stdin.write("%s %s\n" % (op, bytes(data).hex()))
+        self.proc.stdin.flush()
+        reply = self.proc.stdout.readline().strip()
+        return None if reply == "error" else bytes.fromhex(reply)
+
+    def close(self):
+        self.proc.stdin.close()
+        return self.proc.wait()
+
+
+checks = 0
+fails = 0
+
+
+def check(cond, what):
+    global checks, fails
+    checks += 1
+    if not cond:
+        fails += 1
+        print("FAIL: " + what)
+
+
+def round_trip(fw, data, what):
+    c_enc = fw.call("e", data)
+    py_enc = mfgproto.cobs_encode(data)
+    check(c_enc == py_enc, "%s: C and Python encodings differ" % what)
+    check(0 not in c_enc, "%s: zero byte in the encoding" % what)
+    check(len(c_enc) <= len(data) + len(data) // 254 + 1, "%s: encoding too long" % what)
+    check(fw.call("d", py_enc) == data, "%s: C does not decode the Python encoding" % what)
+    check(mfgproto.cobs_decode(c_enc) == data, "%s: Python does not decode the C encoding" % what)
+
+
+def main():
+    fw = Firmware(sys.argv[1])
+    rnd = random.Random(9)
+
+    # CRC-16/XMODEM check value, Python and the firmware's binCrc()
+    check(mfgproto.crc16_xmodem(b"123456789") == 0x31C3, "Python crc16_xmodem check value")
+    pkt = mfgproto.cobs_decode(fw.call("s", b"123456789")[:-1])
+    check(pkt[:9] == b"123456789", "check value packet body")
+    check(struct.unpack("<H", pkt[9:])[0] == 0x31C3, "firmware crc check value")
+
+    # edge cases
+    round_trip(fw, b"", "empty")
+    round_trip(fw, b"\x00", "one zero")
+    for n in (1, 2, 253, 254, 255):
+        round_trip(fw, b"\x00" * n, "%d zeros" % n)
+        round_trip(fw, bytes([0x5A]) * n, "%d byte run without zeros" % n)
+        round_trip(fw, bytes(rnd.randrange(1, 256) for _ in range(n)), "%d random non-zero" % n)
+    round_trip(fw, bytes([0x11] * 254 + [0]), "254 byte run then a zero")
+    round_trip(fw, bytes([0] + [0x11] * 254), "zero then a 254 byte run")
+    round_trip(fw, bytes(range(256))[1:], "1..255")
+
+    # random data, zeros common
+    for n in range(2000):
+        size = rnd.choice((rnd.randrange(0, 16), rnd.randrange(0, 256)))
+        data = bytes(rnd.choice((0, rnd.randrange(256))) for _ in range(size))
+        round_trip(fw, data, "random %d" % n)
+
+    # invalid encodings
+    check(fw.call("d", b"\x00") is None, "zero code accepted")
+    check(fw.call("d", b"\x05\x01\x02") is None, "short block accepted")
+
+    # packets the firmware sends are the frames the host builds, and parse
+    for size in (0, 1, MAX_DATA - 1, MAX_DATA):
+        data = bytes(rnd.randrange(256) for _ in range(size))
+        frame = fw.call("s", bytes([0x81, size]) + data)
+        check(frame == mfgproto.build_frame(0x81, size, data), "send %d bytes" % size)
+        check(mfgproto.parse_frame(frame[:-1]) == (0x81, size, data), "parse %d bytes" % size)
+
+    # over length data is cut to the largest packet
+    data = bytes(range(1, MAX_DATA + 11))
+    frame = fw.call("s", bytes([0x81, 0]) + data)
+    check(mfgproto.parse_frame(frame[:-1])[2] == data[:MAX_DATA], "over length send")
+
+    # requests from the host reference are answered with a valid frame
+    for seq in (0, 1, 0xFF):
+        cmd, rseq, body = mfgproto.parse_frame(fw.call("r", mfgproto.build_frame(
+            mfgproto.CMD_PING, seq))[:-1])
+        check((cmd, rseq, body) == (mfgproto.CMD_PING | mfgproto.RSP_FLAG, seq,
+                                     bytes([0, mfgproto.PROTOCOL_VERSION, mfgproto.MAX_PAYLOAD])),
+              "ping %d" % seq)
+
+    # a bad CRC is reported, an over length frame is dropped without one
+    bad = bytearray(mfgproto.cobs_decode(mfgproto.build_frame(mfgproto.CMD_PING, 7)[:-1]))
+    bad[-1] ^= 0x40
+    reply = fw.call("r", mfgproto.cobs_encode(bytes(bad)) + b"\x00")
+    check(mfgproto.parse_frame(reply[:-1])[2][0] == 1, "bad crc status")
+    check(fw.call("r", bytes([1]) * 300 + b"\x00") == b"", "over length frame answered")
+    check(len(fw.call("r", mfgproto.build_frame(mfgproto.CMD_PING, 8))) > 0,
+          "ping after an over length frame")
+
+    fw.close()
+    print("test_cobs: %d checks, %d failed" % (checks, fails))
+    return 1 if fails else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
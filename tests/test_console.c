@@ -0,0 +1,171 @@
+/*******************************************************************************
+*   File Name: test_console.c
+*
+* Description: cprintf_P() against the C library's snprintf for every
+*              conversion the firmware uses, read back off the UART.  int
+*              is 16 bits on the target, so plain conversions are only fed
+*              16-bit values and 'l' conversions 32-bit ones.  The "log"
+*              command's flash name tables are matched and printed.
+*******************************************************************************/
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include "unit.h"
+#include "sim.h"
+#include "uart.h"
+#include "console.h"
+#include "log.h"
+
+static const char flashStr[] PROGMEM = "from flash";
+
+static const int16_t sValues[] =
+{
+    0, 1, -1, 9, -9, 10, -10, 99, 100, -100, 12345, -12345, INT16_MAX, INT16_MIN
+};
+static const uint16_t uValues[] =
+{
+    0, 1, 9, 10, 15, 16, 99, 100, 255, 256, 4095, 9999, 10000, UINT16_MAX
+};
+static const int32_t lValues[] =
+{
+    0, 1, -1, 65535, 65536, -65536, 999999, 1000000, 123456789, -123456789,
+    INT32_MAX, INT32_MIN
+};
+
+static const char *const sFormats[] = { "%d", "%1d", "%5d", "%05d", "%02d" };
+static const char *const uFormats[] =
+{
+    "%u", "%02u", "%7u", "%x", "%02x", "%X", "%02X", "%.2X", "%4X", "%2u"
+};
+static const char *const lFormats[] = { "%ld", "%12ld", "%012ld" };
+static const char *const luFormats[] =
+{
+    "%lu", "%6lu", "%10lu", "%lx", "%lX", "%08lX"
+};
+
+/*
+ * format with cprintf_P, collect what the UART sent and compare it with the
+ * expected text
+ */
+static void checkFmt(const char *expect, const char *fmt, ...)
+{
+    char     out[UART_TX_BUFFER_SIZE + 1];
+    uint16_t len;
+    va_list  ap;
+
+    va_start(ap, fmt);
+    cvprintf_P(fmt, ap);
+    va_end(ap);
+    len      = sim_uart_drain((uint8_t *)out, sizeof(out) - 1);
+    out[len] = '\0';
+
+    CHECK(strcmp(out, expect) == 0);
+    if(strcmp(out, expect) != 0)
+    {
+        printf("  \"%s\": \"%s\" != \"%s\"\n", fmt, out, expect);
+    }
+}
+
+/*
+ * run "log <sub> <level>" and return what it printed, as much as fits in
+ * the transmit ring
+ */
+static const char *runLog(char *sub, char *level)
+{
+    static char out[UART_TX_BUFFER_SIZE * 2 + 1];
+    cmd_args_t  args;
+    uint16_t    len;
+
+    memset(&args, 0, sizeof(args));
+    args.argv[0] = sub;
+    args.argv[1] = level;
+    args.argc    = (sub != NULL) + (level != NULL);
+    cmdLog(&args);
+    len      = sim_uart_drain((uint8_t *)out, sizeof(out) - 1);
+    out[len] = '\0';
+    return out;
+}
+
+static void testLogNames(void)
+{
+    uint8_t saved[LOG_SUB_COUNT];
+
+    memcpy(saved, logLevel, sizeof(saved));
+    uart_set_tx_policy(UART_TX_DROP);
+    CHECK(strstr(runLog("mux", "debug"), "  mux = debug (max debug)\r\n") != NULL);
+    CHECK_EQ(logLevel[LOG_SUB_MUX], LOG_DEBUG);
+    CHECK(strstr(runLog("twi", "warn"), "  twi is limited to error at compile time\r\n") != NULL);
+    CHECK_EQ(logLevel[LOG_SUB_TWI], LOG_ERROR);
+    CHECK(strstr(runLog("humid", "bogus"), "ERROR - usage") != NULL);
+    CHECK(strstr(runLog("nope", "none"), "ERROR - usage") != NULL);
+    CHECK(strstr(runLog(NULL, NULL), "  i2c = error (max error)\r\n") != NULL);
+    uart_set_tx_policy(UART_TX_POLICY_DEFAULT);
+    memcpy(logLevel, saved, sizeof(saved));
+}
+
+int main(void)
+{
+    char    ref[64];
+    uint8_t f;
+    uint8_t i;
+
+    sim_reset();
+    init_usart0();
+    uart_set_echo(0);
+    sim_uart_drain(NULL, 0);
+
+    for(f = 0; f < sizeof(sFormats) / sizeof(sFormats[0]); f++)
+    {
+        for(i = 0; i < sizeof(sValues) / sizeof(sValues[0]); i++)
+        {
+            snprintf(ref, sizeof(ref), sFormats[f], (int)sValues[i]);
+            checkFmt(ref, sFormats[f], (int)sValues[i]);
+        }
+    }
+
+    for(f = 0; f < sizeof(uFormats) / sizeof(uFormats[0]); f++)
+    {
+        for(i = 0; i < sizeof(uValues) / sizeof(uValues[0]); i++)
+        {
+            snprintf(ref, sizeof(ref), uFormats[f], (unsigned int)uValues[i]);
+            checkFmt(ref, uFormats[f], (unsigned int)uValues[i]);
+        }
+    }
+
+    for(i = 0; i < sizeof(lValues) / sizeof(lValues[0]); i++)
+    {
+        for(f = 0; f < sizeof(lFormats) / sizeof(lFormats[0]); f++)
+        {
+            snprintf(ref, sizeof(ref), lFormats[f], (long)lValues[i]);
+            checkFmt(ref, lFormats[f], lValues[i]);
+        }
+        for(f = 0; f < sizeof(luFormats) / sizeof(luFormats[0]); f++)
+        {
+            snprintf(ref, sizeof(ref), luFormats[f], (unsigned long)(uint32_t)lValues[i]);
+            checkFmt(ref, luFormats[f], (uint32_t)lValues[i]);
+        }
+    }
+
+    checkFmt("A", "%c", 'A');
+    checkFmt("[] [abc]", "[%s] [%s]", "", "abc");
+    checkFmt("<from flash>", "<%S>", flashStr);
+    checkFmt("100%", "100%%");
+    checkFmt("no conversions\r\n", "no conversions\r\n");
+
+    // messages as the firmware prints them
+    snprintf(ref, sizeof(ref), "\r\nbaud = %lu, error = %d.%d%%\r\n", 115200UL, -2, 1);
+    checkFmt(ref, "\r\nbaud = %lu, error = %d.%d%%\r\n", (uint32_t)115200, -2, 1);
+    snprintf(ref, sizeof(ref), "  0x%02X ch %u dev 0x%02X: %u fails, last %d after %lu us",
+             0x70, 3, 0x28, 12, -8, 180000UL);
+    checkFmt(ref, "  0x%02X ch %u dev 0x%02X: %u fails, last %d after %lu us",
+             0x70, 3, 0x28, 12, -8, (uint32_t)180000);
+
+    // unsupported conversions print the letter, a trailing % nothing
+    checkFmt("q", "%q");
+    checkFmt("abc", "abc%");
+
+    testLogNames();
+
+    return unit_report("test_console");
+}
@@ -0,0 +1,57 @@
+/*******************************************************************************
+*   File Name: test_humidity.c
+*
+* Description: humidityConvert() against the ChipCap2 data sheet formulas,
+*              computed in floating point and rounded to nearest, for every
+*              14-bit code:
+*
+*                  RH   = code / 2^14 * 100        in 0.01 %RH
+*                  Temp = code / 2^14 * 165 - 40   in 0.01 C
+*******************************************************************************/
+#include <math.h>
+#include "unit.h"
+#include "humiditySensor.h"
+
+int main(void)
+{
+    humid_data_t data;
+    uint8_t      raw[4];
+    uint16_t     code;
+    uint8_t      status;
+    long         rh;
+    long         temp;
+    int          bad = 0;
+
+    for(code = 0; code < 0x4000; code++)
+    {
+        // same code in both fields, status bits cycling through all four
+        status = code & 0x03;
+        raw[0] = (status << 6) | (code >> 8);
+        raw[1] = code & 0xFF;
+        raw[2] = code >> 6;
+        raw[3] = (code & 0x3F) << 2;
+
+        rh   = lround(code * 10000.0 / 16384.0);
+        temp = lround(code * 16500.0 / 16384.0) - 4000;
+
+        CHECK_EQ(humidityConvert(raw, &data), status);
+        if(data.rhRaw != code || data.tempRaw != code ||
+           data.rh != rh || data.temp != temp)
+        {
+            if(bad++ < 8)
+            {
+                printf("code %u: rh %u want %ld, temp %d want %ld\n",
+                       code, data.rh, rh, data.temp, temp);
+            }
+        }
+    }
+    CHECK_EQ(bad, 0);
+
+    // end points from the data sheet
+    raw[0] = 0x3F; raw[1] = 0xFF; raw[2] = 0xFF; raw[3] = 0xFC;
+    humidityConvert(raw, &data);
+    CHECK_EQ(data.rh, 9999);
+    CHECK_EQ(data.temp, 12499);
+
+    return unit_report("test_humidity");
+}
@@ -0,0 +1,195 @@
+/*******************************************************************************
+*   File Name: test_swtimer.c
+*
+* Description: the software timer list, clocked one Timer0 interrupt at a
+*              time with swtimer_service() run after every tick as the main
+*              loop would: expiry order, periodic timers, stopping and
+*              restarting, a main loop that falls behind, and the tick
+*              count wrapping.
+*******************************************************************************/
+#include <string.h>
+#include "unit.h"
+#include "sim.h"
+#include "timers.h"
+
+extern volatile uint32_t ms_tickCount;  // timers.c
+
+#define MAX_FIRED       64
+
+static sw_timer_t  timer[4];
+static sw_timer_t *fired[MAX_FIRED];
+static uint32_t    firedAt[MAX_FIRED];
+static uint8_t     numFired;
+static uint8_t     stopAfter;
+
+static void setup(uint32_t ticks)
+{
+    sim_reset();
+    init_timers();
+    ms_tickCount = ticks;
+    memset(timer, 0, sizeof(timer));
+    numFired  = 0;
+    stopAfter = 0;
+}
+
+/*
+ * let ms go by, one Timer0 interrupt and one main loop pass per msec
+ */
+static void tick(uint32_t ms)
+{
+    while(ms--)
+    {
+        TIMER0_COMPA_vect();
+        swtimer_service();
+    }
+}
+
+static void record(sw_timer_t *t)
+{
+    if(numFired < MAX_FIRED)
+    {
+        fired[numFired]   = t;
+        firedAt[numFired] = ms_time();
+        numFired++;
+    }
+    if(stopAfter != 0 && numFired >= stopAfter)
+    {
+        swtimer_stop(t);
+    }
+}
+
+static void restart(sw_timer_t *t)
+{
+    record(t);
+    if(numFired < 3)
+    {
+        swtimer_start(t, 7, 0, restart, NULL);
+    }
+}
+
+/*
+ * one shot timers run once, at their expiry, in expiry order; equal
+ * expiries in the order they were started
+ */
+static void testOrder(void)
+{
+    setup(0);
+    swtimer_start(&timer[0], 30, 0, record, &timer[0]);
+    swtimer_start(&timer[1], 10, 0, record, NULL);
+    swtimer_start(&timer[2], 20, 0, record, NULL);
+    swtimer_start(&timer[3], 10, 0, record, NULL);
+    CHECK(swtimer_active(&timer[0]));
+
+    tick(9);
+    CHECK_EQ(numFired, 0);
+    tick(31);
+    CHECK_EQ(numFired, 4);
+    CHECK(fired[0] == &timer[1] && firedAt[0] == 10);
+    CHECK(fired[1] == &timer[3] && firedAt[1] == 10);
+    CHECK(fired[2] == &timer[2] && firedAt[2] == 20);
+    CHECK(fired[3] == &timer[0] && firedAt[3] == 30);
+    CHECK(timer[0].context == &timer[0]);
+    CHECK(!swtimer_active(&timer[0]));
+    CHECK(!swtimer_active(&timer[1]));
+}
+
+/*
+ * a periodic timer keeps its rate and can stop itself from its callback
+ */
+static void testPeriodic(void)
+{
+    uint8_t i;
+
+    setup(0);
+    swtimer_start(&timer[0], 5, 5, record, NULL);
+    swtimer_start(&timer[1], 3, 0, record, NULL);
+    tick(50);
+    CHECK_EQ(numFired, 11);
+    CHECK(fired[0] == &timer[1] && firedAt[0] == 3);
+    for(i = 1; i < numFired; i++)
+    {
+        CHECK(fired[i] == &timer[0] && firedAt[i] == 5UL * i);
+    }
+    CHECK(swtimer_active(&timer[0]));
+
+    setup(0);
+    stopAfter = 3;
+    swtimer_start(&timer[0], 2, 4, record, NULL);
+    tick(50);
+    CHECK_EQ(numFired, 3);
+    CHECK_EQ(firedAt[2], 10);
+    CHECK(!swtimer_active(&timer[0]));
+}
+
+/*
+ * stopped timers never run, stopping twice is harmless, starting a running
+ * timer moves it, and a one shot timer may start itself again
+ */
+static void testStopRestart(void)
+{
+    setup(0);
+    swtimer_start(&timer[0], 10, 0, record, NULL);
+    swtimer_start(&timer[1], 10, 10, record, NULL);
+    swtimer_start(&timer[2], 15, 0, record, NULL);
+    tick(5);
+    swtimer_stop(&timer[1]);
+    swtimer_stop(&timer[1]);
+    swtimer_start(&timer[0], 20, 0, record, NULL);
+    tick(50);
+    CHECK_EQ(numFired, 2);
+    CHECK(fired[0] == &timer[2] && firedAt[0] == 15);
+    CHECK(fired[1] == &timer[0] && firedAt[1] == 25);
+
+    setup(0);
+    swtimer_start(&timer[0], 7, 0, restart, NULL);
+    tick(50);
+    CHECK_EQ(numFired, 3);
+    CHECK_EQ(firedAt[2], 21);
+    CHECK(!swtimer_active(&timer[0]));
+}
+
+/*
+ * a main loop that misses several periods runs the callback once and
+ * picks the period up again from then
+ */
+static void testBehind(void)
+{
+    setup(0);
+    swtimer_start(&timer[0], 10, 10, record, NULL);
+    ms_tickCount += 35;
+    swtimer_service();
+    CHECK_EQ(numFired, 1);
+    tick(9);
+    CHECK_EQ(numFired, 1);
+    tick(1);
+    CHECK_EQ(numFired, 2);
+    CHECK_EQ(firedAt[1], 45);
+}
+
+/*
+ * expiries across the tick count wrapping keep their order
+ */
+static void testWrap(void)
+{
+    setup(0xFFFFFFF0UL);
+    swtimer_start(&timer[0], 32, 0, record, NULL);
+    swtimer_start(&timer[1], 8, 0, record, NULL);
+    swtimer_start(&timer[2], 20, 10, record, NULL);
+    tick(33);
+    CHECK_EQ(numFired, 4);
+    CHECK(fired[0] == &timer[1] && firedAt[0] == 0xFFFFFFF8UL);
+    CHECK(fired[1] == &timer[2] && firedAt[1] == 4);
+    CHECK(fired[2] == &timer[2] && firedAt[2] == 14);
+    CHECK(fired[3] == &timer[0] && firedAt[3] == 16);
+}
+
+int main(void)
+{
+    testOrder();
+    testPeriodic();
+    testStopRestart();
+    testBehind();
+    testWrap();
+
+    return unit_report("test_swtimer");
+}
@@ -0,0 +1,650 @@
+/*******************************************************************************
+*   File Name: test_twi.c
+*
+* Description: the interrupt driven TWI engine against the simulated bus in
+*              sim.c.  The TWI_vect state machine is walked through writes,
+*              reads, repeated STARTs, NACKs, inter-byte pacing, quarantine
+*              re-probes, bus recovery and the queue.  Every wait must end: arbitration losses, NACK
+*              restarts, a hung bus, a slow slave and a STOP that never goes
+*              out each finish with their error within their bound.
+*******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "unit.h"
+#include <util/twi.h>
+#include "sim.h"
+#include "uart.h"
+#include "log.h"
+#include "twi_utils.h"
+
+#define DEV             0x28
+#define MUX             0x70
+#define RUN_LIMIT_US    10000000UL      // give up, the engine is stuck
+
+static uint8_t wrData[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+static uint8_t slaveData[8] = { 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7 };
+static uint8_t doneOrder[4];
+static uint8_t doneCount;
+
+/*
+ * fresh bus and engine state, nothing learned
+ */
+static void setup(void)
+{
+    sim_reset();
+    init_usart0();
+    uart_set_echo(0);
+    init_twi();
+    twi_timeouts_reset();
+    twi_health_clear();
+    twi_clear_muxes();
+}
+
+/*
+ * clock the bus, the inter-byte timer and the watchdog until the
+ * transaction is done
+ *
+ * Return: usec it took
+ */
+static uint32_t run(twi_xfer_t *xfer)
+{
+    uint32_t start = sim_us;
+
+    while(twi_xfer_pending(xfer) && sim_us - start < RUN_LIMIT_US)
+    {
+        if(!sim_twi_step() && !sim_timer2_step())
+        {
+            sim_advance_us(100);    // nothing happening on the wire
+        }
+        twi_service();
+        sim_uart_drain(NULL, 0);
+    }
+    CHECK(!twi_xfer_pending(xfer));
+    return sim_us - start;
+}
+
+static void submitWrite(twi_xfer_t *xfer, uint8_t addr, uint8_t len)
+{
+    twi_setup_xfer(xfer, addr, wrData, len, NULL, 0);
+    CHECK_EQ(twi_submit(xfer), 0);
+}
+
+static void recordDone(twi_xfer_t *xfer)
+{
+    doneOrder[doneCount++] = xfer->addr;
+}
+
+/*
+ * header and data go out in order after SLA+W, one START and one STOP; the
+ * result counts every byte acknowledged
+ */
+static void testWrite(void)
+{
+    twi_xfer_t     xfer;
+    sim_twi_dev_t *dev;
+
+    setup();
+    dev = sim_twi_add(DEV);
+    twi_setup_xfer(&xfer, DEV, wrData, 3, NULL, 0);
+    xfer.hdr[0] = 0x12;
+    xfer.hdr[1] = 0x34;
+    xfer.hdrLen = 2;
+    CHECK_EQ(twi_submit(&xfer), 0);
+    CHECK_EQ(xfer.state, TWI_XFER_BUSY);
+    CHECK_EQ(twi_submit(&xfer), TWI_ERR_BUSY);
+    run(&xfer);
+
+    CHECK_EQ(xfer.state, TWI_XFER_DONE);
+    CHECK_EQ(xfer.result, 5);
+    CHECK_EQ(dev->wrLen, 5);
+    CHECK(memcmp(dev->wr, "\x12\x34\x01\x02\x03", 5) == 0);
+    CHECK_EQ(sim_twi.starts, 1);
+    CHECK_EQ(sim_twi.stops, 1);
+    CHECK_EQ(sim_twi.events, 1 + 1 + 5);
+    CHECK(!twi_busy());
+
+    // address only
+    submitWrite(&xfer, DEV, 0);
+    run(&xfer);
+    CHECK_EQ(xfer.result, 0);
+    CHECK_EQ(sim_twi.stops, 2);
+}
+
+/*
+ * address pointer write, repeated START, read: every byte but the last is
+ * acknowledged so the slave is never read past the end
+ */
+static void testRead(void)
+{
+    twi_xfer_t     xfer;
+    sim_twi_dev_t *dev;
+    uint8_t        rd[8];
+    uint8_t        len;
+
+    for(len = 1; len <= 4; len++)
+    {
+        setup();
+        dev = sim_twi_add(DEV);
+        dev->rd    = slaveData;
+        dev->rdLen = sizeof(slaveData);
+        memset(rd, 0, sizeof(rd));
+
+        twi_setup_xfer(&xfer, DEV, NULL, 0, rd, len);
+        xfer.hdr[0] = 0x05;
+        xfer.hdrLen = 1;
+        CHECK_EQ(twi_submit(&xfer), 0);
+        run(&xfer);
+
+        CHECK_EQ(xfer.result, len);
+        CHECK(memcmp(rd, slaveData, len) == 0);
+        CHECK_EQ(rd[len], 0);
+        CHECK_EQ(dev->rdIdx, len);
+        CHECK_EQ(dev->wrLen, 1);
+        CHECK_EQ(dev->wr[0], 0x05);
+        CHECK_EQ(sim_twi.starts, 2);
+        CHECK_EQ(sim_twi.stops, 1);
+        CHECK_EQ(xfer.twst, TW_MR_DATA_NACK);
+    }
+
+    // read only, no pointer: no write phase and a single START
+    setup();
+    dev = sim_twi_add(DEV);
+    dev->rd    = slaveData;
+    dev->rdLen = sizeof(slaveData);
+    twi_setup_xfer(&xfer, DEV, NULL, 0, rd, 2);
+    CHECK_EQ(twi_submit(&xfer), 0);
+    run(&xfer);
+    CHECK_EQ(xfer.result, 2);
+    CHECK_EQ(dev->wrLen, 0);
+    CHECK_EQ(sim_twi.starts, 1);
+}
+
+/*
+ * a NACKed address is retried with a new START, a NACKed data byte ends
+ * the transaction with a STOP
+ */
+static void testNack(void)
+{
+    twi_xfer_t     xfer;
+    sim_twi_dev_t *dev;
+
+    setup();
+    dev = sim_twi_add(DEV);
+    dev->nackSla = 3;
+    submitWrite(&xfer, DEV, 2);
+    run(&xfer);
+    CHECK_EQ(xfer.result, 2);
+    CHECK_EQ(xfer.retries, 3);
+    CHECK_EQ(sim_twi.starts, 4);
+    CHECK_EQ(dev->wrLen, 2);
+
+    dev->nackByte = dev->wrLen + 2;
+    sim_twi.stops = 0;
+    submitWrite(&xfer, DEV, 4);
+    run(&xfer);
+    CHECK_EQ(xfer.result, TWI_ERR_DATA);
+    CHECK_EQ(xfer.twst, TW_MT_DATA_NACK);
+    CHECK_EQ(sim_twi.stops, 1);
+
+    // no slave at all
+    submitWrite(&xfer, DEV + 1, 1);
+    xfer.flags = TWI_XFER_PROBE;
+    run(&xfer);
+    CHECK_EQ(xfer.result, TWI_ERR_NACK);
+    CHECK_EQ(xfer.twst, TW_MT_SLA_NACK);
+}
+
+/*
+ * queued transactions run in order, one at a time, each callback from the
+ * interrupt that finished it
+ */
+static void testQueue(void)
+{
+    twi_xfer_t xfer[3];
+    uint8_t    rd[2];
+    uint8_t    i;
+
+    setup();
+    for(i = 0; i < 3; i++)
+    {
+        sim_twi_add(DEV + i);
+    }
+
+    doneCount = 0;
+    submitWrite(&xfer[0], DEV, 2);
+    twi_setup_xfer(&xfer[1], DEV + 1, NULL, 0, rd, 2);
+    CHECK_EQ(twi_submit(&xfer[1]), 0);
+    submitWrite(&xfer[2], DEV + 2, 1);
+    for(i = 0; i < 3; i++)
+    {
+        xfer[i].callback = recordDone;
+    }
+    CHECK_EQ(xfer[0].state, TWI_XFER_BUSY);
+    CHECK_EQ(xfer[1].state, TWI_XFER_QUEUED);
+    CHECK_EQ(xfer[2].state, TWI_XFER_QUEUED);
+
+    run(&xfer[2]);
+    CHECK_EQ(doneCount, 3);
+    CHECK_EQ(doneOrder[0], DEV);
+    CHECK_EQ(doneOrder[1], DEV + 1);
+    CHECK_EQ(doneOrder[2], DEV + 2);
+    CHECK_EQ(xfer[0].result, 2);
+    CHECK_EQ(xfer[1].result, 2);
+    CHECK_EQ(xfer[2].result, 1);
+    CHECK_EQ(sim_twi.stops, 3);
+    CHECK(!twi_busy());
+
+    // an interrupt with nothing queued just releases the bus
+    TWSR = TW_START;
+    TWI_vect();
+    CHECK_EQ(sim_twi_step(), 0);
+    CHECK_EQ(sim_twi.stops, 4);
+}
+
+/*
+ * losing arbitration TWI_MAX_ARB times ends the transaction without a STOP,
+ * the bus belongs to the other master; one loss fewer still gets through
+ */
+static void testArbitrationCap(void)
+{
+    twi_xfer_t xfer;
+
+    setup();
+    sim_twi_add(DEV);
+    sim_twi.arbLose = 1000;
+    submitWrite(&xfer, DEV, 2);
+    run(&xfer);
+    CHECK_EQ(xfer.result, TWI_ERR_ARB);
+    CHECK_EQ(sim_twi.starts, TWI_MAX_ARB);
+    CHECK_EQ(sim_twi.stops, 0);
+
+    // the queue is not wedged
+    sim_twi.arbLose = TWI_MAX_ARB - 1;
+    sim_twi.starts  = 0;
+    submitWrite(&xfer, DEV, 2);
+    run(&xfer);
+    CHECK_EQ(xfer.result, 2);
+    CHECK_EQ(sim_twi.starts, TWI_MAX_ARB);
+    CHECK_EQ(sim_twi.stops, 1);
+}
+
+/*
+ * a device that never answers is given up after TWI_MAX_ITER addresses
+ */
+static void testNackLimit(void)
+{
+    twi_xfer_t     xfer;
+    sim_twi_dev_t *dev;
+
+    setup();
+    dev = sim_twi_add(DEV);
+    dev->nackSla = 0xFFFF;
+    submitWrite(&xfer, DEV, 2);
+    run(&xfer);
+    CHECK_EQ(xfer.result, TWI_ERR_NACK);
+    CHECK_EQ(sim_twi.starts, TWI_MAX_ITER);
+
+    // a probe gives up on the first NACK
+    sim_twi.starts = 0;
+    submitWrite(&xfer, DEV, 0);
+    xfer.flags = TWI_XFER_PROBE;
+    run(&xfer);
+    CHECK_EQ(xfer.result, TWI_ERR_NACK);
+    CHECK_EQ(sim_twi.starts, 1);
+}
+
+/*
+ * a hung bus is caught by the phase watchdog, TWI_TIMEOUT_US with nothing
+ * learned, in the phase it hung in
+ */
+static void testPhaseTimeout(void)
+{
+    twi_xfer_t xfer;
+    uint32_t   us;
+
+    setup();
+    sim_twi_add(DEV);
+    sim_twi.stall = 1;
+    submitWrite(&xfer, DEV, 2);
+    us = run(&xfer);
+    CHECK_EQ(xfer.result, TWI_ERR_START_TIMEOUT);
+    CHECK(us >= TWI_TIMEOUT_US && us < TWI_TIMEOUT_US + 1000);
+
+    // hung after the START: the address phase times out
+    sim_twi.stall = 0;
+    submitWrite(&xfer, DEV, 2);
+    CHECK_EQ(sim_twi_step(), 1);
+    sim_twi.stall = 1;
+    us = run(&xfer);
+    CHECK_EQ(xfer.result, TWI_ERR_DATA);
+    CHECK(us >= TWI_TIMEOUT_US && us < TWI_TIMEOUT_US + 1000);
+
+    // the next transaction goes through
+    sim_twi.stall = 0;
+    submitWrite(&xfer, DEV, 2);
+    run(&xfer);
+    CHECK_EQ(xfer.result, 2);
+}
+
+/*
+ * a slave stretching every byte just under the phase timeout trips the
+ * TWI_XFER_MAX_US budget of the whole transaction instead
+ */
+static void testTransactionDeadline(void)
+{
+    twi_xfer_t xfer;
+    uint32_t   us;
+
+    setup();
+    sim_twi_add(DEV);
+    sim_twi.stretchUs = TWI_TIMEOUT_US - 20000;
+    submitWrite(&xfer, DEV, 16);
+    us = run(&xfer);
+    CHECK_EQ(xfer.result, TWI_ERR_TIMEOUT);
+    CHECK(us >= TWI_XFER_MAX_US && us < TWI_XFER_MAX_US + TWI_TIMEOUT_US);
+
+    // a short one with the same slave fits
+    submitWrite(&xfer, DEV, 1);
+    us = run(&xfer);
+    CHECK_EQ(xfer.result, 1);
+    CHECK(us < TWI_XFER_MAX_US);
+}
+
+/*
+ * NACK restarts are bounded by the budget too, not only by TWI_MAX_ITER
+ */
+static void testNackDeadline(void)
+{
+    twi_xfer_t     xfer;
+    sim_twi_dev_t *dev;
+    uint32_t       us;
+
+    setup();
+    dev = sim_twi_add(DEV);
+    dev->nackSla      = 0xFFFF;
+    sim_twi.stretchUs = 2000;
+    submitWrite(&xfer, DEV, 2);
+    us = run(&xfer);
+    CHECK_EQ(xfer.result, TWI_ERR_TIMEOUT);
+    CHECK(sim_twi.starts < TWI_MAX_ITER);
+    CHECK(us >= TWI_XFER_MAX_US && us < TWI_XFER_MAX_US + 10000);
+}
+
+/*
+ * inter-byte delays add to the budget, byteDelay_us for every byte
+ */
+static void testDelayBudget(void)
+{
+    twi_xfer_t xfer;
+
+    setup();
+    sim_twi_add(DEV + 1);
+    CHECK_EQ(twi_register_device(DEV + 1, TWI_SCL_DEFAULT, 16000), 0);
+
+    // 16 bytes paced 16 ms apart plus a stretching slave: over
+    // TWI_XFER_MAX_US on its own but inside the delay allowance
+    sim_twi.stretchUs = 20000;
+    submitWrite(&xfer, DEV + 1, 16);
+    run(&xfer);
+    CHECK_EQ(xfer.result, 16);
+}
+
+/*
+ * without a registered delay the bytes follow each other at bus speed; with
+ * one, TWCR is held after every byte until the Timer2 compare releases it
+ */
+static void testPacing(void)
+{
+    twi_xfer_t xfer;
+    uint32_t   us;
+    uint32_t   busUs;
+    uint8_t    i;
+
+    setup();
+    sim_twi_add(DEV);
+    submitWrite(&xfer, DEV, 16);
+    busUs = run(&xfer);
+    CHECK_EQ(xfer.result, 16);
+    CHECK_EQ(TIMSK2, 0);
+    CHECK(busUs < (1 + 1 + 16) * (sim_twi.eventUs + 20));
+
+    sim_twi_add(DEV + 2);
+    CHECK_EQ(twi_register_device(DEV + 2, TWI_SCL_DEFAULT, 1000), 0);
+    submitWrite(&xfer, DEV + 2, 3);
+    CHECK_EQ(sim_twi_step(), 1);    // START
+    for(i = 0; i < 3; i++)
+    {
+        CHECK_EQ(sim_twi_step(), 1);    // SLA+W or data
+        CHECK(TIMSK2 & _BV(OCIE2A));
+        CHECK_EQ(sim_twi_step(), 0);    // held
+        us = sim_us;
+        CHECK_EQ(sim_timer2_step(), 1);
+        CHECK(sim_us - us >= 1000 && sim_us - us < 1100);
+        CHECK_EQ(TIMSK2, 0);
+    }
+    CHECK_EQ(sim_twi_step(), 1);    // last data, then the STOP
+    CHECK_EQ(xfer.result, 3);
+
+    submitWrite(&xfer, DEV + 2, 16);
+    us = run(&xfer) - busUs;
+    CHECK_EQ(xfer.result, 16);
+    CHECK(us >= 16 * 1000UL && us < 16 * 1000UL + 500);
+}
+
+/*
+ * once a paced device has learned a timeout shorter than its delay, the
+ * watchdog must still wait out the delay
+ */
+static void testPacedTimeout(void)
+{
+    twi_xfer_t    xfer;
+    twi_latency_t lat[TWI_TMO_PHASES];
+    uint8_t       addr;
+    uint8_t       row;
+    uint8_t       i;
+
+    setup();
+    sim_twi_add(DEV + 3);
+    CHECK_EQ(twi_register_device(DEV + 3, TWI_SCL_DEFAULT, 8000), 0);
+    for(i = 0; i < 4; i++)
+    {
+        submitWrite(&xfer, DEV + 3, 16);
+        run(&xfer);
+        CHECK_EQ(xfer.result, 16);
+    }
+    for(row = 0; twi_latency_get(row, &addr, lat) == 0 && addr != DEV + 3; row++)
+    {
+    }
+    CHECK_EQ(addr, DEV + 3);
+    CHECK_EQ(lat[TWI_TMO_XFER].timeoutUs, TWI_TMO_FLOOR_US);
+
+    submitWrite(&xfer, DEV + 3, 2);
+    CHECK_EQ(sim_twi_step(), 1);    // START
+    CHECK_EQ(sim_twi_step(), 1);    // SLA+W, delay armed
+    for(i = 0; i < 7; i++)
+    {
+        sim_advance_us(1000);
+        twi_service();
+        CHECK(twi_xfer_pending(&xfer));
+    }
+    run(&xfer);
+    CHECK_EQ(xfer.result, 2);
+    twi_latency_get(row, &addr, lat);
+    CHECK_EQ(lat[TWI_TMO_XFER].timeouts, 0);
+}
+
+/*
+ * a quarantined device gets one re-probe when it is due, however many
+ * transactions are submitted for it; its result lifts the quarantine or
+ * sets the next re-probe time
+ */
+static void testReprobe(void)
+{
+    const twi_dev_t dev = { MUX, 1, DEV };
+    twi_xfer_t      xfer[3];
+    twi_health_t    h;
+    sim_twi_dev_t  *mux;
+    uint8_t         i;
+
+    setup();
+    mux = sim_twi_add(MUX);
+    mux->muxMask = 0x0F;
+    CHECK_EQ(twi_register_mux(MUX, 0, 0), 0);
+
+    // nothing answers at DEV
+    for(i = 0; i < TWI_QUARANTINE_FAILS; i++)
+    {
+        twi_setup_dev_xfer(&xfer[0], &dev, wrData, 1, NULL, 0);
+        CHECK_EQ(twi_submit(&xfer[0]), 0);
+        run(&xfer[0]);
+        CHECK_EQ(xfer[0].result, TWI_ERR_NACK);
+    }
+    CHECK_EQ(twi_health_get(0, &h), 0);
+    CHECK(h.quarantined);
+    CHECK_EQ(twi_submit(&xfer[0]), TWI_ERR_QUARANTINE);
+
+    // due: the first is the re-probe, the others wait for its result
+    sim_advance_us(TWI_QUARANTINE_MS * 1000UL);
+    for(i = 0; i < 3; i++)
+    {
+        twi_setup_dev_xfer(&xfer[i], &dev, wrData, 1, NULL, 0);
+        CHECK_EQ(twi_submit(&xfer[i]), (i == 0) ? 0 : TWI_ERR_QUARANTINE);
+    }
+    CHECK_EQ(xfer[1].state, TWI_XFER_ERROR);
+    run(&xfer[0]);
+    CHECK_EQ(xfer[0].result, TWI_ERR_NACK);
+    CHECK_EQ(xfer[0].retries, 1);  // NACKed once, not retried
+    twi_health_get(0, &h);
+    CHECK(h.quarantined && !h.probing);
+    CHECK_EQ(h.backoff, 2 * TWI_QUARANTINE_MS);
+    CHECK_EQ(twi_submit(&xfer[1]), TWI_ERR_QUARANTINE);
+
+    // the device is back for the next one
+    sim_twi_add(DEV);
+    sim_advance_us(2 * TWI_QUARANTINE_MS * 1000UL);
+    CHECK_EQ(twi_submit(&xfer[0]), 0);
+    CHECK_EQ(twi_submit(&xfer[1]), TWI_ERR_QUARANTINE);
+    run(&xfer[0]);
+    CHECK_EQ(xfer[0].result, 1);
+    twi_health_get(0, &h);
+    CHECK(!h.quarantined && !h.probing);
+    CHECK_EQ(twi_submit(&xfer[1]), 0);
+    CHECK_EQ(twi_submit(&xfer[2]), 0);
+    run(&xfer[2]);
+    CHECK_EQ(xfer[1].result, 1);
+    CHECK_EQ(xfer[2].result, 1);
+}
+
+/*
+ * the log record a recovery leaves on the console: pulses, usec, status
+ */
+static uint8_t recoveryLogged(int *pulses, int *status)
+{
+    char     out[UART_TX_BUFFER_SIZE + 1];
+    char     tag[8];
+    char    *rec;
+    long     us;
+    uint16_t len;
+
+    len      = sim_uart_drain((uint8_t *)out, sizeof(out) - 1);
+    out[len] = '\0';
+    snprintf(tag, sizeof(tag), "~%u ", LOG_ID_TWI_BUS_RECOVERY);
+    rec = strstr(out, tag);
+    return rec != NULL && sscanf(rec + strlen(tag), "%d %ld %d", pulses, &us, status) == 3;
+}
+
+/*
+ * a recovery, asked for or after the watchdog finds SDA held low, is
+ * counted and logged as a TWI error
+ */
+static void testRecoveryLog(void)
+{
+    twi_xfer_t     xfer;
+    twi_recovery_t stats;
+    uint8_t        level = logLevel[LOG_SUB_TWI];
+    uint32_t       start;
+    int            pulses;
+    int            status;
+
+    setup();
+    twi_recovery_stats(&stats, 1);
+    logLevel[LOG_SUB_TWI] = LOG_NONE;
+    CHECK_EQ(twi_bus_recover(), 0);
+    CHECK(!recoveryLogged(&pulses, &status));
+
+    logLevel[LOG_SUB_TWI] = LOG_ERROR;
+    CHECK_EQ(twi_bus_recover(), 0);
+    CHECK(recoveryLogged(&pulses, &status));
+    CHECK_EQ(pulses, 0);
+    CHECK_EQ(status, 0);
+
+    // a slave holds SDA and the bus never answers
+    sim_twi_add(DEV);
+    sim_twi.stall = 1;
+    PIND &= ~_BV(PD1);
+    submitWrite(&xfer, DEV, 1);
+    start = sim_us;
+    while(twi_xfer_pending(&xfer) && sim_us - start < RUN_LIMIT_US)
+    {
+        sim_advance_us(1000);
+        twi_service();
+    }
+    CHECK_EQ(xfer.result, TWI_ERR_START_TIMEOUT);
+    CHECK(recoveryLogged(&pulses, &status));
+    CHECK_EQ(pulses, TWI_RECOVER_PULSES);
+    CHECK_EQ(status, -1);
+
+    twi_recovery_stats(&stats, 1);
+    CHECK_EQ(stats.count, 3);
+    CHECK_EQ(stats.failed, 1);
+    logLevel[LOG_SUB_TWI] = level;
+}
+
+/*
+ * a STOP that never goes out costs TWI_STOP_TIMEOUT_US, then the TWI is
+ * reset and the queue moves on
+ */
+static void testStopTimeout(void)
+{
+    twi_xfer_t xfer;
+    twi_xfer_t next;
+    uint32_t   us;
+
+    setup();
+    sim_twi_add(DEV);
+    sim_twi.stopStuck = 1;
+    submitWrite(&xfer, DEV, 1);
+    submitWrite(&next, DEV, 1);
+    CHECK_EQ(sim_twi_step(), 1);    // START
+    CHECK_EQ(sim_twi_step(), 1);    // SLA+W
+    us = sim_us;
+    CHECK_EQ(sim_twi_step(), 1);    // data, then the STOP
+    us = sim_us - us - sim_twi.eventUs;
+    CHECK_EQ(xfer.result, 1);
+    CHECK(us >= TWI_STOP_TIMEOUT_US && us < TWI_STOP_TIMEOUT_US + 100);
+
+    sim_twi.stopStuck = 0;
+    run(&next);
+    CHECK_EQ(next.result, 1);
+}
+
+int main(void)
+{
+    testWrite();
+    testRead();
+    testNack();
+    testQueue();
+    testArbitrationCap();
+    testNackLimit();
+    testPhaseTimeout();
+    testTransactionDeadline();
+    testNackDeadline();
+    testDelayBudget();
+    testPacing();
+    testPacedTimeout();
+    testReprobe();
+    testRecoveryLog();
+    testStopTimeout();
+
+    return unit_report("test_twi");
+}
@@ -0,0 +1,43 @@
+/*******************************************************************************
+*   File Name: unit.h
+*
+* Description: minimal checks for the host tests.  A failed check prints
+*              where and carries on; unit_report() gives the exit status.
+*******************************************************************************/
+#ifndef __UNIT_H__
+#define __UNIT_H__
+
+#include <stdio.h>
+
+static int unitChecks;
+static int unitFails;
+
+#define CHECK(cond) \
+    do { \
+        unitChecks++; \
+        if(!(cond)) \
+        { \
+            unitFails++; \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while(0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        long unitA = (long)(a), unitB = (long)(b); \
+        unitChecks++; \
+        if(unitA != unitB) \
+        { \
+            unitFails++; \
+            printf("%s:%d: CHECK_EQ(%s, %s) failed: %ld != %ld\n", \
+                   __FILE__, __LINE__, #a, #b, unitA, unitB); \
+        } \
+    } while(0)
+
+static inline int unit_report(const char *name)
+{
+    printf("%s: %d checks, %d failed\n", name, unitChecks, unitFails);
+    return unitFails != 0;
+}
+
+#endif
@@ -7,20 +7,14 @@
 #include "defines.h"
 #include <avr/io.h>
 #include <avr/interrupt.h> 
+#include <util/atomic.h>
+#include <stddef.h>
+#include "timers.h"
 
 
-volatile int32_t  ms_motorStepCount;
-volatile uint16_t ms_count=0; 
-volatile uint16_t ms_MotorCount=0; 
-volatile uint16_t ms_SleepCount=0; 
-volatile uint16_t ms_ADCcount=0; 
-volatile uint16_t ms_switchCount=0; 
-volatile uint16_t ms_switchReleasedCount=0; 
-volatile uint16_t ms_twiCount=0; 
-volatile uint16_t ms_PressureCount=0;
-volatile uint32_t ms_log_count;
-volatile uint32_t ms_injectionCount;
-volatile uint32_t ms_led_count;
+volatile uint32_t ms_tickCount;         // 1 ms ticks since power up
+
+static sw_timer_t *timerList;           // active timers sorted by expiry
 
 // local functions
 void init_timer0(void);
@@ -28,64 +22,231 @@ void init_timer1_FastPWM(char a, char b, char c);
 void init_timer3_FastPWM(char a, char b, char c);
 
 
-//// millisecond counter interrupt vector 
-//SIGNAL(TIMER0_COMP_vect)
-//{
-  //ms_count+=8;
-  //ms_MotorCount+=8;
-  //ms_SleepCount+=8;
-  //ms_ADCcount+=8; 
-  //ms_motorStepCount+=8;
-  //ms_log_count+=8;
-  //ms_injectionCount +=8;
-  //ms_switchCount += 8;
-  //ms_twiCount +=8;
-  //ms_switchReleasedCount +=8;
-  //ms_PressureCount += 8;
-  //ms_led_count++;
-//}
-
 /******************************************************************************
 *                     TIMER 0 INTERRUPT VECTOR ATMEGA2561                     *
 *******************************************************************************
-* Description: Timer 0 interrupt vector.  Timer 0 interrupts every 8 msecs.
+* Description: Timer 0 interrupt vector.  Timer 0 interrupts every msec and
+*              only advances the tick count; software timers are expired
+*              from the main loop by swtimer_service(), so the ISR cost does
+*              not depend on how many timers are running.
 ******************************************************************************/
-SIGNAL(TIMER0_COMPA_vect)
+ISR(TIMER0_COMPA_vect)
 {
-    ms_count               +=8;
-    ms_MotorCount          +=8;
-    ms_SleepCount          +=8;
-    ms_ADCcount            +=8;
-    ms_motorStepCount      +=8;
-    ms_log_count           +=8;
-    ms_injectionCount      +=8;
-    ms_switchCount         +=8;
-    ms_twiCount            +=8;
-    ms_switchReleasedCount +=8;
-    ms_PressureCount       +=8;
-    ms_led_count           +=8;
-    //ms_flow_count          +=8;
-    //ms_flow_ctrl_count     +=8;
+    ms_tickCount++;
 }
 
 
 void init_timers()
 {
-	ms_count = ms_SleepCount = ms_ADCcount = ms_switchCount = 0;
-	ms_switchReleasedCount = ms_injectionCount = 0;
+	ms_tickCount = 0;
+	timerList    = NULL;
 	init_timer0();
 	//	ms_MotorCount = 0;
 	init_timer1_FastPWM('a', 'b', 'c');
 	init_timer3_FastPWM('a', 'b', 'c');
 }
 
+/******************************************************************************
+*                                 TIME IN USEC                                *
+*******************************************************************************
+* Description: Free running microsecond time stamp, 4 usec resolution.
+*              The ATmega2561 has Timers 0 - 3 only and 1 and 3 drive the
+*              PWM outputs, so the time base is the Timer 0 msec tick plus
+*              TCNT0, which counts 4 usec steps within the msec.  The value
+*              wraps every 2^32 usec (71.6 minutes).  Compare time stamps
+*              with time_after_eq() / timer_expired(), never with <.
+*
+*   Arguments: None
+*
+*      Return: current time in usec
+******************************************************************************/
+uint32_t time_us(void)
+{
+    uint32_t ms;
+    uint8_t  tcnt;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        tcnt = TCNT0;
+        ms   = ms_tickCount;
+
+        // compare match happened but its interrupt has not run yet: the
+        // count has wrapped to the start of the next msec
+        if((TIFR0 & _BV(OCF0A)) && (tcnt < OCR0A / 2))
+        {
+            ms++;
+        }
+    }
+    return ms * 1000UL + (uint32_t)tcnt * (64000000UL / F_CPU);
+}
+
+
+/******************************************************************************
+*                                  USEC SLEEP                                 *
+*******************************************************************************
+* Description: Busy wait for the specified number of microseconds
+*
+*   Arguments: us - microseconds to wait
+*
+*      Return: None
+******************************************************************************/
+void us_sleep(uint32_t us)
+{
+    uint32_t deadline = timer_deadline(us);
+
+    while(!timer_expired(deadline))
+    ;
+}
+
+
 // ms_sleep() - delay for specified number of milliseconds
-void ms_sleep(uint16_t ms)  //---NOTE RESOLUTIION is 8 milliseconds!
+void ms_sleep(uint16_t ms)
+{
+	us_sleep(ms * 1000UL);
+}
+
+
+/******************************************************************************
+*                                 TIME IN MSEC                                *
+*******************************************************************************
+* Description: Monotonic millisecond tick count
+*
+*   Arguments: None
+*
+*      Return: msec since init_timers()
+******************************************************************************/
+uint32_t ms_time(void)
+{
+    uint32_t ticks;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ticks = ms_tickCount;
+    }
+    return ticks;
+}
+
+
+/******************************************************************************
+*                             INSERT SOFTWARE TIMER                           *
+*******************************************************************************
+* Description: Link a timer into the active list in expiry order.  Timers
+*              with the same expiry run in the order they were started.
+*
+*   Arguments: timer - timer to insert, timer->expires already set
+*
+*      Return: None
+******************************************************************************/
+static void swtimer_insert(sw_timer_t *timer)
+{
+    sw_timer_t **link = &timerList;
+
+    while(*link != NULL && time_after_eq(timer->expires, (*link)->expires))
+    {
+        link = &(*link)->next;
+    }
+    timer->next = *link;
+    *link       = timer;
+}
+
+
+/******************************************************************************
+*                              START SOFTWARE TIMER                           *
+*******************************************************************************
+* Description: Start (or restart) a software timer.  The callback runs from
+*              swtimer_service() in main loop context, never from an ISR.
+*
+*   Arguments: timer    - timer to start, caller owns the storage
+*              delay    - msec until the first expiry
+*              period   - msec between expiries, 0 for a one shot timer
+*              callback - function to call on expiry
+*              context  - caller data for the callback
+*
+*      Return: None
+******************************************************************************/
+void swtimer_start(sw_timer_t *timer, uint32_t delay, uint32_t period,
+                   sw_timer_callback_t callback, void *context)
 {
-	TCNT0  = 0;
-	ms_SleepCount = 0;
-	while (ms_SleepCount < ms)
-	;
+    swtimer_stop(timer);
+
+    timer->expires  = ms_time() + delay;
+    timer->period   = period;
+    timer->callback = callback;
+    timer->context  = context;
+    timer->active   = 1;
+    swtimer_insert(timer);
+}
+
+
+/******************************************************************************
+*                              STOP SOFTWARE TIMER                            *
+*******************************************************************************
+* Description: Stop a software timer.  Safe to call on a stopped timer and
+*              from inside the timer's own callback.
+*
+*   Arguments: timer - timer to stop
+*
+*      Return: None
+******************************************************************************/
+void swtimer_stop(sw_timer_t *timer)
+{
+    sw_timer_t **link = &timerList;
+
+    if(!timer->active)
+    {
+        return;
+    }
+
+    while(*link != NULL)
+    {
+        if(*link == timer)
+        {
+            *link = timer->next;
+            break;
+        }
+        link = &(*link)->next;
+    }
+    timer->active = 0;
+}
+
+
+/******************************************************************************
+*                            SERVICE SOFTWARE TIMERS                          *
+*******************************************************************************
+* Description: Run the callbacks of every expired timer and reschedule the
+*              periodic ones.  Call from the main loop.  A periodic timer
+*              that falls behind is rescheduled from its previous expiry so
+*              it keeps its rate without bunching up.
+*
+*   Arguments: None
+*
+*      Return: None
+******************************************************************************/
+void swtimer_service(void)
+{
+    uint32_t    now = ms_time();
+    sw_timer_t *timer;
+
+    while((timer = timerList) != NULL && time_after_eq(now, timer->expires))
+    {
+        timerList = timer->next;
+
+        if(timer->period)
+        {
+            timer->expires += timer->period;
+            if(time_after_eq(now, timer->expires))
+            {
+                timer->expires = now + timer->period;
+            }
+            swtimer_insert(timer);
+        }
+        else
+        {
+            timer->active = 0;
+        }
+
+        timer->callback(timer);
+    }
 }
 
 
@@ -113,16 +274,20 @@ void ms_sleep(uint16_t ms)  //---NOTE RESOLUTIION is 8 milliseconds!
 *                              INITIALIZE TIMER 0                             *
 *******************************************************************************
 * Description: Initialize ATmega2561 Timer 0 to generate an interrupt every
-*              eight milliseconds. Used for timing of motor control, logging, 
-*              and for ADC.
+*              millisecond.  This is the software timer tick, and with
+*              TCNT0 the microsecond time base, see time_us().
 *
 *              CTC mode -- Clear Timer on Compare match
 *              Initialize timer0 to generate an output compare interrupt, and
 *              set the output compare register so that we get that interrupt
-*              every 8 millisecond.
+*              every millisecond: 16 MHz / 64 / 250.  (The old setup put
+*              WGM02 in TCCR0B, which is a reserved mode, not CTC.)
 *
 *   ATmega2561
 *   Registers:
+*              TCCR0A - WGM01 selects CTC
+*              TCCR0B - clock select
+*              OCR0A  - compare value, TOP in CTC mode
 *
 *   Arguments: None
 *
@@ -130,14 +295,14 @@ void ms_sleep(uint16_t ms)  //---NOTE RESOLUTIION is 8 milliseconds!
 ******************************************************************************/
 void init_timer0(void)
 {    
-    TIFR0  |= _BV(OCF0A);     // output compare flag timer 0 A match
-    TCCR0B  = _BV(WGM02) |    // waveform generation mode
-    _BV(CS02)  |    // Clock select - CLKtos
-    _BV(CS00)  ;    // Clock select - CLKtos - CTC, prescale = 1024-- frequency of 15.625 KHz, i.e period of 64 micro seconds
-    TCNT0   = 0;              // Remove Compare Match
+    TCCR0A  = _BV(WGM01);     // waveform generation mode - CTC
+    TCCR0B  = _BV(CS01)  |    // Clock select - clkIO/64 = 250 kHz
+              _BV(CS00)  ;
+    TCNT0   = 0;
+    OCR0A   = (uint8_t) ((F_CPU / 64UL / 1000UL) - 1);    // match every 1 ms
+    TIFR0   = _BV(OCF0A);     // clear pending compare match
     TIMSK0 |= _BV(OCIE0A);    // Enable Output Compare Match A Interrupt
-    OCR0A   =  (int8_t) ((F_CPU / 1000UL) / 128UL) ;       // match in 8 ms count to 125 at 15.625 KHz
-    }
+}
 
 
 /* 8 bit fast PWM mode at 16MHz/256/64 = 976 Hz . No inturrupts. 
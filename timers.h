@@ -1,28 +1,50 @@
 /*******************************************************************************
-*   File Name: 
+*   File Name: timers.h
 *  
-* Description: 
+* Description: Timer data and definitions: microsecond time base, millisecond
+*              tick and software timers
 *******************************************************************************/
 #ifndef __TIMERS_H__
 #define __TIMERS_H__
+
+#include <inttypes.h>
   
-// global data
-extern volatile uint16_t ms_count;
-extern volatile uint16_t ms_MotorCount;
-extern volatile uint16_t ms_SleepCount;  
-extern volatile uint16_t ms_ADCcount;
-extern volatile uint16_t ms_coldCount; 
-extern volatile uint16_t ms_hotCount; 
-extern volatile uint16_t ms_sampleCount; 
-extern volatile uint16_t ms_switchCount;
-extern volatile uint16_t ms_switchReleasedCount;
-extern volatile uint16_t ms_twiCount;
-extern volatile uint16_t ms_PressureCount;
+typedef struct sw_timer sw_timer_t;
+typedef void (*sw_timer_callback_t)(sw_timer_t *timer);
+
+/*
+ * software timer, owned by the caller and linked into a list sorted by
+ * expiry while it is running
+ */
+struct sw_timer
+{
+    uint32_t             expires;   // ms_time() of the next expiry
+    uint32_t             period;    // msec, 0 for a one shot timer
+    sw_timer_callback_t  callback;  // called from swtimer_service()
+    void                *context;   // caller data for the callback
+    uint8_t              active;    // non zero while running
+    sw_timer_t          *next;      // list link
+};
+
+
+// microsecond time base, rollover safe comparisons
+#define time_after_eq(a, b)     ((int32_t)((uint32_t)(a) - (uint32_t)(b)) >= 0)
+#define timer_deadline(us)      (time_us() + (uint32_t)(us))
+#define timer_expired(deadline) time_after_eq(time_us(), (deadline))
 
 
 // global functions
-void ms_sleep(uint16_t ms);
-void init_timers(void);
+void     ms_sleep(uint16_t ms);
+void     us_sleep(uint32_t us);
+uint32_t time_us(void);
+uint32_t ms_time(void);
+void     init_timers(void);
+void     swtimer_start(sw_timer_t *timer, uint32_t delay, uint32_t period,
+                       sw_timer_callback_t callback, void *context);
+void     swtimer_stop(sw_timer_t *timer);
+void     swtimer_service(void);
+
+#define  swtimer_active(t)  ((t)->active)
 
 
 #endif  // end __TIMERS_H__
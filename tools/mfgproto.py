@@ -0,0 +1,265 @@
+#!/usr/bin/env python3
+"""Host side reference for the MfgTest binary protocol (binaryCmd.h).
+
+Packets are COBS encoded and terminated by a single 0x00.  Decoded packet:
+
+    request:   cmd  seq  args...             crc16
+    response:  cmd|0x80  seq  status  data... crc16
+    event:     evt  seq  data...             crc16
+
+crc16 is CRC-16/XMODEM over everything ahead of it, low byte first.
+
+Usage:
+    mfgproto.py PORT [BAUD]        ping, read the humidity sensor, stream
+                                   telemetry for 50 records, exit
+
+The encoder/decoder functions have no dependencies; the serial client
+needs pyserial.
+"""
+import os
+import re
+import struct
+import sys
+
+PROTOCOL_VERSION = 1
+MAX_PAYLOAD = 64
+RSP_FLAG = 0x80
+
+CMD_PING = 0x01
+CMD_EXIT = 0x02
+CMD_TELEM_START = 0x08
+CMD_TELEM_STOP = 0x09
+CMD_HUMID_MR = 0x10
+CMD_HUMID_READ = 0x11
+CMD_MUX_GET = 0x20
+CMD_MUX_SET = 0x21
+CMD_TWI_XFER = 0x30
+
+EVT_BASE = 0x40
+EVT_TELEMETRY = EVT_BASE + 0
+EVT_LOG = EVT_BASE + 1
+
+TELEM_SRC_HUMIDITY = 1
+
+STATUS = {0: "ok", 1: "crc", 2: "unknown command", 3: "bad length", 4: "twi error",
+          5: "bad argument", 6: "busy"}
+
+
+def crc16_xmodem(data, crc=0):
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_idx, code = 0, 1
+    for b in data:
+        if b == 0:
+            out[code_idx] = code
+            code_idx, code = len(out), 1
+            out.append(0)
+        else:
+            out.append(b)
+            code += 1
+            if code == 0xFF:
+                out[code_idx] = code
+                code_idx, code = len(out), 1
+                out.append(0)
+    out[code_idx] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        i += 1
+        if code == 0 or i + code - 1 > len(data):
+            raise ValueError("bad COBS frame")
+        out += data[i:i + code - 1]
+        i += code - 1
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def build_frame(cmd, seq, args=b""):
+    pkt = bytes([cmd, seq & 0xFF]) + bytes(args)
+    pkt += struct.pack("<H", crc16_xmodem(pkt))
+    return cobs_encode(pkt) + b"\x00"
+
+
+def parse_frame(frame):
+    """Decode one frame (delimiter stripped) into (cmd, seq, body).
+
+    For a response body starts with the status byte."""
+    pkt = cobs_decode(frame)
+    if len(pkt) < 4:
+        raise ValueError("short packet")
+    if crc16_xmodem(pkt[:-2]) != struct.unpack("<H", pkt[-2:])[0]:
+        raise ValueError("crc mismatch")
+    return pkt[0], pkt[1], pkt[2:-2]
+
+
+def load_log_table(path=None):
+    """Message formats from logMessages.h, indexed by message ID."""
+    if path is None:
+        path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                            "..", "logMessages.h")
+    table = []
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'\s*LOG_MSG\(\s*(\w+)\s*,\s*"(.*)"\s*\)', line)
+            if m:
+                # console.h conversions to Python: drop 'l', %u -> %d, %S -> %s
+                fmt = re.sub(r"%([0-9.]*)l?([dxXcs])", r"%\1\2", m.group(2))
+                fmt = re.sub(r"%([0-9.]*)l?u", r"%\1d", fmt).replace("%S", "%s")
+                table.append((m.group(1), fmt))
+    return table
+
+
+def decode_log_args(data):
+    """Zigzag varint arguments of a BIN_EVT_LOG record."""
+    args, value, shift = [], 0, 0
+    for b in data:
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            args.append((value >> 1) ^ -(value & 1))
+            value, shift = 0, 0
+    return args
+
+
+def expand_log(table, msg_id, args):
+    if msg_id >= len(table):
+        return "log %d %s" % (msg_id, args)
+    name, fmt = table[msg_id]
+    try:
+        return fmt % tuple(args)
+    except (TypeError, ValueError):
+        return "%s %s" % (name, args)
+
+
+def expand_log_line(table, line):
+    """Expand a text console log line "~<id> <arg> ...", or return it as is."""
+    if not line.startswith("~"):
+        return line
+    fields = line[1:].split()
+    return expand_log(table, int(fields[0]), [int(a) for a in fields[1:]])
+
+
+class Client:
+    def __init__(self, port, log_table=None):
+        self.port = port
+        self.seq = 0
+        self.rx = bytearray()
+        self.log_table = log_table if log_table is not None else load_log_table()
+
+    def handle_event(self, cmd, body):
+        if cmd == EVT_LOG and body:
+            print("log: " + expand_log(self.log_table, body[0], decode_log_args(body[1:])))
+
+    def read_frame(self):
+        while True:
+            b = self.port.read(1)
+            if not b:
+                raise TimeoutError("no response")
+            if b == b"\x00":
+                frame, self.rx = bytes(self.rx), bytearray()
+                if frame:
+                    return frame
+            else:
+                self.rx += b
+
+    def request(self, cmd, args=b""):
+        self.seq = (self.seq + 1) & 0xFF
+        self.port.write(build_frame(cmd, self.seq, args))
+        while True:
+            try:
+                rcmd, rseq, body = parse_frame(self.read_frame())
+            except ValueError:
+                continue        # console text ahead of the first frame
+            if rcmd == EVT_LOG:
+                self.handle_event(rcmd, body)
+            elif rcmd == cmd | RSP_FLAG and rseq == self.seq:
+                status, data = body[0], body[1:]
+                if status != 0:
+                    raise IOError("%s: %s" % (STATUS.get(status, status), data.hex()))
+                return data
+
+    def ping(self):
+        return tuple(self.request(CMD_PING))
+
+    def humid_read(self):
+        status, rh, temp = struct.unpack("<BHH", self.request(CMD_HUMID_READ))
+        return status, rh * 100.0 / 16384, temp * 165.0 / 16384 - 40
+
+    def telem_start(self, period_ms):
+        self.request(CMD_TELEM_START, struct.pack("<H", period_ms))
+
+    def telem_stop(self):
+        """Returns (sent, dropped, errors).  Records still in flight are
+        skipped while waiting for the response."""
+        return struct.unpack("<III", self.request(CMD_TELEM_STOP))
+
+    def telem_records(self):
+        """Yield (source, seq, time_ms, data) for each telemetry record."""
+        while True:
+            try:
+                cmd, _, body = parse_frame(self.read_frame())
+            except ValueError:
+                continue
+            if cmd == EVT_TELEMETRY:
+                src, seq, time_ms = struct.unpack("<BHI", body[:7])
+                yield src, seq, time_ms, body[7:]
+            else:
+                self.handle_event(cmd, body)
+
+    def mux_set(self, ctrl):
+        return self.request(CMD_MUX_SET, bytes([ctrl]))[0]
+
+    def twi_xfer(self, addr, wr=b"", rd_len=0):
+        return self.request(CMD_TWI_XFER, bytes([addr, rd_len]) + bytes(wr))
+
+
+def main():
+    import serial
+
+    if len(sys.argv) < 2:
+        print(__doc__)
+        return 1
+
+    port = serial.Serial(sys.argv[1], int(sys.argv[2]) if len(sys.argv) > 2 else 9600,
+                         timeout=2)
+    port.reset_input_buffer()
+    port.write(b"\rbin\r")
+    cli = Client(port)
+
+    print("version %d, max payload %d" % cli.ping())
+    cli.request(CMD_HUMID_MR)
+    print("status %d, rh %.1f %%, temp %.1f C" % cli.humid_read())
+
+    cli.telem_start(100)
+    last = None
+    for n, (src, seq, time_ms, data) in enumerate(cli.telem_records()):
+        if last is not None and seq != (last + 1) & 0xFFFF:
+            print("lost %d records" % ((seq - last - 1) & 0xFFFF))
+        last = seq
+        if src == TELEM_SRC_HUMIDITY:
+            status, rh, temp = struct.unpack("<BHH", data)
+            print("%5d %10d ms  status %d  rh %.2f %%  temp %.2f C" %
+                  (seq, time_ms, status, rh * 100.0 / 16384, temp * 165.0 / 16384 - 40))
+        if n == 49:
+            break
+    print("sent %d, dropped %d, errors %d" % cli.telem_stop())
+    cli.request(CMD_EXIT)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -5,31 +5,57 @@
 * Description: Two Wire Interface, I2C, utilities. 
 *******************************************************************************/
 #include <util/twi.h>
+#include <util/atomic.h>
+#include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
 
 #include <stdio.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <string.h> 
+#include "defines.h"
 #include "twi_utils.h"
 #include "timers.h"
+#include "console.h"
+#include "log.h"
 
-const char s_twi_start_error[]   PROGMEM = "TWI START CONDITION ERROR";
-const char s_twi_sla_w_error[]   PROGMEM = "TWI SLAVE ADDRESS ERROR";
-const char s_twi_data_tx_error[] PROGMEM = "TWI DATA TX ERROR";
-const char s_twi_data_rx_error[] PROGMEM = "TWI DATA RX ERROR";
-const char s_twi_timeout[]       PROGMEM = "TWI TIMEOUT";
-const char s_twi_error[]         PROGMEM = "TWI ERROR\n";
-const char s_fmt_twi_error[]     PROGMEM = " TWCR=%02x STATUS=%02x\n";
+static uint16_t twiBusBitrate;      // TWI_BITRATE for unregistered devices
+static uint16_t twiHwBitrate;       // value currently in TWSR:TWBR
 
-static uint8_t verbose;
+
+/*******************************************************************************
+*                             SET TWI BIT RATE                                 *
+********************************************************************************
+* Description: Load the bit rate generator if it is not already set.  Only
+*              call while the bus is idle.
+*
+*   Arguments: bitrate - TWI_BITRATE value, prescaler in the high byte
+*
+*      Return: None
+*******************************************************************************/
+static void twi_set_hw_bitrate(uint16_t bitrate)
+{
+    if(bitrate != twiHwBitrate)
+    {
+        TWSR = bitrate >> 8;    // only the prescaler bits are writable
+        TWBR = bitrate & 0xFF;
+        twiHwBitrate = bitrate;
+    }
+}
 
 
 /******************************************************************************* 
 *                         INITIALIZE TWO WIRE INTERFACE                        *
 ******************************************************************************** 
-* Description: Initialize the I2C (two wire) interface:
-*              prescaller value = 16, bit rate = 15
-*              SCL = 16MHz / (16 + 2 * 15 * (4^16) = 32,258
+* Description: Initialize the I2C (two wire) interface at TWI_SCL_DEFAULT.
+*              SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS)
+*
+*              The old setup cleared the prescaler (TWSR &= 0x02 never sets
+*              a bit) so TWBR = 15 actually ran at 16MHz / 46 = 348 kHz, not
+*              the 32 kHz the comments claimed.  Devices that can go faster
+*              than the default register a profile, see twi_register_device.
 * 
 *              Ports:   PD0 - SCL
 *                       PD1 - SDA 
@@ -39,27 +65,15 @@ static uint8_t verbose;
 *              TWBR - two wire bit rate register, p205
 *              TWCR - two wire control register, p205
 * 
-*      Global: verbose
-* 
 *   Arguments: None
 * 
 *      Return: None
 *******************************************************************************/ 
 void init_twi(void)
 {
-    /* set the I2C bit rate generator to 100 kb/s */  
-    /* TWSR &= ~0x03;   // set prescaller to zero
-    TWBR  = 28;
-    TWCR |= _BV(TWEN);*/
-
-    // GSL, well no its not 100kb/s -- isn't it CPU / (16 + 28 * 4^0)? which is 360 kb/s
-    // to get 100kbs with 16 Mhz clock we need TWBR = 9 and prescaller = 16
-    // or 16 MHZ / ( 16 + 9*4^2)
-    TWSR &= ~0x03;        // clear prescaller bits 0 and 1, ps value = 1
-    TWSR &=  0x02;        // set prescaller to 2, ps value = 16
-    TWBR  =    15;        // 0000,1111 
+    twiBusBitrate = TWI_BITRATE(TWI_SCL_DEFAULT);
+    twi_set_hw_bitrate(twiBusBitrate);
     TWCR |= _BV(TWEN);    // enable twi
-    verbose = 0;
 }
 
 
@@ -78,20 +92,18 @@ void init_twi(void)
 *******************************************************************************/
 int8_t twi_start(uint8_t expected_status)
 {
-    uint8_t status;
-
-    ms_twiCount = 0;
+    uint8_t  status;
+    uint32_t deadline = timer_deadline(TWI_TIMEOUT_US);
 
     // send start condition to take control of the bus: TWINT, TWSTA, TWEN
     TWCR = TWCR_START;
 
-    while(!(TWCR & _BV(TWINT)) && (ms_twiCount < TWI_TIMEOUT))
+    while(!(TWCR & _BV(TWINT)) && !timer_expired(deadline))
     ;
 
-    if(ms_twiCount >= TWI_TIMEOUT) 
+    if(!(TWCR & _BV(TWINT))) 
     {
-   	  twi_error(s_twi_start_error, TWCR, TWSR);
-	  twi_error(s_twi_timeout, TWCR, TWSR);
+      twi_error(LOG_ID_TWI_START_TIMEOUT, TWCR, TWSR);
       return -1;
     }
 
@@ -99,34 +111,63 @@ int8_t twi_start(uint8_t expected_status)
     status = TWSR;
     if(status != expected_status) 
     {
-	   printf_P(PSTR("expected  "));
-       twi_error(s_twi_start_error, TWCR, status);
+       twi_error(LOG_ID_TWI_START_ERROR, TWCR, status);
 	   return -1;
     }
     return 0;
 }
 
  
+/*******************************************************************************
+*                               WAIT FOR STOP                                  *
+********************************************************************************
+* Description: Send a STOP and wait at most TWI_STOP_TIMEOUT_US for it to go
+*              out.  If it does not, the TWI is disabled and enabled again,
+*              which releases SCL/SDA and resets its state machine.
+*
+*   Arguments: None
+*
+*      Return: 0, -1 if the STOP timed out
+*******************************************************************************/
+static int8_t twi_send_stop(void)
+{
+    uint32_t deadline = timer_deadline(TWI_STOP_TIMEOUT_US);
+
+    TWCR = _BV(TWINT)|_BV(TWEN)|_BV(TWSTO);
+
+    while((TWCR & _BV(TWSTO)) && !timer_expired(deadline))
+    ;
+
+    if(TWCR & _BV(TWSTO))
+    {
+        TWCR = 0;
+        TWCR = _BV(TWEN);
+        return -1;
+    }
+    return 0;
+}
+
+ 
 /******************************************************************************* 
 *                                    STOP TWI                                  *
 ********************************************************************************
-* Description: STOP--signal the end of an TWI bus transfer
+* Description: STOP--signal the end of an TWI bus transfer.  A STOP that
+*              times out is logged here; it used to go through twi_error(),
+*              which sent another STOP and could recurse without end on a
+*              stuck bus.
 * 
 *  Arguments: None
 * 
-*     Return: 0 if no error is detected
+*     Return: 0 if no error is detected, -1 if the STOP timed out
 *******************************************************************************/
-int8_t twi_stop()
+int8_t twi_stop(void)
 {
-    TWCR        = _BV(TWINT)|_BV(TWEN)|_BV(TWSTO);
-    ms_twiCount = 0;
-
-    while (TWCR & _BV(TWSTO) && ms_twiCount < TWI_TIMEOUT)
-    ;
+    uint8_t cr = TWCR;
 
-    if(ms_twiCount >= TWI_TIMEOUT) 
+    if(twi_send_stop() < 0)
     {
-       twi_error(s_twi_timeout, TWCR, TWSR);
+        LOG(TWI, ERROR, TWI_STOP_TIMEOUT, cr, TWSR);
+        return -1;
     }
     return 0;
 }
@@ -135,760 +176,2062 @@ int8_t twi_stop()
 /*******************************************************************************
 *                                   TWI ERROR                                  *
 ********************************************************************************
-* Description: display the TWI status and error message and release the TWI bus
+* Description: log the TWI status and error message and release the TWI bus
 *  
-*   Arguments: *message
-*               cr
-*               status
+*   Arguments: msg    - LOG_ID_TWI_xxx
+*              cr     - TWCR
+*              status - TWSR
 *  
 *      Return: None
 *******************************************************************************/
-void twi_error(const char * message, uint8_t cr, uint8_t status)
+void twi_error(uint8_t msg, uint8_t cr, uint8_t status)
+{
+    LOG_ID(TWI, ERROR, msg, cr, status);
+    twi_stop();
+}
+
+
+/*******************************************************************************
+*                              TWI ENGINE PRIVATES                             *
+********************************************************************************
+* Description: Interrupt driven TWI transaction engine.  Transactions are
+*              queued on a singly linked list and clocked out by TWI_vect, one
+*              bus event per interrupt, so the CPU is free while the bytes are
+*              on the wire.  The blocking twi_xxx_bytes routines below are thin
+*              wrappers that queue a transaction and wait for it.
+*
+*              Bytes are paced by TWINT, i.e. by the bus itself including any
+*              clock stretching by the slave.  A device that needs extra time
+*              between bytes can register an inter-byte delay which is timed
+*              by Timer2 in one-shot mode so the ISR never spins.
+*******************************************************************************/
+#define TWI_PHASE_WRITE   0     // sending SLA+W, header and write data
+#define TWI_PHASE_READ    1     // sending SLA+R and reading data
+
+#define TWI_STATE_START   0     // waiting for (repeated) START
+#define TWI_STATE_XFER    1     // waiting for SLA or data
+
+
+#define TWCR_ISR_START    (_BV(TWINT)|_BV(TWSTA)|_BV(TWEN)|_BV(TWIE))
+#define TWCR_ISR_NEXT     (_BV(TWINT)|_BV(TWEN)|_BV(TWIE))
+#define TWCR_ISR_ACK      (_BV(TWINT)|_BV(TWEN)|_BV(TWIE)|_BV(TWEA))
+#define TWCR_STOP         (_BV(TWINT)|_BV(TWEN)|_BV(TWSTO))
+
+#define TWI_XFER_REPROBE  0x80  // flags bit, quarantine re-probe, engine private
+
+static twi_xfer_t * volatile twiHead;       // next transaction to run
+static twi_xfer_t * volatile twiTail;       // last queued transaction
+static twi_xfer_t * volatile twiCurrent;    // transaction on the bus
+static volatile uint8_t      twiState;      // TWI_STATE_xxx
+static volatile uint8_t      twiPendingCr;  // TWCR value held back by a delay
+static volatile uint32_t     twiEventTime;  // time_us() of the last bus event
+
+static twi_profile_t         twiProfiles[TWI_MAX_DEVICES];
+static uint8_t               twiNumProfiles;
+
+static twi_mux_t             twiMux[TWI_MAX_MUXES];
+static uint8_t               twiNumMuxes;
+static twi_xfer_t            twiSelXfer;    // channel select the engine inserts
+static uint8_t               twiSelCfg;
+static uint8_t               twiSkips;      // times the head was passed over
+static uint32_t              twiStartTime;  // time_us() the current route began
+static uint32_t              twiDeadline;   // TWI_XFER_MAX_US budget of the route
+static twi_xfer_t           *twiRouteFor;   // transaction the selects are for
+
+static twi_health_t          twiHealth[TWI_MAX_HEALTH];
+static uint8_t               twiNumHealth;
+
+// per profile, the last row for devices without one
+static twi_latency_t         twiLatency[TWI_MAX_DEVICES + 1][TWI_TMO_PHASES];
+
+/*
+ * learned timeouts in EEPROM, by device address; 0 is the row for devices
+ * without a profile
+ */
+#define TWI_TMO_MAGIC     0x544F
+
+typedef struct
+{
+    uint8_t  addr;
+    uint32_t timeoutUs[TWI_TMO_PHASES];
+} twi_tmo_rec_t;
+
+typedef struct
+{
+    uint16_t      magic;
+    uint8_t       count;
+    twi_tmo_rec_t rec[TWI_MAX_DEVICES + 1];
+    uint16_t      crc;                      // CRC-16/XMODEM of the above
+} twi_tmo_image_t;
+
+static twi_tmo_image_t twiTmoEeprom EEMEM;
+
+#define TWI_SCL_PIN       _BV(PD0)
+#define TWI_SDA_PIN       _BV(PD1)
+
+static volatile uint8_t      twiRecovering; // queue held while the bus is freed
+static twi_recovery_t        twiRecovery;
+static twi_recover_hook_t    twiRecoverHook;
+
+// Timer2 prescaler choices for the inter-byte delay, CS22:0 = index + 2
+static const uint16_t twiDelayDiv[] PROGMEM = { 8, 32, 64, 128, 256, 1024 };
+
+static void twi_begin_next(void);
+
+
+/*******************************************************************************
+*                              PACE NEXT BUS EVENT                             *
+********************************************************************************
+* Description: Write TWCR to continue the transaction, either now or, if the
+*              device profile asks for an inter-byte delay, from the Timer2
+*              compare interrupt once the delay has elapsed.  TWDR has already
+*              been loaded; it stays valid while TWINT is set.
+*
+*   Arguments: xfer - current transaction
+*              twcr - TWCR value that continues the transaction
+*
+*      Return: None
+*******************************************************************************/
+static void twi_pace(twi_xfer_t *xfer, uint8_t twcr)
 {
-    if (verbose)
+    const twi_profile_t *profile = xfer->profile;
+
+    if(profile == NULL || profile->delayCs == 0)
     {
-  	    printf_P(message);
-  	    printf_P(s_fmt_twi_error, cr, status);
+        TWCR = twcr;
+        return;
     }
-    twi_stop(1);
+
+    twiPendingCr = twcr;
+    TCCR2B = 0;
+    TCNT2  = 0;
+    OCR2A  = profile->delayOcr;
+    TIFR2  = _BV(OCF2A);
+    TIMSK2 = _BV(OCIE2A);
+    TCCR2B = profile->delayCs;      // start the one-shot
 }
 
 
 /*******************************************************************************
-*                                TWI WRITE BYTES                               *
+*                          TIMER 2 COMPARE A INTERRUPT                         *
 ********************************************************************************
-* Description: Write to twi without address pointer (or address pointer is
-*              part of buffer)
-*  
-*   Arguments: twi_addr - two wire interface address
-*              line
-*              *buf
-*  
-*      Return: 0 if no error is detected
+* Description: End of an inter-byte delay: stop Timer2 and let the TWI go on.
+*
+*      Global: twiPendingCr
 *******************************************************************************/
-int twi_write_bytes(uint8_t twi_addr, int len, uint8_t *buf)
+ISR(TIMER2_COMPA_vect)
 {
-	return twi_write_bytes_with_WP(twi_addr, -2, len, buf);
+    TCCR2B = 0;
+    TIMSK2 = 0;
+    TWCR   = twiPendingCr;
+    twiEventTime = time_us();   // the bus phase starts now, not at the delay
 }
 
 
 /*******************************************************************************
-*                      TWI WRITE BYTES WITH ADDRESS POINTER                    *
+*                              FIND DEVICE PROFILE                             *
 ********************************************************************************
-* Description: Write to twi with two byte address pointer.  If the write
-*              pointer address is less then zero start then it is not sent.
-*  
-*   Arguments: twi_addr
-*              write Pointer
-*              len
-*              *buf
-*  
-*      Return: None
+* Description: Look up the profile registered for a device address
+*
+*   Arguments: twi_addr - 7-bit device address
+*
+*      Return: profile or NULL if the device has not been registered
 *******************************************************************************/
-int twi_write_bytes_with_WP(uint8_t twi_addr, int16_t writePointer,  int len, uint8_t *buf)
+static twi_profile_t *twi_find_profile(uint8_t twi_addr)
 {
-    uint8_t n     = 0;
-    uint8_t wpCnt = 0;  //write pointer count.
-    uint8_t twst;
-    int     rv    = 0;
-    //uint16_t ms_twiCount;
-  
-  
-  if (writePointer <0)
-  	wpCnt = 2;					// don't send  write Pointer.
+    uint8_t i;
 
-  restart:
+    for(i = 0; i < twiNumProfiles; i++)
+    {
+        if(twiProfiles[i].addr == twi_addr)
+        {
+            return &twiProfiles[i];
+        }
+    }
+    return NULL;
+}
 
-  if(n++ >= TWI_MAX_ITER)
-    return -TWI_MAX_ITER;
 
+/*******************************************************************************
+*                              LATENCY ROW                                     *
+********************************************************************************
+* Description: Latency record for a transaction's device and a phase
+*
+*   Arguments: xfer  - transaction
+*              phase - TWI_TMO_xxx
+*
+*      Return: record
+*******************************************************************************/
+static twi_latency_t *twi_latency_row(twi_xfer_t *xfer, uint8_t phase)
+{
+    uint8_t i = (xfer->profile != NULL) ? xfer->profile - twiProfiles : TWI_MAX_DEVICES;
 
- begin:
- 
-  ms_twiCount = 0;
-
-  TWCR = TWCR_START ; // send start condition 
-  while ( !(TWCR & _BV(TWINT))  && (ms_twiCount < TWI_TIMEOUT) ) ; // wait for transmission 
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_start_error, TWCR, TWSR);
-    return -2;
-   }
-  switch ((twst = TW_STATUS))
-    {
-    case TW_REP_START:		// OK, but should not happen 
-    case TW_START:
-      break;
-
-    case TW_MT_ARB_LOST:
-      goto begin;
-
-    default:
-      return -3;		// error: not in start condition 
-				// NB: do /not/ send stop condition 
-    }
-
-
-
-  /* send twi_addr + W */
-  ms_twiCount = 0;
-  TWDR = (twi_addr <<1) | TW_WRITE;
-  TWCR = _BV(TWINT) | _BV(TWEN); /* clear interrupt to start transmission */
-  while ( !(TWCR & _BV(TWINT)) && ms_twiCount < TWI_TIMEOUT ) 
-  {
-  			; // wait for transmission 
-  }
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_sla_w_error, TWCR, TWSR);
-      goto error;	  
-  }
-
-  switch ((twst = TW_STATUS))
-  {
-    case TW_MT_SLA_ACK:
-      break;
-
-    case TW_MT_SLA_NACK:	/* nack during select: device busy writing */
-      goto restart;
-
-    case TW_MT_ARB_LOST:	/* re-arbitrate */
-      goto begin;
-  }
-  ms_sleep(1);  // don't know why we need to wait but we do!
-
-  
-
-  for (; len > 0; len--)
-  {
-    ms_twiCount = 0;
-    if (wpCnt>1)
-    	TWDR = *buf++;
-    else                       // first two bytes are the address of the date to be written.
-    { 
-    	len++;
-			TWDR = (wpCnt==0) ? writePointer>> 8 : writePointer & 0xFF ;    
-			wpCnt++;
-		}
-    	
-    TWCR = _BV(TWINT) | _BV(TWEN); /* start transmission */
-    while ( !(TWCR & _BV(TWINT)) &&  ms_twiCount < TWI_TIMEOUT) ; /* wait for transmission */
-    if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_data_tx_error, TWCR, TWSR);
-	  goto quit;  // should this be go to error?
-    }
-    switch ((twst = TW_STATUS))
-    {
-  	  case TW_MT_DATA_NACK:
-	    twi_error( s_twi_data_tx_error ,TWCR, twst);
-        goto error;	   // why go to error here but go to quit	
-
-      case TW_MT_DATA_ACK:
-        rv++;
-	    break;
-
-	  default:
-      goto error;
-     
-	  }
-  	ms_sleep(1);  // don't know why we need to wait but we do!
-  }
-  quit:
-  twi_stop(1);  
-
-  return rv;
-
-  error:
-  rv = -1;
-  goto quit;
+    return &twiLatency[i][phase];
 }
 
 
 /*******************************************************************************
-*                                  READ BYTES                                  *
+*                              RECORD LATENCY                                  *
 ********************************************************************************
-* Description: Data Read---NO pointer is sent
-* 
-*   Arguments: twi_addr - device address
-*              len      - number of bytes to read
-*              *buf     - put read data here
-*  
-*      Return: number of bytes read
+* Description: Count one bus event latency and, every 8 samples once there
+*              are enough, derive the timeout again
+*
+*   Arguments: lat - record
+*              us  - time from the TWCR write to the interrupt
+*
+*      Return: None
 *******************************************************************************/
-int twi_read_bytes(uint8_t twi_addr, int len, uint8_t *buf)
-{  
+static void twi_latency_record(twi_latency_t *lat, uint32_t us)
+{
+    uint32_t limit = TWI_TMO_BUCKET0_US;
+    uint8_t  b     = 0;
+    uint8_t  i;
 
-  uint8_t n = 0;
-  uint8_t twst, twcr;
-  int rv = 0;
+    while(us >= limit && b < TWI_TMO_BUCKETS - 1)
+    {
+        limit <<= 1;
+        b++;
+    }
+
+    if(lat->hist[b] == UINT8_MAX)
+    {
+        for(i = 0; i < TWI_TMO_BUCKETS; i++)
+        {
+            lat->hist[i] >>= 1;
+        }
+    }
+    lat->hist[b]++;
 
+    if(lat->samples < UINT16_MAX)
+    {
+        lat->samples++;
+    }
+    if(lat->samples >= TWI_TMO_MIN_SAMPLES && (lat->samples & 7) == 0)
+    {
+        lat->timeoutUs = twi_latency_timeout(lat);
+    }
+}
 
 
-  restart:
+/*******************************************************************************
+*                              PHASE TIMEOUT                                   *
+********************************************************************************
+* Description: Watchdog limit for the current phase of a transaction.  The
+*              phase clock only restarts when an inter-byte delay ends, so
+*              while one is pending the delay is added on top of the
+*              learned limit.
+*
+*   Arguments: xfer - transaction on the bus
+*
+*      Return: timeout in usec
+*******************************************************************************/
+static uint32_t twi_phase_timeout(twi_xfer_t *xfer)
+{
+    twi_latency_t *lat = twi_latency_row(xfer, (twiState == TWI_STATE_START) ?
+                                               TWI_TMO_START : TWI_TMO_XFER);
+    uint32_t       tmo = (lat->timeoutUs != 0) ? lat->timeoutUs : TWI_TIMEOUT_US;
 
-  if (n++ >= TWI_MAX_ITER)
-  {
-    return -TWI_MAX_ITER;
-  }
-  begin:
- 
-  ms_twiCount =0;
- //printf_P(PSTR("TWI-Start Cond\n"));			//GSL
-  TWCR = TWCR_START ; // send start condition 
-  while ( !(TWCR & _BV(TWINT))  && (ms_twiCount < TWI_TIMEOUT) ) ; // wait for transmission 
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_start_error, TWCR, TWSR);
-    return -2;
-   }
-
-
-  switch ((twst = TW_STATUS))
-    {
-    case TW_REP_START:		// OK, but should not happen 
-    case TW_START:
-//	  printf_P(PSTR("TWI-Started\n"));			//GSL
-      break;
-
-    case TW_MT_ARB_LOST:
-//	  printf_P(PSTR("TWI_ARB_LOST\n"));			//GSL
-      goto begin;
-
-    default:
-//	  printf_P(PSTR("TWI_DEFAULT1\n"));			//GSL	
-      return -3;		// error: not in start condition 
-				// NB: do /not/ send stop condition 
-    }
-
-
-
-  /* send twi_addr + R */
-  ms_twiCount =0;
-  TWDR = (twi_addr <<1) | TW_READ;
-//  printf_P(PSTR("TWI-starting Trans\n"));			//GSL	
-
-  TWCR = _BV(TWINT) | _BV(TWEN); /* clear interrupt to start transmission */
-  while ( !(TWCR & _BV(TWINT)) && ms_twiCount < TWI_TIMEOUT ) 
-  {
-  			; // wait for transmission 
-  }
-  if (ms_twiCount >= TWI_TIMEOUT) {
-//	  printf_P(PSTR("TWI-timedOut\n"));			//GSL
-      twi_error(s_twi_sla_w_error, TWCR, TWSR);
-      goto error;	  
-  }
-
-  switch ((twst = TW_STATUS))
-  {
-    case TW_MT_SLA_ACK:
-//	   printf_P(PSTR("TWI-ACK\n"));			//GSL
-
-      break;
-
-    case TW_MT_SLA_NACK:	/* nack during select: device busy writing */
-//	   printf_P(PSTR("TWI-NotACK\n"));			//GSL
-      goto restart;
-
-    case TW_MT_ARB_LOST:	/* re-arbitrate */
-//	   printf_P(PSTR("TWI-ARB-2\n"));			//GSL
-      goto begin;
-  }
-
-
-  for (; len > 0; len--)
-  {
-//     printf_P(PSTR("len-%d\n"),len);			//GSL
-	ms_twiCount =0;
-    twcr = _BV(TWINT) | _BV(TWEN) |  _BV(TWEA);  // NAK on last byte
-    if (len == 1)
-      twcr = _BV(TWINT) | _BV(TWEN); // send NAK this time 
-    TWCR = twcr;		/* clear int to start transmission */
-    while ((TWCR & _BV(TWINT)) == 0  && (ms_twiCount < TWI_TIMEOUT)) ; /* wait for transmission */
-    if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_sla_w_error, TWCR, TWSR);
-      goto error;	  
-   }
-    switch ((twst = TW_STATUS))
-	{
-	  case TW_MR_DATA_NACK:
-//	    printf_P(PSTR("TWI-NACK-2\n"));			//GSL
-	    len = 0;		/* force end of loop */
-	    /* FALLTHROUGH */
-	  case TW_MR_DATA_ACK:
-//	    printf_P(PSTR("ACK\n"));			//GSL
-	    *buf++ = TWDR;
-	    rv++;
-	    break;
-
-	default:
-//	  printf_P(PSTR("TWI-defaultError\n"));			//GSL
-	  goto error;
-	}
-  }
-  quit:
-  /* Note [14] */
-  TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN); /* send stop condition */
-
-  return rv;
-
-  error:
-  rv = -1;
-  goto quit;
+    if((TIMSK2 & _BV(OCIE2A)) && xfer->profile != NULL)
+    {
+        tmo += xfer->profile->byteDelay_us;
+    }
+    return tmo;
 }
 
 
-
 /*******************************************************************************
-*                                  READ BYTES                                  *
+*                              RESTART TRANSACTION                             *
 ********************************************************************************
-* Description: Data Read ONE BYTE data ADDRESS!! 
-*              ---Write Pointer Then Read   
-*              USE: twi_read_bytes_wP2() for 2 byte address
-*  
-*   Arguments: twi_addr
-*              write_pointer_addr
-*              len
-*              *buf
-*  
+* Description: Rewind a transaction to its first phase and request a (repeated)
+*              START.  Used to begin a transaction and to retry after a NACK
+*              or lost arbitration.
+*
+*   Arguments: xfer - transaction to (re)start
+*
 *      Return: None
 *******************************************************************************/
-int twi_read_bytes_wP(uint8_t twi_addr, uint8_t write_pointer_addr, int len, uint8_t *buf)
+static void twi_restart(twi_xfer_t *xfer)
 {
-  uint8_t n = 0;
-  uint8_t twst, twcr;
-  int rv = 0;
-//  uint16_t ms_twiCount; 
+    xfer->phase = (xfer->hdrLen + xfer->wrLen > 0 || xfer->rdLen == 0) ?
+                  TWI_PHASE_WRITE : TWI_PHASE_READ;
+    xfer->idx   = 0;
+    xfer->count = 0;
+
+    twiState     = TWI_STATE_START;
+    twiEventTime = time_us();
+    TWCR         = TWCR_ISR_START;
+}
 
 
-  restart:
+/*******************************************************************************
+*                                  FIND MUX                                    *
+********************************************************************************
+* Description: Look up a registered mux by address
+*
+*   Arguments: twi_addr - 7-bit address
+*
+*      Return: mux or NULL if the address is not a registered mux
+*******************************************************************************/
+static twi_mux_t *twi_find_mux(uint8_t twi_addr)
+{
+    uint8_t i;
 
-  if (n++ >= TWI_MAX_ITER)
-    return -TWI_MAX_ITER;
+    for(i = 0; i < twiNumMuxes; i++)
+    {
+        if(twiMux[i].addr == twi_addr)
+        {
+            return &twiMux[i];
+        }
+    }
+    return NULL;
+}
 
-  begin:
- 
-  ms_twiCount =0;
-  ///////////////////////////
-  // send start condition 
-  TWCR = TWCR_START ; // send start condition 
-  while ( !(TWCR & _BV(TWINT))  && (ms_twiCount < TWI_TIMEOUT) ) ; // wait for transmission 
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_start_error, TWCR, TWSR);
-    return -2;
-   }
-  switch ((twst = TW_STATUS))
-    {
-    case TW_REP_START:		// OK, but should not happen 
-    case TW_START:
-      break;
-
-    case TW_MT_ARB_LOST:
-      goto begin;
-
-    default:
-      return -3;		// error: not in start condition 
-				// NB: do /not/ send stop condition 
-    }
-
-  ///////////////////////////
-  // send twi addr + w
-  ms_twiCount =0;
-  TWDR = (twi_addr <<1) | TW_WRITE;
-  TWCR = _BV(TWINT) | _BV(TWEN); /* clear interrupt to start transmission */
-  while ( !(TWCR & _BV(TWINT)) && ms_twiCount < TWI_TIMEOUT ) 
-  {
-  			; // wait for transmission 
-  }
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_sla_w_error, TWCR, TWSR);
-      goto error;	  
-  }
-
-  switch ((twst = TW_STATUS))
-  {
-    case TW_MT_SLA_ACK:
-      break;
-
-    case TW_MT_SLA_NACK:	/* nack during select: device busy writing */
-      goto restart;
-
-    case TW_MT_ARB_LOST:	/* re-arbitrate */
-      goto begin;
-  }
-  ms_sleep(1);  // don't know why we need to wait but we do!
-
-
-
-  ///////////////////////////
-  // send data pointer 
-  ms_twiCount =0;
-  TWDR = write_pointer_addr;
-  TWCR = _BV(TWINT) | _BV(TWEN); /* clear interrupt to start transmission */
-  while ( !(TWCR & _BV(TWINT)) && ms_twiCount < TWI_TIMEOUT ) 
-  {
-  			; // wait for transmission 
-  }
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_sla_w_error, TWCR, TWSR);
-      goto error;	  
-  }
-
-  switch ((twst = TW_STATUS))
-  {
-    case TW_MT_SLA_ACK:
-      break;
-
-    case TW_MT_SLA_NACK:	/* nack during select: device busy writing */
-      goto restart;
-
-    case TW_MT_ARB_LOST:	/* re-arbitrate */
-      goto begin;
-  }
-  ms_sleep(1);  // don't know why we need to wait but we do!
-
-
-  ///////////////////////////
-  //  resend start condition 
-  TWCR = TWCR_START ; // send start condition 
-  while ( !(TWCR & _BV(TWINT))  && (ms_twiCount < TWI_TIMEOUT) ) ; // wait for transmission 
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_start_error, TWCR, TWSR);
-    return -2;
-   }
-  switch ((twst = TW_STATUS))
-    {
-    case TW_REP_START:		// OK, but should not happen 
-    case TW_START:
-      break;
-
-    case TW_MT_ARB_LOST:
-      goto begin;
-
-    default:
-      return -3;		// error: not in start condition 
-				// NB: do /not/ send stop condition 
-    }
-
-
-  ///////////////////////////
-  // send twi addr + R
-  ms_twiCount =0;
-  TWDR = (twi_addr <<1) | TW_READ;
-  TWCR = _BV(TWINT) | _BV(TWEN); /* clear interrupt to start transmission */
-  while ( !(TWCR & _BV(TWINT)) && ms_twiCount < TWI_TIMEOUT ) 
-  {
-  			; // wait for transmission 
-  }
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_sla_w_error, TWCR, TWSR);
-      goto error;	  
-  }
-
-  switch ((twst = TW_STATUS))
-  {
-    case TW_MT_SLA_ACK:
-      break;
-
-    case TW_MT_SLA_NACK:	/* nack during select: device busy writing */
-      goto restart;
-
-    case TW_MT_ARB_LOST:	/* re-arbitrate */
-      goto begin;
-  }
-  //////////////////////////////////////
-  // Now Read Data
-  for (; len > 0; len--)
-  {
-    twcr = _BV(TWINT) | _BV(TWEN) |  _BV(TWEA);  // NAK on last byte
-    if (len == 1)
-      twcr = _BV(TWINT) | _BV(TWEN); // send NAK this time 
-    TWCR = twcr;		/* clear int to start transmission */
-    while ((TWCR & _BV(TWINT)) == 0) ; /* wait for transmission */
-    switch ((twst = TW_STATUS))
-	{
-	  case TW_MR_DATA_NACK:
-	    len = 0;		/* force end of loop */
-	    /* FALLTHROUGH */
-	  case TW_MR_DATA_ACK:
-	    *buf++ = TWDR;
-	    rv++;
-	    break;
-
-	default:
-	  goto error;
-	}
-  }
-
- quit:
-  /* Note [14] */
-  TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN); /* send stop condition */
-
-  return rv;
-
-  error:
-  rv = -1;
-  goto quit;
 
+/*******************************************************************************
+*                              TRACK MUX STATE                                 *
+********************************************************************************
+* Description: Update the cached control register from a finished transaction
+*              to a mux, whoever sent it.  A read returns the register, a
+*              write sets it to the last byte written; after an error the
+*              register is unknown.
+*
+*   Arguments: mux    - mux addressed by the transaction
+*              xfer   - the transaction
+*              result - byte count or TWI_ERR_xxx
+*
+*      Return: None
+*******************************************************************************/
+static void twi_mux_track(twi_mux_t *mux, twi_xfer_t *xfer, int16_t result)
+{
+    if(result < 0)
+    {
+        mux->valid = 0;
+    }
+    else if(xfer->rdLen > 0)
+    {
+        mux->cfg   = xfer->rdBuf[xfer->rdLen - 1];
+        mux->valid = 1;
+    }
+    else if(xfer->wrLen > 0)
+    {
+        mux->cfg   = xfer->wrBuf[xfer->wrLen - 1];
+        mux->valid = 1;
+    }
 }
 
 
+/*******************************************************************************
+*                              FIND DEVICE HEALTH                              *
+********************************************************************************
+* Description: Look up the health entry for a routed transaction's device
+*
+*   Arguments: xfer   - routed transaction
+*              create - add an entry if there is none and there is room
+*
+*      Return: entry or NULL
+*******************************************************************************/
+static twi_health_t *twi_health_find(twi_xfer_t *xfer, uint8_t create)
+{
+    twi_health_t *h;
+    uint8_t       i;
+
+    for(i = 0; i < twiNumHealth; i++)
+    {
+        h = &twiHealth[i];
+        if(h->addr == xfer->addr && h->muxAddr == xfer->muxAddr &&
+           h->channel == xfer->muxChannel)
+        {
+            return h;
+        }
+    }
+    if(!create || twiNumHealth >= TWI_MAX_HEALTH)
+    {
+        return NULL;
+    }
+
+    h = &twiHealth[twiNumHealth++];
+    memset(h, 0, sizeof(*h));
+    h->muxAddr = xfer->muxAddr;
+    h->channel = xfer->muxChannel;
+    h->addr    = xfer->addr;
+    return h;
+}
 
 
 /*******************************************************************************
-*                                  READ BYTES                                  *
+*                             UPDATE DEVICE HEALTH                             *
 ********************************************************************************
-* Description: Data Read TWO BYTE data ADDRESS!!
-*              ---Write Pointer Then Read   
-*              USE: twi_read_bytes_wP() for 1 byte address
-*  
-*   Arguments: twi_addr
-*              write_pointer_addr
-*              len
-*              *buf
-*  
+* Description: Count a routed transaction's result.  A success clears the
+*              device's record; a failure counts toward quarantine and, once
+*              quarantined, pushes the next re-probe out twice as far.
+*
+*   Arguments: xfer   - routed transaction
+*              result - byte count or TWI_ERR_xxx
+*
 *      Return: None
 *******************************************************************************/
-int twi_read_bytes_wP2(uint8_t twi_addr, uint16_t write_pointer_addr, int len, uint8_t *buf)
+static void twi_health_update(twi_xfer_t *xfer, int16_t result)
 {
-  uint8_t n = 0, write_pointer_addr_H, write_pointer_addr_L;
-  uint8_t twst, twcr;
-  int rv = 0;
-//  uint16_t ms_twiCount;
+    twi_health_t *h = twi_health_find(xfer, result < 0);
+    uint32_t      next;
+
+    if(h != NULL && (xfer->flags & TWI_XFER_REPROBE))
+    {
+        h->probing = 0;
+    }
+    xfer->flags &= ~TWI_XFER_REPROBE;
+    if(h == NULL)
+    {
+        return;
+    }
 
-  write_pointer_addr_H = (write_pointer_addr >> 8);
-  write_pointer_addr_L = (write_pointer_addr & 0xFF);
+    if(result >= 0)
+    {
+        h->fails       = 0;
+        h->quarantined = 0;
+        h->backoff     = 0;
+        return;
+    }
 
+    if(h->fails < UINT8_MAX)
+    {
+        h->fails++;
+    }
+    h->lastError = result;
+    h->failUs    = time_us() - twiStartTime;
 
-  restart:
+    if(h->fails >= TWI_QUARANTINE_FAILS)
+    {
+        next = (h->backoff == 0) ? TWI_QUARANTINE_MS : (uint32_t)h->backoff * 2;
+        h->backoff     = (next > TWI_QUARANTINE_MAX_MS) ? TWI_QUARANTINE_MAX_MS : next;
+        h->retryAt     = ms_time() + h->backoff;
+        h->quarantined = 1;
+    }
+}
 
-  if (n++ >= TWI_MAX_ITER)
-    return -TWI_MAX_ITER;
 
-  begin:
- 
-  ms_twiCount =0;
-  ///////////////////////////
-  // send start condition 
-  TWCR = TWCR_START ; // send start condition 
-  while ( !(TWCR & _BV(TWINT))  && (ms_twiCount < TWI_TIMEOUT) ) ; // wait for transmission 
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_start_error, TWCR, TWSR);
-    return -2;
-   }
-  switch ((twst = TW_STATUS))
-    {
-    case TW_REP_START:		// OK, but should not happen 
-    case TW_START:
-      break;
-
-    case TW_MT_ARB_LOST:
-      goto begin;
-
-    default:
-      return -3;		// error: not in start condition 
-				// NB: do /not/ send stop condition 
-    }
-
-  ///////////////////////////
-  // send twi addr + w
-  ms_twiCount =0;
-  TWDR = (twi_addr <<1) | TW_WRITE;
-  TWCR = _BV(TWINT) | _BV(TWEN); /* clear interrupt to start transmission */
-  while ( !(TWCR & _BV(TWINT)) && ms_twiCount < TWI_TIMEOUT ) 
-  {
-  			; // wait for transmission 
-  }
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_sla_w_error, TWCR, TWSR);
-      goto error;	  
-  }
-
-  switch ((twst = TW_STATUS))
-  {
-    case TW_MT_SLA_ACK:
-      break;
-
-    case TW_MT_SLA_NACK:	/* nack during select: device busy writing */
-      goto restart;
-
-    case TW_MT_ARB_LOST:	/* re-arbitrate */
-      goto begin;
-  }
-  ms_sleep(1);  // don't know why we need to wait but we do!
-
-
-
-  ///////////////////////////
-  // send MSB data pointer  
-  ms_twiCount =0;
-  TWDR = write_pointer_addr_H ;
-  TWCR = _BV(TWINT) | _BV(TWEN); /* clear interrupt to start transmission */
-  while ( !(TWCR & _BV(TWINT)) && ms_twiCount < TWI_TIMEOUT ) 
-  {
-  			; // wait for transmission 
-  }
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_sla_w_error, TWCR, TWSR);
-      goto error;	  
-  }
-
-  switch ((twst = TW_STATUS))
-  {
-    case TW_MT_SLA_ACK:
-      break;
-
-    case TW_MT_SLA_NACK:	/* nack during select: device busy writing */
-      goto restart;
-
-    case TW_MT_ARB_LOST:	/* re-arbitrate */
-      goto begin;
-  }
-//  ms_sleep(1);  // don't know why we need to wait but we do!
-
-
-///////////////////////////
-  // send LSB data pointer  
-  ms_twiCount =0;
-  TWDR = write_pointer_addr_L ;
-  TWCR = _BV(TWINT) | _BV(TWEN); /* clear interrupt to start transmission */
-  while ( !(TWCR & _BV(TWINT)) && ms_twiCount < TWI_TIMEOUT ) 
-  {
-  			; // wait for transmission 
-  }
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_sla_w_error, TWCR, TWSR);
-      goto error;	  
-  }
-
-  switch ((twst = TW_STATUS))
-  {
-    case TW_MT_SLA_ACK:
-      break;
-
-    case TW_MT_SLA_NACK:	/* nack during select: device busy writing */
-      goto restart;
-
-    case TW_MT_ARB_LOST:	/* re-arbitrate */
-      goto begin;
-  }
-  ms_sleep(1);  // don't know why we need to wait but we do!
-
-
-
-  ///////////////////////////
-  //  resend start condition 
-  TWCR = TWCR_START ; // send start condition 
-  while ( !(TWCR & _BV(TWINT))  && (ms_twiCount < TWI_TIMEOUT) ) ; // wait for transmission 
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_start_error, TWCR, TWSR);
-    return -2;
-   }
-  switch ((twst = TW_STATUS))
-    {
-    case TW_REP_START:		// OK, but should not happen 
-    case TW_START:
-      break;
-
-    case TW_MT_ARB_LOST:
-      goto begin;
-
-    default:
-      return -3;		// error: not in start condition 
-				// NB: do /not/ send stop condition 
-    }
-
-
-  ///////////////////////////
-  // send twi addr + R
-  ms_twiCount =0;
-  TWDR = (twi_addr <<1) | TW_READ;
-  TWCR = _BV(TWINT) | _BV(TWEN); /* clear interrupt to start transmission */
-  while ( !(TWCR & _BV(TWINT)) && ms_twiCount < TWI_TIMEOUT ) 
-  {
-  			; // wait for transmission 
-  }
-  if (ms_twiCount >= TWI_TIMEOUT) {
-      twi_error(s_twi_sla_w_error, TWCR, TWSR);
-      goto error;	  
-  }
-
-  switch ((twst = TW_STATUS))
-  {
-    case TW_MT_SLA_ACK:
-      break;
-
-    case TW_MT_SLA_NACK:	/* nack during select: device busy writing */
-      goto restart;
-
-    case TW_MT_ARB_LOST:	/* re-arbitrate */
-      goto begin;
-  }
-  //////////////////////////////////////
-  // Now Read Data
-  for (; len > 0; len--)
-  {
-    twcr = _BV(TWINT) | _BV(TWEN) |  _BV(TWEA);  // NAK on last byte
-    if (len == 1)
-      twcr = _BV(TWINT) | _BV(TWEN); // send NAK this time 
-    TWCR = twcr;		/* clear int to start transmission */
-    while ((TWCR & _BV(TWINT)) == 0) ; /* wait for transmission */
-    switch ((twst = TW_STATUS))
-	{
-	  case TW_MR_DATA_NACK:
-	    len = 0;		/* force end of loop */
-	    /* FALLTHROUGH */
-	  case TW_MR_DATA_ACK:
-	    *buf++ = TWDR;
-	    rv++;
-	    break;
-
-	default:
-	  goto error;
-	}
-  }
-
- quit:
-  /* Note [14] */
-  TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN); /* send stop condition */
-
-  return rv;
-
-  error:
-  rv = -1;
-  goto quit;
-
-}
+/*******************************************************************************
+*                             COMPLETE TRANSACTION                             *
+********************************************************************************
+* Description: Post the result of the current transaction, run its callback
+*              and start the next queued transaction.  Called with interrupts
+*              disabled.
+*
+*              If a channel select the engine inserted failed, the routed
+*              transaction waiting for it, still at the head of the queue,
+*              fails with the same result rather than going to whatever
+*              channel happens to be selected.
+*
+*   Arguments: result - byte count or TWI_ERR_xxx
+*
+*      Return: None
+*******************************************************************************/
+static void twi_complete(int16_t result)
+{
+    twi_xfer_t *xfer = twiCurrent;
+    twi_mux_t  *mux  = twi_find_mux(xfer->addr);
+
+    twiCurrent   = NULL;
+    xfer->result = result;
+    xfer->state  = (result < 0) ? TWI_XFER_ERROR : TWI_XFER_DONE;
+
+    if(mux != NULL)
+    {
+        twi_mux_track(mux, xfer, result);
+    }
+
+    if(xfer == &twiSelXfer)
+    {
+        if(result >= 0)
+        {
+            twi_begin_next();
+            return;
+        }
+
+        // fail the transaction the select was for
+        xfer    = twiHead;
+        twiHead = xfer->next;
+        if(twiHead == NULL)
+        {
+            twiTail = NULL;
+        }
+        xfer->twst   = twiSelXfer.twst;
+        xfer->result = result;
+        xfer->state  = TWI_XFER_ERROR;
+        twiRouteFor  = NULL;
+    }
 
+    if(xfer->muxAddr != 0 && !(xfer->flags & TWI_XFER_PROBE))
+    {
+        twi_health_update(xfer, result);
+    }
+
+    if(xfer->callback)
+    {
+        xfer->callback(xfer);
+    }
+    twi_begin_next();
+}
 
-
-/*******************************************************************************
-*                              PARSE I2C COMMANDS                              *
+
+/*******************************************************************************
+*                              FINISH TRANSACTION                              *
 ********************************************************************************
-* Description: Parse I2C command 
-*  
-*   Arguments: *cmd
-*  
+* Description: Send a STOP, wait at most TWI_STOP_TIMEOUT_US for it to go
+*              out, then complete the current transaction.
+*
+*   Arguments: result - byte count or TWI_ERR_xxx
+*
 *      Return: None
 *******************************************************************************/
-void parseI2C_commands(char *cmd)
-{
-	if (!strncmp(cmd,"tem",3 ))
-	{
-		verbose ^= 1;
-		verbose &= 1;
-		if (verbose)
-		{
-			printf_P(PSTR("error messages on\n"));
-		}
-		else 			
-		{
-			printf_P(PSTR("error messages off\n"));
-		}
-	}
-	else if (cmd[0] == '?')
-	{
-		printf_P(PSTR("terr -- toggle TWI Error display of Messages on and off\n"));
-	}
-	else
-	{
-		printf_P(PSTR("\ni2c command unknown.\n"));
-	}
+static void twi_finish(int16_t result)
+{
+    twi_send_stop();
+    twi_complete(result);
+}
+
+
+/*******************************************************************************
+*                              CLEAR MUX SEGMENT                               *
+********************************************************************************
+* Description: Find a mux on a bus segment that may have a channel enabled
+*
+*   Arguments: parent  - mux in front of the segment, 0 for the main bus
+*              channel - parent channel
+*              keep    - mux on the path, allowed to have one enabled
+*
+*      Return: mux that needs its channels disabled, NULL if none
+*******************************************************************************/
+static twi_mux_t *twi_route_clear(uint8_t parent, uint8_t channel, twi_mux_t *keep)
+{
+    twi_mux_t *mux;
+    uint8_t    i;
+
+    for(i = 0; i < twiNumMuxes; i++)
+    {
+        mux = &twiMux[i];
+        if(mux != keep && mux->parent == parent && mux->parentChannel == channel &&
+           (!mux->valid || mux->cfg != 0))
+        {
+            return mux;
+        }
+    }
+    return NULL;
+}
+
+
+/*******************************************************************************
+*                               NEXT ROUTE STEP                                *
+********************************************************************************
+* Description: Find the first mux write a transaction still needs, working
+*              from the main bus toward the device so every mux written is
+*              reachable.  On each segment of the path the other muxes are
+*              disabled first, then the path mux is set to the one channel
+*              leading on.  Muxes behind the device's own channel are
+*              disabled last, except the device itself when it is a mux:
+*              discovery sizes a cascaded mux by writing and reading back
+*              its control register.
+*
+*   Arguments: xfer - transaction
+*              cfg  - set to the value to write
+*
+*      Return: mux to write, NULL if the route is set up or there is none
+*******************************************************************************/
+static twi_mux_t *twi_route_step(twi_xfer_t *xfer, uint8_t *cfg)
+{
+    twi_mux_t *path[TWI_MAX_MUXES];
+    twi_mux_t *mux;
+    uint8_t    depth = 0;
+    uint8_t    want;
+
+    if(xfer->muxAddr == 0)
+    {
+        return NULL;
+    }
+
+    // device to main bus, the depth limit guards against a parent loop
+    for(mux = twi_find_mux(xfer->muxAddr); mux != NULL && depth < TWI_MAX_MUXES;
+        mux = twi_find_mux(mux->parent))
+    {
+        path[depth++] = mux;
+    }
+
+    *cfg = 0;
+    while(depth > 0)
+    {
+        mux  = path[--depth];
+        want = _BV((depth > 0) ? path[depth - 1]->parentChannel : xfer->muxChannel);
+
+        if((mux = twi_route_clear(mux->parent, mux->parentChannel, mux)) != NULL)
+        {
+            return mux;
+        }
+        mux = path[depth];
+        if(!mux->valid || mux->cfg != want)
+        {
+            *cfg = want;
+            return mux;
+        }
+    }
+    // a mux behind the channel that is itself the target keeps its setting
+    return twi_route_clear(xfer->muxAddr, xfer->muxChannel, twi_find_mux(xfer->addr));
+}
+
+
+/*******************************************************************************
+*                           PICK NEXT TRANSACTION                              *
+********************************************************************************
+* Description: Choose the queued transaction to run next.  Normally the
+*              head, but if the head needs a channel switch the first few
+*              transactions are searched for one that needs none, so
+*              transactions on the selected channel go out together.  The
+*              search never moves a transaction ahead of an earlier one to
+*              the same device, or past a transaction addressed to a mux,
+*              and the head is passed over at most TWI_GROUP_SCAN times.
+*
+*   Arguments: prev - set to the transaction ahead of the one chosen, NULL
+*                     if it is the head
+*
+*      Return: transaction to run, NULL if the head needs a channel switch
+*              first
+*******************************************************************************/
+static twi_xfer_t *twi_pick_next(twi_xfer_t **prev)
+{
+    twi_xfer_t *xfer = twiHead;
+    twi_xfer_t *p;
+    uint8_t     cfg;
+    uint8_t     n;
+
+    *prev = NULL;
+    if(twi_route_step(xfer, &cfg) == NULL)
+    {
+        twiSkips = 0;
+        return xfer;
+    }
+    if(twiSkips >= TWI_GROUP_SCAN)
+    {
+        twiSkips = 0;
+        return NULL;
+    }
+
+    for(n = 1; n < TWI_GROUP_SCAN && xfer->next != NULL; n++)
+    {
+        *prev = xfer;
+        xfer  = xfer->next;
+
+        if(twi_find_mux(xfer->addr) != NULL)
+        {
+            break;
+        }
+        if(twi_route_step(xfer, &cfg) != NULL)
+        {
+            continue;
+        }
+
+        for(p = twiHead; p != xfer; p = p->next)
+        {
+            if(p->addr == xfer->addr && p->muxAddr == xfer->muxAddr &&
+               p->muxChannel == xfer->muxChannel)
+            {
+                break;
+            }
+        }
+        if(p == xfer)
+        {
+            twiSkips++;
+            return xfer;
+        }
+    }
+    return NULL;
+}
+
+
+/*******************************************************************************
+*                             START TRANSACTION                                *
+********************************************************************************
+* Description: Put a transaction on the bus at its device's rate
+*
+*   Arguments: xfer - transaction, already off the queue
+*
+*      Return: None
+*******************************************************************************/
+static void twi_start_xfer(twi_xfer_t *xfer)
+{
+    twiCurrent    = xfer;
+    xfer->state   = TWI_XFER_BUSY;
+    xfer->retries = 0;
+    xfer->arbLost = 0;
+    xfer->profile = twi_find_profile(xfer->addr);
+    twi_set_hw_bitrate((xfer->profile && xfer->profile->bitrate) ?
+                        xfer->profile->bitrate : twiBusBitrate);
+    twi_restart(xfer);
+}
+
+
+/*******************************************************************************
+*                            TRANSACTION BUDGET                                *
+********************************************************************************
+* Description: Longest a transaction may take, TWI_XFER_MAX_US plus its
+*              device's inter-byte delay for every byte
+*
+*   Arguments: xfer - transaction
+*
+*      Return: usec
+*******************************************************************************/
+static uint32_t twi_xfer_budget(twi_xfer_t *xfer)
+{
+    const twi_profile_t *profile = twi_find_profile(xfer->addr);
+    uint16_t             bytes   = xfer->hdrLen + xfer->wrLen + xfer->rdLen;
+
+    return TWI_XFER_MAX_US +
+           ((profile != NULL) ? (uint32_t)bytes * profile->byteDelay_us : 0);
+}
+
+
+/*******************************************************************************
+*                            BEGIN NEXT TRANSACTION                            *
+********************************************************************************
+* Description: Move the next queued transaction onto the bus if the bus is
+*              idle.  A routed transaction whose path is not set up stays
+*              queued while the engine writes the muxes on the way, one
+*              select at a time.  Called with interrupts disabled.
+*
+*   Arguments: None
+*
+*      Return: None
+*******************************************************************************/
+static void twi_begin_next(void)
+{
+    twi_xfer_t *xfer;
+    twi_xfer_t *prev;
+    twi_mux_t  *mux;
+
+    if(twiCurrent != NULL || twiHead == NULL || twiRecovering)
+    {
+        return;
+    }
+
+    xfer = twi_pick_next(&prev);
+    if(xfer == NULL)
+    {
+        if(twiRouteFor != twiHead)
+        {
+            twiRouteFor  = twiHead;
+            twiStartTime = time_us();
+            twiDeadline  = twiStartTime + twi_xfer_budget(twiHead);
+        }
+        mux = twi_route_step(twiHead, &twiSelCfg);
+        twi_setup_xfer(&twiSelXfer, mux->addr, &twiSelCfg, 1, NULL, 0);
+        mux->switches++;
+        twi_start_xfer(&twiSelXfer);
+        return;
+    }
+
+    mux = twi_find_mux(xfer->muxAddr);
+    if(mux != NULL && xfer->muxAddr != 0)
+    {
+        mux->hits++;
+    }
+    if(xfer != twiRouteFor)
+    {
+        twiStartTime = time_us();
+        twiDeadline  = twiStartTime + twi_xfer_budget(xfer);
+    }
+    twiRouteFor = NULL;
+
+    if(prev == NULL)
+    {
+        twiHead = xfer->next;
+    }
+    else
+    {
+        prev->next = xfer->next;
+    }
+    if(twiTail == xfer)
+    {
+        twiTail = prev;
+    }
+
+    twi_start_xfer(xfer);
+}
+
+
+/*******************************************************************************
+*                              TWI INTERRUPT VECTOR                            *
+********************************************************************************
+* Description: TWI state machine.  Each interrupt is one bus event; TW_STATUS
+*              together with the transaction phase tells us what to send next.
+*
+*      Global: twiCurrent, twiState
+*******************************************************************************/
+ISR(TWI_vect)
+{
+    twi_xfer_t *xfer = twiCurrent;
+    uint8_t     twst = TW_STATUS;
+    uint32_t    now  = time_us();
+
+    if(xfer != NULL)
+    {
+        twi_latency_record(twi_latency_row(xfer, (twiState == TWI_STATE_START) ?
+                                                 TWI_TMO_START : TWI_TMO_XFER),
+                           now - twiEventTime);
+    }
+    twiEventTime = now;
+
+    if(xfer == NULL)
+    {
+        // nothing queued, just release the bus
+        TWCR = TWCR_STOP;
+        return;
+    }
+    xfer->twst = twst;
+
+    switch(twst)
+    {
+        case TW_START:
+        case TW_REP_START:
+            twiState = TWI_STATE_XFER;
+            TWDR = (xfer->addr << 1) |
+                   ((xfer->phase == TWI_PHASE_READ) ? TW_READ : TW_WRITE);
+            TWCR = TWCR_ISR_NEXT;
+            break;
+
+        case TW_MT_DATA_ACK:
+            xfer->idx++;
+            xfer->count++;
+            /* FALLTHROUGH */
+        case TW_MT_SLA_ACK:
+            if(xfer->idx < xfer->hdrLen + xfer->wrLen)
+            {
+                // header (address pointer) bytes go out ahead of the data
+                TWDR = (xfer->idx < xfer->hdrLen) ?
+                       xfer->hdr[xfer->idx] :
+                       xfer->wrBuf[xfer->idx - xfer->hdrLen];
+                twi_pace(xfer, TWCR_ISR_NEXT);
+            }
+            else if(xfer->rdLen > 0)
+            {
+                // turn the bus around with a repeated START
+                xfer->phase = TWI_PHASE_READ;
+                xfer->idx   = 0;
+                xfer->count = 0;
+                twiState    = TWI_STATE_START;
+                twi_pace(xfer, TWCR_ISR_START);
+            }
+            else
+            {
+                twi_finish(xfer->count);
+            }
+            break;
+
+        case TW_MT_SLA_NACK:    // nack during select: device busy writing
+        case TW_MR_SLA_NACK:
+            if(++xfer->retries >= TWI_MAX_ITER ||
+               (xfer->flags & (TWI_XFER_PROBE | TWI_XFER_REPROBE)))
+            {
+                twi_finish(TWI_ERR_NACK);
+            }
+            else
+            {
+                twi_restart(xfer);
+            }
+            break;
+
+        case TW_MT_ARB_LOST:    // re-arbitrate, same code as TW_MR_ARB_LOST
+            if(++xfer->arbLost >= TWI_MAX_ARB)
+            {
+                // the bus belongs to the other master, no STOP
+                TWCR = _BV(TWINT) | _BV(TWEN);
+                twi_complete(TWI_ERR_ARB);
+            }
+            else
+            {
+                twi_restart(xfer);
+            }
+            break;
+
+        case TW_MR_SLA_ACK:
+            // NAK on last byte
+            TWCR = (xfer->rdLen > 1) ? TWCR_ISR_ACK : TWCR_ISR_NEXT;
+            break;
+
+        case TW_MR_DATA_ACK:
+            xfer->rdBuf[xfer->idx++] = TWDR;
+            xfer->count++;
+            TWCR = (xfer->rdLen - xfer->idx > 1) ? TWCR_ISR_ACK : TWCR_ISR_NEXT;
+            break;
+
+        case TW_MR_DATA_NACK:
+            xfer->rdBuf[xfer->idx++] = TWDR;
+            xfer->count++;
+            twi_finish(xfer->count);
+            break;
+
+        case TW_MT_DATA_NACK:
+        default:
+            twi_finish(TWI_ERR_DATA);
+            break;
+    }
+}
+
+
+/*******************************************************************************
+*                             REGISTER TWI DEVICE                              *
+********************************************************************************
+* Description: Register (or update) the bus profile for a device.  The bus is
+*              switched to the device's SCL rate when one of its transactions
+*              starts.  A non zero inter-byte delay holds off every data byte
+*              and repeated START after the first address phase by at least
+*              that long.  Delays are rounded up to the Timer2 tick and
+*              limited to 16 msec.
+*
+*   Arguments: twi_addr     - 7-bit device address
+*              maxScl_hz    - fastest SCL the device supports, 0 to use the
+*                             bus rate
+*              byteDelay_us - inter-byte delay in usec, 0 for none
+*
+*      Return: 0 if no error is detected, -1 if the table is full or the
+*              rate or delay is out of range
+*******************************************************************************/
+int8_t twi_register_device(uint8_t twi_addr, uint32_t maxScl_hz, uint16_t byteDelay_us)
+{
+    twi_profile_t *profile = twi_find_profile(twi_addr);
+    uint16_t       bitrate = 0;
+    uint32_t       ticks;
+    uint16_t       div;
+    uint8_t        ocr = 0;
+    uint8_t        cs  = 0;
+    uint8_t        i;
+
+    if(maxScl_hz > 0)
+    {
+        bitrate = twi_calc_bitrate(maxScl_hz);
+        if(bitrate == 0)
+        {
+            return -1;
+        }
+    }
+
+    if(byteDelay_us > 0)
+    {
+        for(i = 0; i < sizeof(twiDelayDiv) / sizeof(twiDelayDiv[0]); i++)
+        {
+            div   = pgm_read_word(&twiDelayDiv[i]);
+            ticks = ((F_CPU / 1000000UL) * byteDelay_us + div - 1) / div;
+            if(ticks <= 256)
+            {
+                ocr = (ticks > 0) ? ticks - 1 : 0;
+                cs  = i + 2;
+                break;
+            }
+        }
+        if(cs == 0)
+        {
+            return -1;
+        }
+    }
+
+    if(profile == NULL)
+    {
+        if(twiNumProfiles >= TWI_MAX_DEVICES)
+        {
+            return -1;
+        }
+        profile = &twiProfiles[twiNumProfiles];
+        twiNumProfiles++;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        profile->addr         = twi_addr;
+        profile->bitrate      = bitrate;
+        profile->byteDelay_us = byteDelay_us;
+        profile->delayOcr     = ocr;
+        profile->delayCs      = cs;
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+*                           CALCULATE TWI BIT RATE                             *
+********************************************************************************
+* Description: Runtime version of TWI_BITRATE.  Picks the smallest prescaler
+*              that fits and rounds TWBR up so SCL never exceeds the target.
+*              Master mode needs TWBR >= 10, about 444 kHz at 16 MHz.
+*
+*   Arguments: scl_hz - target SCL frequency
+*
+*      Return: TWI_BITRATE value, 0 if the target cannot be reached
+*******************************************************************************/
+uint16_t twi_calc_bitrate(uint32_t scl_hz)
+{
+    uint32_t div;
+    uint32_t twbr;
+    uint8_t  ps;
+
+    if(scl_hz == 0 || F_CPU / scl_hz < 16)
+    {
+        return 0;
+    }
+
+    div = F_CPU / scl_hz - 16;
+    for(ps = 0; ps < 4; ps++)
+    {
+        twbr = (div + (2UL << (2 * ps)) - 1) >> (1 + 2 * ps);
+        if(twbr <= 255)
+        {
+            if(twbr < TWI_TWBR_MIN)
+            {
+                return 0;
+            }
+            return ((uint16_t)ps << 8) | twbr;
+        }
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+*                              TWI BIT RATE IN HZ                              *
+********************************************************************************
+* Description: SCL frequency produced by a bit rate setting
+*
+*   Arguments: bitrate - TWI_BITRATE value
+*
+*      Return: SCL frequency in Hz
+*******************************************************************************/
+uint32_t twi_bitrate_hz(uint16_t bitrate)
+{
+    return F_CPU / (16UL + ((uint32_t)(bitrate & 0xFF) << (1 + 2 * (bitrate >> 8))));
+}
+
+
+/*******************************************************************************
+*                            SET TWI BUS SPEED                                 *
+********************************************************************************
+* Description: Set the SCL rate used for devices without a profile.  Their
+*              learned timeouts start over.
+*
+*   Arguments: scl_hz - target SCL frequency
+*
+*      Return: actual SCL frequency, 0 if the target is out of range
+*******************************************************************************/
+uint32_t twi_set_speed(uint32_t scl_hz)
+{
+    uint16_t bitrate = twi_calc_bitrate(scl_hz);
+
+    if(bitrate == 0)
+    {
+        return 0;
+    }
+
+    twiBusBitrate = bitrate;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        // latency learned at the old rate no longer applies
+        memset(twiLatency[TWI_MAX_DEVICES], 0, sizeof(twiLatency[TWI_MAX_DEVICES]));
+        if(!twi_busy())
+        {
+            twi_set_hw_bitrate(bitrate);
+        }
+    }
+    return twi_bitrate_hz(bitrate);
+}
+
+
+/*******************************************************************************
+*                            GET TWI BUS SPEED                                 *
+********************************************************************************
+* Description: SCL rate used for devices without a profile
+*
+*   Arguments: None
+*
+*      Return: SCL frequency in Hz
+*******************************************************************************/
+uint32_t twi_get_speed(void)
+{
+    return twi_bitrate_hz(twiBusBitrate);
+}
+
+
+/*******************************************************************************
+*                            SETUP TWI TRANSACTION                             *
+********************************************************************************
+* Description: Fill in a transaction descriptor.  Header bytes, callback and
+*              context are cleared and may be set by the caller afterwards.
+*
+*   Arguments: xfer     - descriptor to set up
+*              twi_addr - 7-bit device address
+*              wrBuf    - data to write, may be NULL if wrLen is 0
+*              wrLen    - number of bytes to write
+*              rdBuf    - read data goes here, may be NULL if rdLen is 0
+*              rdLen    - number of bytes to read
+*
+*      Return: None
+*******************************************************************************/
+void twi_setup_xfer(twi_xfer_t *xfer, uint8_t twi_addr,
+                    const uint8_t *wrBuf, uint8_t wrLen,
+                    uint8_t *rdBuf, uint8_t rdLen)
+{
+    memset(xfer, 0, sizeof(*xfer));
+    xfer->addr  = twi_addr;
+    xfer->wrBuf = wrBuf;
+    xfer->wrLen = wrLen;
+    xfer->rdBuf = rdBuf;
+    xfer->rdLen = rdLen;
+}
+
+
+/*******************************************************************************
+*                        SETUP ROUTED TWI TRANSACTION                          *
+********************************************************************************
+* Description: Fill in a transaction descriptor for a device that may sit
+*              behind a mux channel.  The engine selects the channel when
+*              the transaction starts, the caller never touches the mux.
+*
+*   Arguments: xfer  - descriptor to set up
+*              dev   - device handle
+*              wrBuf - data to write, may be NULL if wrLen is 0
+*              wrLen - number of bytes to write
+*              rdBuf - read data goes here, may be NULL if rdLen is 0
+*              rdLen - number of bytes to read
+*
+*      Return: None
+*******************************************************************************/
+void twi_setup_dev_xfer(twi_xfer_t *xfer, const twi_dev_t *dev,
+                        const uint8_t *wrBuf, uint8_t wrLen,
+                        uint8_t *rdBuf, uint8_t rdLen)
+{
+    twi_setup_xfer(xfer, dev->addr, wrBuf, wrLen, rdBuf, rdLen);
+    xfer->muxAddr    = dev->muxAddr;
+    xfer->muxChannel = dev->channel;
+}
+
+
+/*******************************************************************************
+*                               REGISTER MUX                                   *
+********************************************************************************
+* Description: Register a PCA9546 style channel switch so transactions can
+*              be routed through it.  Its control register is unknown until
+*              the first transaction to it.  A mux behind another mux is
+*              registered after it.
+*
+*   Arguments: muxAddr       - 7-bit mux address
+*              parentAddr    - mux in front of this one, 0 for the main bus
+*              parentChannel - parent channel it sits behind
+*
+*      Return: 0 if no error is detected, -1 if the table is full or the
+*              parent is not registered
+*******************************************************************************/
+int8_t twi_register_mux(uint8_t muxAddr, uint8_t parentAddr, uint8_t parentChannel)
+{
+    twi_mux_t *mux = twi_find_mux(muxAddr);
+
+    if(parentAddr != 0 && (twi_find_mux(parentAddr) == NULL || parentAddr == muxAddr))
+    {
+        return -1;
+    }
+    if(parentAddr == 0)
+    {
+        parentChannel = 0;
+    }
+
+    if(mux == NULL)
+    {
+        if(twiNumMuxes >= TWI_MAX_MUXES)
+        {
+            return -1;
+        }
+        mux = &twiMux[twiNumMuxes];
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            memset(mux, 0, sizeof(*mux));
+            mux->addr = muxAddr;
+            twiNumMuxes++;
+        }
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        mux->parent        = parentAddr;
+        mux->parentChannel = parentChannel;
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+*                              CACHED MUX STATE                                *
+********************************************************************************
+* Description: Control register of a mux as last seen on the bus
+*
+*   Arguments: muxAddr - 7-bit mux address
+*              cfg     - set to the control register if it is known
+*
+*      Return: 1 if cfg was set, 0 if unknown, TWI_ERR_ROUTE if the mux is
+*              not registered
+*******************************************************************************/
+int8_t twi_mux_cached(uint8_t muxAddr, uint8_t *cfg)
+{
+    twi_mux_t *mux = twi_find_mux(muxAddr);
+    int8_t     rv  = 0;
+
+    if(mux == NULL)
+    {
+        return TWI_ERR_ROUTE;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if(mux->valid)
+        {
+            *cfg = mux->cfg;
+            rv   = 1;
+        }
+    }
+    return rv;
+}
+
+
+/*******************************************************************************
+*                               CLEAR MUX TABLE                                *
+********************************************************************************
+* Description: Forget every registered mux, ahead of discovering the tree
+*              again.  Waits for the queue to drain first.
+*
+*   Arguments: None
+*
+*      Return: None
+*******************************************************************************/
+void twi_clear_muxes(void)
+{
+    while(twi_busy())
+    {
+        twi_service();
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        twiNumMuxes = 0;
+    }
+}
+
+
+/*******************************************************************************
+*                             INVALIDATE MUX STATE                             *
+********************************************************************************
+* Description: Forget the cached control register, for a change the engine
+*              cannot see such as a hardware reset.  The next routed
+*              transaction selects its channel again.
+*
+*   Arguments: muxAddr - 7-bit mux address
+*
+*      Return: None
+*******************************************************************************/
+void twi_mux_invalidate(uint8_t muxAddr)
+{
+    twi_mux_t *mux = twi_find_mux(muxAddr);
+
+    if(mux != NULL)
+    {
+        mux->valid = 0;
+    }
+}
+
+
+/*******************************************************************************
+*                                 MUX INFO                                     *
+********************************************************************************
+* Description: Copy a mux's cached state and routing counters
+*
+*   Arguments: muxAddr - 7-bit mux address
+*              info    - copy goes here
+*
+*      Return: 0, or TWI_ERR_ROUTE if the mux is not registered
+*******************************************************************************/
+int8_t twi_mux_info(uint8_t muxAddr, twi_mux_t *info)
+{
+    twi_mux_t *mux = twi_find_mux(muxAddr);
+
+    if(mux == NULL)
+    {
+        return TWI_ERR_ROUTE;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        *info = *mux;
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+*                               DEVICE HEALTH                                  *
+********************************************************************************
+* Description: Copy a routed device's health entry
+*
+*   Arguments: index  - entry, 0 up
+*              health - copy goes here
+*
+*      Return: 0, -1 past the last entry
+*******************************************************************************/
+int8_t twi_health_get(uint8_t index, twi_health_t *health)
+{
+    int8_t rv = -1;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if(index < twiNumHealth)
+        {
+            *health = twiHealth[index];
+            rv      = 0;
+        }
+    }
+    return rv;
+}
+
+
+/*******************************************************************************
+*                             CLEAR DEVICE HEALTH                              *
+********************************************************************************
+* Description: Forget every health entry, which lifts every quarantine
+*
+*   Arguments: None
+*
+*      Return: None
+*******************************************************************************/
+void twi_health_clear(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        twiNumHealth = 0;
+    }
+}
+
+
+/*******************************************************************************
+*                             LATENCY RECORD                                   *
+********************************************************************************
+* Description: Copy a device's latency records, one per phase
+*
+*   Arguments: index - profile, 0 up; one past the last profile is the row
+*                      for devices without one, addr 0
+*              addr  - set to the device address
+*              lat   - TWI_TMO_PHASES records go here
+*
+*      Return: 0, -1 past the last row
+*******************************************************************************/
+int8_t twi_latency_get(uint8_t index, uint8_t *addr, twi_latency_t *lat)
+{
+    uint8_t row;
+
+    if(index > twiNumProfiles)
+    {
+        return -1;
+    }
+    row   = (index < twiNumProfiles) ? index : TWI_MAX_DEVICES;
+    *addr = (index < twiNumProfiles) ? twiProfiles[index].addr : 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        memcpy(lat, twiLatency[row], sizeof(twiLatency[row]));
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+*                              LATENCY P99                                     *
+********************************************************************************
+* Description: 99th percentile latency, as the top of its histogram bucket
+*
+*   Arguments: lat - record
+*
+*      Return: usec, 0 if there are no samples
+*******************************************************************************/
+uint32_t twi_latency_p99(const twi_latency_t *lat)
+{
+    uint16_t total = 0;
+    uint16_t cum   = 0;
+    uint8_t  b;
+
+    for(b = 0; b < TWI_TMO_BUCKETS; b++)
+    {
+        total += lat->hist[b];
+    }
+    if(total == 0)
+    {
+        return 0;
+    }
+
+    total -= total / 100;
+    for(b = 0; b < TWI_TMO_BUCKETS - 1; b++)
+    {
+        cum += lat->hist[b];
+        if(cum >= total)
+        {
+            break;
+        }
+    }
+    return TWI_TMO_BUCKET0_US << b;
+}
+
+
+/*******************************************************************************
+*                             LEARNED TIMEOUT                                  *
+********************************************************************************
+* Description: Timeout derived from a latency record: p99 times
+*              TWI_TMO_MARGIN, between TWI_TMO_FLOOR_US and TWI_TIMEOUT_US
+*
+*   Arguments: lat - record
+*
+*      Return: usec
+*******************************************************************************/
+uint32_t twi_latency_timeout(const twi_latency_t *lat)
+{
+    uint32_t tmo = twi_latency_p99(lat) * TWI_TMO_MARGIN;
+
+    if(tmo < TWI_TMO_FLOOR_US)
+    {
+        tmo = TWI_TMO_FLOOR_US;
+    }
+    if(tmo > TWI_TIMEOUT_US)
+    {
+        tmo = TWI_TIMEOUT_US;
+    }
+    return tmo;
+}
+
+
+/*******************************************************************************
+*                              RESET TIMEOUTS                                  *
+********************************************************************************
+* Description: Forget every latency sample and learned timeout; the
+*              watchdog goes back to TWI_TIMEOUT_US until they are learned
+*              again
+*
+*   Arguments: None
+*
+*      Return: None
+*******************************************************************************/
+void twi_timeouts_reset(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        memset(twiLatency, 0, sizeof(twiLatency));
+    }
+}
+
+
+/*******************************************************************************
+*                              SAVE TIMEOUTS                                   *
+********************************************************************************
+* Description: Write every device's learned timeouts to EEPROM, by address.
+*              Only changed bytes are written.
+*
+*   Arguments: None
+*
+*      Return: number of devices saved
+*******************************************************************************/
+int8_t twi_timeouts_save(void)
+{
+    twi_tmo_image_t img;
+    twi_latency_t   lat[TWI_TMO_PHASES];
+    uint8_t         i;
+    uint8_t         p;
+    uint16_t        crc = 0;
+    const uint8_t  *b   = (const uint8_t *)&img;
+
+    memset(&img, 0, sizeof(img));
+    img.magic = TWI_TMO_MAGIC;
+    for(i = 0; twi_latency_get(i, &img.rec[img.count].addr, lat) == 0; i++)
+    {
+        if(lat[TWI_TMO_START].timeoutUs == 0 && lat[TWI_TMO_XFER].timeoutUs == 0)
+        {
+            continue;
+        }
+        for(p = 0; p < TWI_TMO_PHASES; p++)
+        {
+            img.rec[img.count].timeoutUs[p] = lat[p].timeoutUs;
+        }
+        img.count++;
+    }
+
+    for(i = 0; i < offsetof(twi_tmo_image_t, crc); i++)
+    {
+        crc = _crc_xmodem_update(crc, b[i]);
+    }
+    img.crc = crc;
+
+    eeprom_update_block(&img, &twiTmoEeprom, sizeof(img));
+    return img.count;
+}
+
+
+/*******************************************************************************
+*                              LOAD TIMEOUTS                                   *
+********************************************************************************
+* Description: Seed the timeouts from EEPROM.  Call once the devices are
+*              registered; a seeded timeout is used until enough samples
+*              are seen to learn it again.
+*
+*   Arguments: None
+*
+*      Return: number of devices seeded, -1 if EEPROM holds no valid table
+*******************************************************************************/
+int8_t twi_timeouts_load(void)
+{
+    twi_tmo_image_t img;
+    twi_tmo_rec_t  *rec;
+    uint8_t         row;
+    uint8_t         i;
+    uint8_t         p;
+    uint8_t         n   = 0;
+    uint16_t        crc = 0;
+    const uint8_t  *b   = (const uint8_t *)&img;
+
+    eeprom_read_block(&img, &twiTmoEeprom, sizeof(img));
+    for(i = 0; i < offsetof(twi_tmo_image_t, crc); i++)
+    {
+        crc = _crc_xmodem_update(crc, b[i]);
+    }
+    if(img.magic != TWI_TMO_MAGIC || crc != img.crc || img.count > TWI_MAX_DEVICES + 1)
+    {
+        return -1;
+    }
+
+    for(i = 0; i < img.count; i++)
+    {
+        rec = &img.rec[i];
+        if(rec->addr == 0)
+        {
+            row = TWI_MAX_DEVICES;
+        }
+        else if(twi_find_profile(rec->addr) != NULL)
+        {
+            row = twi_find_profile(rec->addr) - twiProfiles;
+        }
+        else
+        {
+            continue;
+        }
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            for(p = 0; p < TWI_TMO_PHASES; p++)
+            {
+                twiLatency[row][p].timeoutUs = rec->timeoutUs[p];
+            }
+        }
+        n++;
+    }
+    return n;
+}
+
+
+/*******************************************************************************
+*                             SUBMIT TWI TRANSACTION                           *
+********************************************************************************
+* Description: Queue a transaction and return immediately.  Completion is
+*              signalled through xfer->state and the optional callback, which
+*              runs in interrupt context.  May be called from a callback.
+*
+*              A routed transaction to a quarantined device is refused, and
+*              left in the error state, until its re-probe is due.  The
+*              first one submitted after that is the re-probe; others are
+*              refused until it completes; see twi_health_t.  Probes are not
+*              tracked or refused.
+*
+*   Arguments: xfer - transaction to queue
+*
+*      Return: 0 if queued, TWI_ERR_BUSY if the descriptor is already queued,
+*              TWI_ERR_ROUTE if it is routed through an unregistered mux,
+*              TWI_ERR_QUARANTINE if its device is quarantined
+*******************************************************************************/
+int8_t twi_submit(twi_xfer_t *xfer)
+{
+    twi_health_t *h;
+    int8_t        rv = 0;
+
+    if(xfer->muxAddr != 0 && twi_find_mux(xfer->muxAddr) == NULL)
+    {
+        return TWI_ERR_ROUTE;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        h = (xfer->muxAddr != 0 && !(xfer->flags & TWI_XFER_PROBE)) ?
+            twi_health_find(xfer, 0) : NULL;
+
+        if(twi_xfer_pending(xfer))
+        {
+            rv = TWI_ERR_BUSY;
+        }
+        else if(h != NULL && h->quarantined &&
+                (h->probing || !time_after_eq(ms_time(), h->retryAt)))
+        {
+            h->refused++;
+            xfer->state  = TWI_XFER_ERROR;
+            xfer->result = TWI_ERR_QUARANTINE;
+            rv           = TWI_ERR_QUARANTINE;
+        }
+        else
+        {
+            if(h != NULL && h->quarantined)
+            {
+                xfer->flags |= TWI_XFER_REPROBE;
+                h->probing   = 1;
+            }
+            xfer->state  = TWI_XFER_QUEUED;
+            xfer->result = 0;
+            xfer->next   = NULL;
+
+            if(twiTail == NULL)
+            {
+                twiHead = xfer;
+            }
+            else
+            {
+                twiTail->next = xfer;
+            }
+            twiTail = xfer;
+
+            twi_begin_next();
+        }
+    }
+    return rv;
+}
+
+
+/*******************************************************************************
+*                                  TWI BUSY                                    *
+********************************************************************************
+* Description: Check for TWI activity
+*
+*   Arguments: None
+*
+*      Return: non zero if a transaction is on the bus or queued
+*******************************************************************************/
+uint8_t twi_busy(void)
+{
+    return (twiCurrent != NULL) || (twiHead != NULL);
+}
+
+
+/*******************************************************************************
+*                            RECOVERY SCL RELEASE                              *
+********************************************************************************
+* Description: Let SCL float high and wait, at most TWI_RECOVER_STRETCH_US,
+*              for a slave that is stretching the clock
+*
+*   Arguments: None
+*
+*      Return: None
+*******************************************************************************/
+static void twi_recover_scl_high(void)
+{
+    uint32_t deadline = timer_deadline(TWI_RECOVER_STRETCH_US);
+
+    DDRD &= ~TWI_SCL_PIN;
+    while(!(PIND & TWI_SCL_PIN) && !timer_expired(deadline))
+    ;
+    us_sleep(TWI_RECOVER_HALF_US);
+}
+
+
+/*******************************************************************************
+*                             RUN BUS RECOVERY                                 *
+********************************************************************************
+* Description: Free a bus a slave is holding.  With the TWI off, SCL and SDA
+*              are driven as open drain GPIO: SCL is pulsed until SDA goes
+*              high, at most TWI_RECOVER_PULSES times, which lets a slave
+*              caught mid byte finish it, then a STOP is made by hand.  The
+*              TWI is enabled again and the recovery hook, the mux reset,
+*              runs.  The queue is held by twiRecovering, which is cleared
+*              here, and the next transaction started.
+*
+*              Takes about 200 usec, up to 10 msec if a slave stretches
+*              every clock.  Interrupts stay enabled.
+*
+*      Global: twiRecovering, twiRecovery
+*
+*   Arguments: None
+*
+*      Return: 0, -1 if SDA or SCL is still low
+*******************************************************************************/
+static int8_t twi_recover_run(void)
+{
+    uint32_t start = time_us();
+    uint32_t us;
+    uint8_t  port;
+    uint8_t  ddr;
+    uint8_t  n;
+    int8_t   rv;
+
+    TWCR = 0;                   // TWI off, the pins are GPIO
+    port = PORTD & (TWI_SCL_PIN | TWI_SDA_PIN);
+    ddr  = DDRD  & (TWI_SCL_PIN | TWI_SDA_PIN);
+
+    // released is an input, low is an output driving 0
+    PORTD &= ~(TWI_SCL_PIN | TWI_SDA_PIN);
+    DDRD  &= ~(TWI_SCL_PIN | TWI_SDA_PIN);
+    twi_recover_scl_high();
+
+    for(n = 0; n < TWI_RECOVER_PULSES && !(PIND & TWI_SDA_PIN); n++)
+    {
+        DDRD |= TWI_SCL_PIN;
+        us_sleep(TWI_RECOVER_HALF_US);
+        twi_recover_scl_high();
+    }
+
+    // STOP: SDA rises while SCL is high
+    DDRD |= TWI_SCL_PIN;
+    us_sleep(TWI_RECOVER_HALF_US);
+    DDRD |= TWI_SDA_PIN;
+    us_sleep(TWI_RECOVER_HALF_US);
+    twi_recover_scl_high();
+    DDRD &= ~TWI_SDA_PIN;
+    us_sleep(TWI_RECOVER_HALF_US);
+
+    rv = ((PIND & TWI_SDA_PIN) && (PIND & TWI_SCL_PIN)) ? 0 : -1;
+
+    DDRD  = (DDRD  & ~(TWI_SCL_PIN | TWI_SDA_PIN)) | ddr;
+    PORTD = (PORTD & ~(TWI_SCL_PIN | TWI_SDA_PIN)) | port;
+    TWCR  = _BV(TWEN);
+
+    if(twiRecoverHook != NULL)
+    {
+        twiRecoverHook();
+    }
+
+    us = time_us() - start;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        twiRecovery.count++;
+        twiRecovery.pulses += n;
+        if(rv < 0)
+        {
+            twiRecovery.failed++;
+        }
+        twiRecovery.lastUs = us;
+        if(us > twiRecovery.maxUs)
+        {
+            twiRecovery.maxUs = us;
+        }
+
+        twiRecovering = 0;
+        twi_begin_next();
+    }
+
+    LOG(TWI, ERROR, TWI_BUS_RECOVERY, n, us, rv);
+    return rv;
+}
+
+
+/*******************************************************************************
+*                                 SERVICE TWI                                  *
+********************************************************************************
+* Description: TWI watchdog.  If the bus has not produced an interrupt
+*              within the phase's timeout, learned for the device or
+*              TWI_TIMEOUT_US, or the transaction has used up its
+*              TWI_XFER_MAX_US budget, the current transaction is aborted,
+*              the TWI hardware is reset and the next transaction is
+*              started.  Call from the main loop and from anything waiting
+*              on a transaction.
+*
+*              If SCL or SDA is low once the TWI is off, a slave is holding
+*              the bus: the queue is held and the bus recovered first, see
+*              twi_recover_run().
+*
+*      Global: twiEventTime - set by TWI_vect on every bus event
+*
+*   Arguments: None
+*
+*      Return: None
+*******************************************************************************/
+void twi_service(void)
+{
+    uint8_t overBudget;
+    uint8_t stuck = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        overBudget = (twiCurrent != NULL) && timer_expired(twiDeadline);
+        if(overBudget || (twiCurrent != NULL &&
+           timer_expired(twiEventTime + twi_phase_timeout(twiCurrent))))
+        {
+            twiCurrent->twst = TWSR;
+            if(!overBudget)
+            {
+                twi_latency_row(twiCurrent, (twiState == TWI_STATE_START) ?
+                                            TWI_TMO_START : TWI_TMO_XFER)->timeouts++;
+            }
+
+            // cancel any inter-byte delay in progress
+            TCCR2B = 0;
+            TIMSK2 = 0;
+
+            // disabling the TWI releases SCL/SDA and resets the state machine
+            TWCR = 0;
+            if((PIND & (TWI_SCL_PIN | TWI_SDA_PIN)) != (TWI_SCL_PIN | TWI_SDA_PIN))
+            {
+                stuck         = 1;
+                twiRecovering = 1;
+            }
+            TWCR = _BV(TWEN);
+
+            twi_complete(overBudget ? TWI_ERR_TIMEOUT :
+                         (twiState == TWI_STATE_START) ? TWI_ERR_START_TIMEOUT :
+                                                         TWI_ERR_DATA);
+        }
+    }
+
+    if(stuck)
+    {
+        twi_recover_run();
+    }
+}
+
+
+/*******************************************************************************
+*                              RECOVER TWI BUS                                 *
+********************************************************************************
+* Description: Run a bus recovery now, see twi_recover_run().  Waits for the
+*              transaction on the bus, if any, to finish or time out.
+*
+*   Arguments: None
+*
+*      Return: 0, -1 if the bus is still held low
+*******************************************************************************/
+int8_t twi_bus_recover(void)
+{
+    uint8_t idle = 0;
+
+    while(!idle)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if(twiCurrent == NULL && !twiRecovering)
+            {
+                twiRecovering = 1;
+                idle          = 1;
+            }
+        }
+        if(!idle)
+        {
+            twi_service();
+        }
+    }
+    return twi_recover_run();
+}
+
+
+/*******************************************************************************
+*                           SET RECOVERY HOOK                                  *
+********************************************************************************
+* Description: Register a function run at the end of every bus recovery,
+*              with interrupts enabled and the queue held.  It must not wait
+*              on TWI transactions.
+*
+*   Arguments: hook - function, NULL for none
+*
+*      Return: None
+*******************************************************************************/
+void twi_set_recover_hook(twi_recover_hook_t hook)
+{
+    twiRecoverHook = hook;
+}
+
+
+/*******************************************************************************
+*                            RECOVERY STATISTICS                               *
+********************************************************************************
+* Description: Copy the bus recovery counters
+*
+*   Arguments: stats - copied here
+*              clear - clear the counters after copying
+*
+*      Return: None
+*******************************************************************************/
+void twi_recovery_stats(twi_recovery_t *stats, uint8_t clear)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        *stats = twiRecovery;
+        if(clear)
+        {
+            memset(&twiRecovery, 0, sizeof(twiRecovery));
+        }
+    }
+}
+
+
+/*******************************************************************************
+*                              RUN TWI TRANSACTION                             *
+********************************************************************************
+* Description: Queue a transaction and wait for it to complete.  Errors are
+*              reported when TWI error messages are enabled.
+*
+*   Arguments: xfer - transaction to run
+*
+*      Return: bytes transferred or TWI_ERR_xxx
+*******************************************************************************/
+int twi_transfer(twi_xfer_t *xfer)
+{
+    int8_t rv = twi_submit(xfer);
+
+    if(rv != 0)
+    {
+        return rv;
+    }
+
+    while(twi_xfer_pending(xfer))
+    {
+        twi_service();
+    }
+
+    if(xfer->result < 0)
+    {
+        LOG(TWI, ERROR, TWI_XFER_ERROR, xfer->addr, xfer->result, xfer->phase,
+            TWCR, xfer->twst);
+    }
+    return xfer->result;
+}
+
+
+/*******************************************************************************
+*                                TWI WRITE BYTES                               *
+********************************************************************************
+* Description: Write to twi without address pointer (or address pointer is
+*              part of buffer)
+*  
+*   Arguments: twi_addr - two wire interface address
+*              line
+*              *buf
+*  
+*      Return: 0 if no error is detected
+*******************************************************************************/
+int twi_write_bytes(uint8_t twi_addr, int len, uint8_t *buf)
+{
+	return twi_write_bytes_with_WP(twi_addr, -2, len, buf);
+}
+
+
+/*******************************************************************************
+*                      TWI WRITE BYTES WITH ADDRESS POINTER                    *
+********************************************************************************
+* Description: Write to twi with two byte address pointer.  If the write
+*              pointer address is less then zero start then it is not sent.
+*  
+*   Arguments: twi_addr
+*              write Pointer
+*              len
+*              *buf
+*  
+*      Return: number of bytes written, including the pointer, or TWI_ERR_xxx
+*******************************************************************************/
+int twi_write_bytes_with_WP(uint8_t twi_addr, int16_t writePointer,  int len, uint8_t *buf)
+{
+    twi_xfer_t xfer;
+
+    if(len < 0 || len > UINT8_MAX)
+    {
+        return TWI_ERR_DATA;
+    }
+
+    twi_setup_xfer(&xfer, twi_addr, buf, len, NULL, 0);
+    if(writePointer >= 0)
+    {
+        // first two bytes are the address of the data to be written
+        xfer.hdr[0] = writePointer >> 8;
+        xfer.hdr[1] = writePointer & 0xFF;
+        xfer.hdrLen = 2;
+    }
+
+    return twi_transfer(&xfer);
+}
+
+
+/*******************************************************************************
+*                                  READ BYTES                                  *
+********************************************************************************
+* Description: Data Read---NO pointer is sent
+* 
+*   Arguments: twi_addr - device address
+*              len      - number of bytes to read
+*              *buf     - put read data here
+*  
+*      Return: number of bytes read
+*******************************************************************************/
+int twi_read_bytes(uint8_t twi_addr, int len, uint8_t *buf)
+{  
+    twi_xfer_t xfer;
+
+    if(len < 0 || len > UINT8_MAX)
+    {
+        return TWI_ERR_DATA;
+    }
+
+    twi_setup_xfer(&xfer, twi_addr, NULL, 0, buf, len);
+    return twi_transfer(&xfer);
+}
+
+
+/*******************************************************************************
+*                                  READ BYTES                                  *
+********************************************************************************
+* Description: Data Read ONE BYTE data ADDRESS!! 
+*              ---Write Pointer Then Read   
+*              USE: twi_read_bytes_wP2() for 2 byte address
+*  
+*   Arguments: twi_addr
+*              write_pointer_addr
+*              len
+*              *buf
+*  
+*      Return: number of bytes read
+*******************************************************************************/
+int twi_read_bytes_wP(uint8_t twi_addr, uint8_t write_pointer_addr, int len, uint8_t *buf)
+{
+    twi_xfer_t xfer;
+
+    if(len < 0 || len > UINT8_MAX)
+    {
+        return TWI_ERR_DATA;
+    }
+
+    twi_setup_xfer(&xfer, twi_addr, NULL, 0, buf, len);
+    xfer.hdr[0] = write_pointer_addr;
+    xfer.hdrLen = 1;
+
+    return twi_transfer(&xfer);
+}
+
+
+/*******************************************************************************
+*                                  READ BYTES                                  *
+********************************************************************************
+* Description: Data Read TWO BYTE data ADDRESS!!
+*              ---Write Pointer Then Read   
+*              USE: twi_read_bytes_wP() for 1 byte address
+*  
+*   Arguments: twi_addr
+*              write_pointer_addr
+*              len
+*              *buf
+*  
+*      Return: number of bytes read
+*******************************************************************************/
+int twi_read_bytes_wP2(uint8_t twi_addr, uint16_t write_pointer_addr, int len, uint8_t *buf)
+{
+    twi_xfer_t xfer;
+
+    if(len < 0 || len > UINT8_MAX)
+    {
+        return TWI_ERR_DATA;
+    }
+
+    twi_setup_xfer(&xfer, twi_addr, NULL, 0, buf, len);
+    xfer.hdr[0] = write_pointer_addr >> 8;
+    xfer.hdr[1] = write_pointer_addr & 0xFF;
+    xfer.hdrLen = 2;
 
+    return twi_transfer(&xfer);
 }
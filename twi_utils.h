@@ -1,6 +1,6 @@
 /*******************************************************************************
 *   File Name: twi_utils.h
-*  
+*
 * Description: data and definitions for twi_utils.c
 *******************************************************************************/
 #ifndef __twi_h__
@@ -15,23 +15,280 @@
 #define TWCR_START    (_BV(TWINT)|_BV(TWSTA)|_BV(TWEN))
 #define TWI_MASTER_TX (_BV(TWINT)|_BV(TWEN))
 #define TWI_TIMEOUT   180  // CHANGED BY gl TO 180 FROM 1000
+#define TWI_TIMEOUT_US (TWI_TIMEOUT * 1000UL)   // per bus phase, usec, the
+                                                // ceiling of learned timeouts
 #define TWI_ACK       1
 #define TWI_NACK      0
 #define TWI_VERBOSE   1   // GSL
 #define TWI_QUIET     0   // GSL
-#define TWI_MAX_ITER  250
+#define TWI_MAX_ITER  250      // SLA NACK restarts
+#define TWI_MAX_ARB   8         // arbitration losses before giving up
+#define TWI_STOP_TIMEOUT_US   1000UL    // STOP, busy wait
+#define TWI_XFER_MAX_US       500000UL  // one transaction, selects included,
+                                        // plus its inter-byte delays
+
+/*
+ * stuck bus recovery, PD0 SCL and PD1 SDA driven as GPIO
+ */
+#define TWI_RECOVER_PULSES    9         // SCL pulses to free a slave holding SDA
+#define TWI_RECOVER_HALF_US   5         // half an SCL period, about 100 kHz
+#define TWI_RECOVER_STRETCH_US 1000UL   // wait for a slave stretching SCL
+#define TWI_MAX_DEVICES  16     // number of device profiles
+#define TWI_MAX_MUXES    8      // PCA9546/PCA9548 style channel switches
+#define TWI_GROUP_SCAN   8      // queued transactions searched for one that
+                                // needs no channel switch
+#define TWI_MAX_HEALTH   32     // routed devices tracked for quarantine
+#define TWI_QUARANTINE_FAILS  3         // consecutive failures to quarantine
+#define TWI_QUARANTINE_MS     100       // first re-probe delay, doubles
+#define TWI_QUARANTINE_MAX_MS 60000     // longest re-probe delay
+
+/*
+ * learned timeouts.  Bus event latency is kept per device and phase in a
+ * histogram, bucket b counting latencies under TWI_TMO_BUCKET0_US << b.
+ * Once there are TWI_TMO_MIN_SAMPLES the watchdog uses p99 times
+ * TWI_TMO_MARGIN, kept between TWI_TMO_FLOOR_US and TWI_TIMEOUT_US.
+ */
+#define TWI_TMO_START         0         // waiting for a (repeated) START
+#define TWI_TMO_XFER          1         // SLA or data byte
+#define TWI_TMO_PHASES        2
+#define TWI_TMO_BUCKETS       11
+#define TWI_TMO_BUCKET0_US    64UL
+#define TWI_TMO_MIN_SAMPLES   64
+#define TWI_TMO_MARGIN        4
+#define TWI_TMO_FLOOR_US      2000UL
+
+/*
+ * SCL rate.  SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS).  TWI_BITRATE packs the
+ * prescaler bits in the high byte and TWBR in the low byte; for a constant
+ * rate it folds to a constant, otherwise use twi_calc_bitrate().  TWBR is
+ * rounded up so SCL never exceeds the target.
+ */
+#define TWI_SCL_DEFAULT     100000UL    // standard mode
+#define TWI_SCL_FAST        400000UL    // fast mode
+#define TWI_TWBR_MIN        10          // smallest TWBR allowed in master mode
+
+#define TWI_TWBR(scl, ps)   (((F_CPU) / (scl) - 16UL + 2UL * (ps) - 1) / (2UL * (ps)))
+#define TWI_BITRATE(scl)    ((TWI_TWBR(scl,  1) <= 255) ? (0x000 | TWI_TWBR(scl,  1)) : \
+                             (TWI_TWBR(scl,  4) <= 255) ? (0x100 | TWI_TWBR(scl,  4)) : \
+                             (TWI_TWBR(scl, 16) <= 255) ? (0x200 | TWI_TWBR(scl, 16)) : \
+                                                          (0x300 | TWI_TWBR(scl, 64)))
+
+/*
+ * transaction states
+ */
+#define TWI_XFER_IDLE     0     // not submitted
+#define TWI_XFER_QUEUED   1     // waiting in the transaction queue
+#define TWI_XFER_BUSY     2     // on the bus
+#define TWI_XFER_DONE     3     // completed, result is the byte count
+#define TWI_XFER_ERROR    4     // failed, result is a TWI_ERR_xxx code
+
+/*
+ * transaction flags
+ */
+#define TWI_XFER_PROBE    0x01  // fail on the first SLA NACK, no retries
+
+/*
+ * transaction result codes, same values the polled routines returned
+ */
+#define TWI_ERR_DATA           -1             // SLA or data phase error/timeout
+#define TWI_ERR_START_TIMEOUT  -2             // no START condition
+#define TWI_ERR_START          -3             // unexpected status after START
+#define TWI_ERR_BUSY           -4             // transaction already queued
+#define TWI_ERR_ROUTE          -5             // mux not registered
+#define TWI_ERR_QUARANTINE     -6             // routed device quarantined
+#define TWI_ERR_ARB            -7             // lost arbitration TWI_MAX_ARB times
+#define TWI_ERR_TIMEOUT        -8             // over its TWI_XFER_MAX_US budget
+#define TWI_ERR_NACK           -TWI_MAX_ITER  // slave never acknowledged
+
+/*
+ * latency of one device and phase.  A full bucket halves them all, so old
+ * samples fade.
+ */
+typedef struct
+{
+    uint8_t           hist[TWI_TMO_BUCKETS];
+    uint16_t          samples;      // saturates
+    uint16_t          timeouts;     // watchdog expiries
+    uint32_t          timeoutUs;    // learned or loaded timeout, 0 if none
+} twi_latency_t;
+
+/*
+ * per device bus profile, looked up by address when a transaction starts
+ */
+typedef struct
+{
+    uint8_t           addr;         // 7-bit device address
+    uint16_t          bitrate;      // TWI_BITRATE, 0 = use the bus rate
+    uint16_t          byteDelay_us; // inter-byte delay, 0 = paced by the bus
+    uint8_t           delayOcr;     // Timer2 compare value for the delay
+    uint8_t           delayCs;      // Timer2 clock select for the delay
+} twi_profile_t;
+
+/*
+ * a device behind a mux channel, or on the main bus if muxAddr is 0.  The
+ * mux may itself sit behind other muxes.  Before a transaction to the
+ * device the engine sets every mux on the path to the one channel leading
+ * on, and disables any other mux that would still share the segment,
+ * writing only the muxes not already set that way.
+ */
+typedef struct
+{
+    uint8_t           muxAddr;      // mux 7-bit address, 0 for none
+    uint8_t           channel;      // mux channel
+    uint8_t           addr;         // 7-bit device address
+} twi_dev_t;
+
+/*
+ * channel switch state, kept by the engine from every transaction to the
+ * mux address, and its place in the tree
+ */
+typedef struct
+{
+    uint8_t           addr;         // mux 7-bit address
+    uint8_t           parent;       // mux in front of this one, 0 for none
+    uint8_t           parentChannel;
+    uint8_t           cfg;          // control register, if valid
+    uint8_t           valid;        // cfg is known
+    uint16_t          switches;     // channel selects the engine inserted
+    uint16_t          hits;         // routed transactions that needed none
+} twi_mux_t;
+
+/*
+ * health of a routed device, one mux channel and address.  After
+ * TWI_QUARANTINE_FAILS failures in a row its transactions are refused at
+ * submit until the re-probe time; then one goes through, with no NACK
+ * retries, and the rest are refused until it is done.  Each failure
+ * doubles the delay.
+ */
+typedef struct
+{
+    uint8_t           muxAddr;
+    uint8_t           channel;
+    uint8_t           addr;
+    uint8_t           fails;        // consecutive failures
+    uint8_t           quarantined;
+    uint8_t           probing;      // the re-probe is queued or on the bus
+    int16_t           lastError;    // TWI_ERR_xxx of the last failure
+    uint32_t          failUs;       // how long the last failure took
+    uint32_t          retryAt;      // ms_time() of the next re-probe
+    uint16_t          backoff;      // current re-probe delay, msec
+    uint16_t          refused;      // transactions refused in quarantine
+} twi_health_t;
+
+/*
+ * bus recovery counters
+ */
+typedef struct
+{
+    uint16_t          count;        // recoveries run
+    uint16_t          failed;       // bus still held low afterwards
+    uint16_t          pulses;       // SCL pulses clocked out, all recoveries
+    uint32_t          lastUs;       // duration of the last recovery
+    uint32_t          maxUs;        // longest recovery
+} twi_recovery_t;
+
+typedef void (*twi_recover_hook_t)(void);
+
+typedef struct twi_xfer twi_xfer_t;
+typedef void (*twi_callback_t)(twi_xfer_t *xfer);
+
+/*
+ * TWI transaction descriptor.  A transaction is an optional write phase
+ * (header bytes followed by wrBuf) and an optional read phase joined by a
+ * repeated START.  The descriptor and its buffers must stay valid until the
+ * transaction completes.
+ */
+struct twi_xfer
+{
+    uint8_t           addr;         // 7-bit device address
+    uint8_t           muxAddr;      // mux in front of the device, 0 for none
+    uint8_t           muxChannel;   // mux channel
+    uint8_t           hdr[2];       // address pointer sent ahead of wrBuf
+    uint8_t           hdrLen;       // number of header bytes, 0 - 2
+    const uint8_t    *wrBuf;        // data to write
+    uint8_t           wrLen;        // number of bytes to write
+    uint8_t          *rdBuf;        // read data goes here
+    uint8_t           rdLen;        // number of bytes to read
+    twi_callback_t    callback;     // called from TWI_vect when done, or NULL
+    void             *context;      // caller data for the callback
+    uint8_t           flags;        // TWI_XFER_PROBE
+    volatile uint8_t  state;        // TWI_XFER_xxx
+    volatile int16_t  result;       // bytes transferred or TWI_ERR_xxx
+    volatile uint8_t  twst;         // last TWI status seen
+
+    // engine private
+    const twi_profile_t *profile;   // device profile or NULL
+    uint8_t           phase;        // write or read phase
+    uint8_t           idx;          // byte index in the current phase
+    uint8_t           count;        // bytes transferred
+    uint8_t           retries;      // SLA NACK restarts
+    uint8_t           arbLost;      // arbitration losses
+    twi_xfer_t       *next;         // queue link
+};
+
+#define twi_xfer_pending(x) ((x)->state == TWI_XFER_QUEUED || \
+                             (x)->state == TWI_XFER_BUSY)
+
+/*
+ * worst case times.  Every wait is bounded:
+ *
+ *   one bus phase (START, SLA, byte)     phase timeout, <= TWI_TIMEOUT_US
+ *   STOP                                 TWI_STOP_TIMEOUT_US, busy wait in
+ *                                        the interrupt
+ *   one transaction, channel selects     TWI_XFER_MAX_US plus bytes times
+ *   included                             the profile's inter-byte delay;
+ *                                        NACK restarts <= TWI_MAX_ITER and
+ *                                        arbitration losses <= TWI_MAX_ARB
+ *                                        fall inside it
+ *   twi_transfer() and the blocking      one transaction plus
+ *   read/write calls                     TWI_STOP_TIMEOUT_US for each one
+ *                                        queued ahead and itself
+ *   twi_submit(), twi_service()          no bus waits; twi_service() may
+ *                                        run one STOP and callbacks
+ *   twi_start(), twi_stop(), polled      TWI_TIMEOUT_US, TWI_STOP_TIMEOUT_US
+ */
 
 
 void    init_twi(void);
-int8_t  twi_stop();
-void    twi_error(const char * message, uint8_t cr, uint8_t status);
+int8_t  twi_stop(void);
+void    twi_error(uint8_t msg, uint8_t cr, uint8_t status);
 int8_t  twi_start(uint8_t expected_status);
+int8_t  twi_register_device(uint8_t twi_addr, uint32_t maxScl_hz, uint16_t byteDelay_us);
+uint16_t twi_calc_bitrate(uint32_t scl_hz);
+uint32_t twi_bitrate_hz(uint16_t bitrate);
+uint32_t twi_set_speed(uint32_t scl_hz);
+uint32_t twi_get_speed(void);
+void    twi_setup_xfer(twi_xfer_t *xfer, uint8_t twi_addr,
+                       const uint8_t *wrBuf, uint8_t wrLen,
+                       uint8_t *rdBuf, uint8_t rdLen);
+void    twi_setup_dev_xfer(twi_xfer_t *xfer, const twi_dev_t *dev,
+                           const uint8_t *wrBuf, uint8_t wrLen,
+                           uint8_t *rdBuf, uint8_t rdLen);
+int8_t  twi_register_mux(uint8_t muxAddr, uint8_t parentAddr, uint8_t parentChannel);
+void    twi_clear_muxes(void);
+int8_t  twi_mux_cached(uint8_t muxAddr, uint8_t *cfg);
+void    twi_mux_invalidate(uint8_t muxAddr);
+int8_t  twi_mux_info(uint8_t muxAddr, twi_mux_t *info);
+int8_t  twi_health_get(uint8_t index, twi_health_t *health);
+int8_t  twi_latency_get(uint8_t index, uint8_t *addr, twi_latency_t *lat);
+uint32_t twi_latency_p99(const twi_latency_t *lat);
+uint32_t twi_latency_timeout(const twi_latency_t *lat);
+void    twi_timeouts_reset(void);
+int8_t  twi_timeouts_save(void);
+int8_t  twi_timeouts_load(void);
+int8_t  twi_bus_recover(void);
+void    twi_set_recover_hook(twi_recover_hook_t hook);
+void    twi_recovery_stats(twi_recovery_t *stats, uint8_t clear);
+void    twi_health_clear(void);
+int8_t  twi_submit(twi_xfer_t *xfer);
+int     twi_transfer(twi_xfer_t *xfer);
+uint8_t twi_busy(void);
+void    twi_service(void);
 int     twi_write_bytes(uint8_t twi_addr, int len, uint8_t *buf);
 int 	twi_write_bytes_with_WP(uint8_t twi_addr, int16_t writePointer,  int len, uint8_t *buf);
 int     twi_read_bytes(uint8_t twi_addr, int len, uint8_t *buf);
 int     twi_read_bytes_wP(uint8_t twi_addr, uint8_t data_addr, int len, uint8_t *buff);
 int     twi_read_bytes_wP2(uint8_t twi_addr, uint16_t write_pointer_addr, int len, uint8_t *buf);
-void    parseI2C_commands(char *cmd);
 
 
 #endif
@@ -0,0 +1,1000 @@
+/*******************************************************************************
+*   File Name: uart.c
+*  
+* Description: USART0 console driver.  Receive is interrupt driven into a
+*              ring buffer; transmit is queued in a ring buffer that is
+*              drained by the data register empty interrupt, so cprintf only
+*              blocks when the ring is full (and then only if the policy says
+*              so).  Optional XON/XOFF or RTS/CTS flow control keeps a host
+*              that streams commands from overflowing the receive ring.
+*******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <inttypes.h>
+#include "main.h"
+#include "uart.h"
+#include "timers.h"
+#include "serialPortCmd.h"
+#include "console.h"
+
+
+// serial port input ring buffer
+static uint8_t           rxBuf[UART_RX_BUFFER_SIZE];
+static volatile uint8_t  rxHead;         // next insert point, ISR only
+static volatile uint8_t  rxTail;         // next byte to read
+static volatile uart_rx_stats_t rxStats; // receive error counters
+
+// serial port output ring buffer
+static uint8_t           txBuf[UART_TX_BUFFER_SIZE];
+static volatile uint8_t  txHead;         // next insert point, producer only
+static volatile uint8_t  txTail;         // next byte to send
+static volatile uint16_t txDropped;      // characters lost to DROP/OVERWRITE
+static uint8_t           txPolicy;       // UART_TX_xxx when the ring is full
+static volatile uint8_t  txStarted;      // a character has been sent
+
+static uint32_t          uartBaud;       // current baud rate
+static uint8_t           rxEcho;         // echo received characters
+
+// baud rate change waiting for the host, see negotiateBaud()
+static sw_timer_t        baudTimer;      // confirm window
+static uint32_t          baudOld;        // rate to go back to
+static uint32_t          baudNew;        // rate being confirmed
+static int16_t           baudErr;        // error of the new rate, 0.1 %
+static char              baudReply[4];   // host reply so far
+static uint8_t           baudLen;
+
+static void baudConfirmTimeout(sw_timer_t *timer);
+
+// flow control
+static uint8_t           flowMode;       // UART_FLOW_xxx
+static volatile uint8_t  rxThrottled;    // host has been told to stop
+static volatile uint8_t  txFlowChar;     // XON/XOFF to send next, 0 = none
+static volatile uint8_t  txPaused;       // host sent XOFF
+
+
+/******************************************************************************
+*                                SEND TX BYTE                                 *
+*******************************************************************************
+* Description: Write a character to UDR0.  Call only when UDRE0 is set and
+*              interrupts are off.
+*
+*      Global: txStarted
+******************************************************************************/
+static inline void uart_send_byte(uint8_t data)
+{
+    UDR0 = data;
+
+    // clear TXC0 so uart_flush() can see the last character go out
+    UCSR0A    = (UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | _BV(TXC0);
+    txStarted = 1;
+}
+
+
+/******************************************************************************
+*                              SEND NEXT TX BYTE                              *
+*******************************************************************************
+* Description: Move the oldest queued character to UDR0.  Call only when
+*              UDRE0 is set, the queue is not empty and interrupts are off.
+*
+*      Global: txBuf, txTail
+******************************************************************************/
+static inline void uart_send_next(void)
+{
+    uart_send_byte(txBuf[txTail & UART_TX_BUFFER_MASK]);
+    txTail++;
+}
+
+
+/******************************************************************************
+*                               HOST CAN RECEIVE                              *
+*******************************************************************************
+* Description: Flow control check before sending queued data.  XON/XOFF
+*              characters we send ourselves are not subject to it.
+*
+*      Return: 1 if the host is accepting data
+******************************************************************************/
+static inline uint8_t uart_tx_ready(void)
+{
+    if(txPaused)
+    {
+        return 0;
+    }
+    if(flowMode == UART_FLOW_RTSCTS && (UART_RTS_PIN & _BV(UART_RTS)))
+    {
+        return 0;
+    }
+    return 1;
+}
+
+
+/******************************************************************************
+*                              THROTTLE THE HOST                              *
+*******************************************************************************
+* Description: Tell the host to stop (stop = 1) or resume (stop = 0) sending.
+*              Call with interrupts off.
+*
+*      Global: rxThrottled, txFlowChar
+******************************************************************************/
+static void uart_rx_throttle(uint8_t stop)
+{
+    rxThrottled = stop;
+
+    if(flowMode == UART_FLOW_XONXOFF)
+    {
+        // goes out ahead of anything queued, see the UDRE ISR
+        txFlowChar = stop ? UART_XOFF : UART_XON;
+        UCSR0B    |= _BV(UDRIE0);
+    }
+    else if(flowMode == UART_FLOW_RTSCTS)
+    {
+        if(stop)
+        {
+            UART_CTS_PORT |= _BV(UART_CTS);
+        }
+        else
+        {
+            UART_CTS_PORT &= ~_BV(UART_CTS);
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+////////////////////////////// INTERRUPT HANDLERS /////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+/******************************************************************************
+*                               USART0 RXC ISR                                *
+*******************************************************************************
+* Description: UART 0 receive complete interrupt service routine.  The echo
+*              goes through the transmit queue; it is dropped rather than
+*              blocking if the queue is full.  A character that does not fit
+*              in the receive ring is counted and discarded, unread data is
+*              never overwritten.
+*
+*      Global: rxBuf[UART_RX_BUFFER_SIZE] - receive ring buffer
+*              rxStats                    - receive error counters
+******************************************************************************/
+ISR(USART0_RX_vect)
+{
+    uint8_t status = UCSR0A;        // error flags are only valid before UDR0
+    uint8_t data   = UDR0;
+    uint8_t used;
+    uint8_t policy;
+
+    if(status & _BV(DOR0))
+    {
+        rxStats.overrun++;
+    }
+    if(status & _BV(FE0))
+    {
+        rxStats.framing++;
+    }
+
+    if(flowMode == UART_FLOW_XONXOFF && (data == UART_XON || data == UART_XOFF))
+    {
+        txPaused = (data == UART_XOFF);
+        if(!txPaused)
+        {
+            UCSR0B |= _BV(UDRIE0);
+        }
+        return;
+    }
+
+    used = rxHead - rxTail;
+    if(used >= UART_RX_BUFFER_SIZE)
+    {
+        rxStats.overflow++;
+        return;
+    }
+
+    // echo the received character back, a backspace also blanks the
+    // character it takes back
+    if(rxEcho)
+    {
+        policy = (txPolicy == UART_TX_BLOCK) ? UART_TX_DROP : txPolicy;
+        if(data == CMD_BACKSPACE || data == CMD_DELETE)
+        {
+            uart_tx_queue('\b', policy);
+            uart_tx_queue(' ', policy);
+            uart_tx_queue('\b', policy);
+        }
+        else
+        {
+            uart_tx_queue(data, policy);
+        }
+    }
+
+    rxBuf[rxHead & UART_RX_BUFFER_MASK] = data;
+    rxHead++;
+
+    if(!rxThrottled && used + 1 > UART_RX_BUFFER_SIZE - UART_RX_STOP_FREE)
+    {
+        uart_rx_throttle(1);
+    }
+}
+
+
+/******************************************************************************
+*                               USART0 UDRE ISR                               *
+*******************************************************************************
+* Description: UART 0 data register empty interrupt.  Sends a pending
+*              XON/XOFF first, then the next queued character.  Disables
+*              itself when the queue is empty or the host has stopped us;
+*              uart_service() turns it back on.
+*
+*      Global: txBuf, txHead, txTail, txFlowChar
+******************************************************************************/
+ISR(USART0_UDRE_vect)
+{
+    if(txFlowChar)
+    {
+        uart_send_byte(txFlowChar);
+        txFlowChar = 0;
+    }
+    else if(txHead != txTail && uart_tx_ready())
+    {
+        uart_send_next();
+    }
+
+    if(!txFlowChar && (txHead == txTail || !uart_tx_ready()))
+    {
+        UCSR0B &= ~_BV(UDRIE0);
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+//////////////////////////// PUBLIC MEMBER FUNCTIONS //////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+/******************************************************************************
+*                              INITIALIZE UART                                *
+*******************************************************************************
+* Description: Initialize USART0: UART_BAUD, 8, N, 1 with no flow control.
+*              The handshake lines are set up so uart_set_flow() can turn
+*              RTS/CTS on later: UART_CTS (PB4) is driven low (asserted) and
+*              UART_RTS (PE2) is an input with pull-up.
+
+*              UBRR0L - USART0 baud rate register low
+*              UBRR0H - USART0 baud rate register high
+*              UCSR0A - USART0 control and status register A. p188
+*              UCSR0B - USART0 control and status register B, p189
+*              UCSR0C - USART0 control and status register C
+*              DDRE   - Data Direction Register Port E
+*
+*              Processor Parameters:
+*              clock - 16MHz
+*              RXD0/(PDI)  - PE0 - Pen  2
+*              TXD0/(PDO)  - PE1 - Pen  3 - 
+*              XCK0/(AIN0) - PE2 - Pen  4
+*              OC0         - PB4 - Pen 14
+*
+*   Arguments: None
+*
+*      Return: None
+******************************************************************************/
+void init_usart0(void)
+{
+    rxHead        = 0;
+    rxTail        = 0;
+    rxStats.overflow = 0;
+    rxStats.overrun  = 0;
+    rxStats.framing  = 0;
+    flowMode      = UART_FLOW_NONE;
+    rxEcho        = 1;
+    rxThrottled   = 0;
+    txFlowChar    = 0;
+    txPaused      = 0;
+    txHead        = 0;
+    txTail        = 0;
+    txDropped     = 0;
+    txStarted     = 0;
+    txPolicy      = UART_TX_POLICY_DEFAULT;
+
+    // Initialize the baud rate registers, constants checked in uart.h
+    UBRR0H = UART_UBRR(UART_BAUD) >> 8; 
+    UBRR0L = UART_UBRR(UART_BAUD) &  0xFF;
+    UCSR0A = UART_USE_U2X(UART_BAUD) ? _BV(U2X0) : 0;
+    uartBaud = UART_BAUD;
+    
+    // Enable the receiver, transmitter, and receive complete interrupt.
+    // The data register empty interrupt is enabled while there is data
+    // queued.
+    UCSR0B = (1 << RXEN0)  | (1 << TXEN0) | (1 << RXCIE0);
+     
+    // Set the USART data size to 8b, no parity, one stop bit
+    UCSR0C = (1 << UCSZ00) | (1 << UCSZ01);
+    
+    // Set the TX line (PE1) to be an output.      
+    DDRE  |= (1 << 1);                      
+
+    // handshake lines
+    UART_CTS_PORT &= ~_BV(UART_CTS);
+    UART_CTS_DDR  |=  _BV(UART_CTS);
+    UART_RTS_DDR  &= ~_BV(UART_RTS);
+    UART_RTS_PORT |=  _BV(UART_RTS);
+}
+
+
+/******************************************************************************
+*                              SET FLOW CONTROL                               *
+*******************************************************************************
+* Description: Select the flow control mode.  Throttle state is reset, the
+*              host is told it may send.
+*
+*   Arguments: mode - UART_FLOW_NONE, UART_FLOW_XONXOFF or UART_FLOW_RTSCTS
+*
+*      Return: None
+******************************************************************************/
+void uart_set_flow(uint8_t mode)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        flowMode   = mode;
+        txPaused   = 0;
+        txFlowChar = 0;
+        uart_rx_throttle(0);
+        UART_CTS_PORT &= ~_BV(UART_CTS);
+        if(txHead != txTail)
+        {
+            UCSR0B |= _BV(UDRIE0);
+        }
+    }
+}
+
+
+/******************************************************************************
+*                                 SET ECHO                                    *
+*******************************************************************************
+* Description: Turn the echo of received characters on or off.  The echo is
+*              for the text console and is turned off for binary protocols.
+*
+*   Arguments: on - non zero to echo
+*
+*      Return: None
+******************************************************************************/
+void uart_set_echo(uint8_t on)
+{
+    rxEcho = on;
+}
+
+
+/******************************************************************************
+*                              GET FLOW CONTROL                               *
+*******************************************************************************
+* Description: Current flow control mode
+*
+*   Arguments: None
+*
+*      Return: UART_FLOW_xxx
+******************************************************************************/
+uint8_t uart_get_flow(void)
+{
+    return flowMode;
+}
+
+
+/******************************************************************************
+*                                UART SERVICE                                 *
+*******************************************************************************
+* Description: Restart transmission once the host raises RTS again.  PE2 has
+*              no pin change interrupt so the main loop polls it; with XON/
+*              XOFF the receive ISR restarts transmission itself.
+*
+*   Arguments: None
+*
+*      Return: None
+******************************************************************************/
+void uart_service(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if(txHead != txTail && uart_tx_ready())
+        {
+            UCSR0B |= _BV(UDRIE0);
+        }
+    }
+}
+
+
+/******************************************************************************
+*                            CALCULATE BAUD RATE                              *
+*******************************************************************************
+* Description: Runtime version of the UART_UBRR macros.  Picks double speed
+*              mode when it gives the smaller error, or when the normal mode
+*              divisor does not fit in UBRR0.
+*
+*   Arguments: baud - baud rate
+*              ubrr - UBRR0 value goes here
+*              u2x  - UCSR0A value goes here
+*
+*      Return: baud rate error in 0.1 % units, -1 if the error is above
+*              UART_MAX_ERR
+******************************************************************************/
+static int16_t uart_calc_baud(uint32_t baud, uint16_t *ubrr, uint8_t *u2x)
+{
+    uint32_t ubrr16, ubrr8;
+    uint32_t err16,  err8;
+    uint8_t  dbl;
+
+    if(baud == 0 || baud > F_CPU / 8)
+    {
+        return -1;
+    }
+
+    ubrr16 = (F_CPU + 8UL * baud) / (16UL * baud) - 1;
+    ubrr8  = (F_CPU + 4UL * baud) / (8UL * baud) - 1;
+    err16  = UART_ABSDIFF(F_CPU / (16UL * (ubrr16 + 1)), baud) * 1000UL / baud;
+    err8   = UART_ABSDIFF(F_CPU / (8UL * (ubrr8 + 1)), baud) * 1000UL / baud;
+
+    dbl = (err8 < err16) || (ubrr16 > 4095);
+    if(dbl ? (err8 > UART_MAX_ERR || ubrr8 > 4095) : (err16 > UART_MAX_ERR))
+    {
+        return -1;
+    }
+
+    *ubrr = dbl ? ubrr8 : ubrr16;
+    *u2x  = dbl ? _BV(U2X0) : 0;
+    return dbl ? err8 : err16;
+}
+
+
+/******************************************************************************
+*                               SET BAUD RATE                                 *
+*******************************************************************************
+* Description: Waits for pending output to go out at the old rate, then
+*              reprograms the baud rate generator.
+*
+*   Arguments: baud - new baud rate
+*
+*      Return: baud rate error in 0.1 % units, -1 if the rate is not
+*              supported (the rate is not changed)
+******************************************************************************/
+int16_t uart_set_baud(uint32_t baud)
+{
+    uint16_t ubrr;
+    uint8_t  u2x;
+    int16_t  err;
+
+    err = uart_calc_baud(baud, &ubrr, &u2x);
+    if(err < 0)
+    {
+        return err;
+    }
+
+    uart_flush();
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        UBRR0H   = ubrr >> 8;
+        UBRR0L   = ubrr & 0xFF;
+        UCSR0A   = u2x;
+        uartBaud = baud;
+    }
+    return err;
+}
+
+
+/******************************************************************************
+*                               GET BAUD RATE                                 *
+*******************************************************************************
+* Description: Current baud rate
+*
+*   Arguments: None
+*
+*      Return: baud rate
+******************************************************************************/
+uint32_t uart_get_baud(void)
+{
+    return uartBaud;
+}
+
+
+/******************************************************************************
+*                             QUEUE TX CHARACTER                              *
+*******************************************************************************
+* Description: Queue one character for transmission.  If the ring is full the
+*              policy decides: BLOCK waits for the UDRE interrupt to make
+*              room (or sends a character itself if interrupts are off),
+*              DROP discards the new character and OVERWRITE discards the
+*              oldest one.  Only DROP and OVERWRITE may be used from an ISR.
+*              With interrupts off BLOCK sends directly while flow control
+*              allows and drops the character once the host holds off.
+*
+*   Arguments: data   - character to send
+*              policy - UART_TX_xxx
+*
+*      Return: 1 if the character was queued, 0 if it was dropped
+******************************************************************************/
+uint8_t uart_tx_queue(uint8_t data, uint8_t policy)
+{
+    uint8_t queued = 0;
+    uint8_t done   = 0;
+    uint8_t irqOn  = SREG & _BV(SREG_I);   // the caller's state, not ours
+
+    while(!done)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if((uint8_t)(txHead - txTail) >= UART_TX_BUFFER_SIZE)
+            {
+                if(policy == UART_TX_OVERWRITE)
+                {
+                    txTail++;
+                    txDropped++;
+                }
+                else if(policy == UART_TX_DROP)
+                {
+                    txDropped++;
+                    done = 1;
+                }
+                else if(!irqOn)
+                {
+                    // interrupts are off so the ISR cannot drain the ring
+                    // and no XON can arrive: send from here while the host
+                    // accepts data, drop rather than hang once it does not
+                    if(!uart_tx_ready())
+                    {
+                        txDropped++;
+                        done = 1;
+                    }
+                    else if(UCSR0A & _BV(UDRE0))
+                    {
+                        uart_send_next();
+                    }
+                }
+                else if(uart_tx_ready())
+                {
+                    // a stopped ring was restarted by the host
+                    UCSR0B |= _BV(UDRIE0);
+                }
+            }
+
+            if(!done && (uint8_t)(txHead - txTail) < UART_TX_BUFFER_SIZE)
+            {
+                txBuf[txHead & UART_TX_BUFFER_MASK] = data;
+                txHead++;
+                UCSR0B |= _BV(UDRIE0);
+                queued = 1;
+                done   = 1;
+            }
+        }
+    }
+    return queued;
+}
+
+
+/******************************************************************************
+*                               TRANSMIT UART                                 *
+*******************************************************************************
+* Description: Queue a single byte for transmit on USART0 using the current
+*              buffer full policy.
+*
+*   Arguments: data - data to transmit
+*
+*      Return: None
+******************************************************************************/
+void transmit_usart0(uint8_t data)
+{   
+    uart_tx_queue(data, txPolicy);
+}
+
+
+/******************************************************************************
+*                             SET TX FULL POLICY                              *
+*******************************************************************************
+* Description: Select what happens when the transmit ring is full
+*
+*   Arguments: policy - UART_TX_BLOCK, UART_TX_DROP or UART_TX_OVERWRITE
+*
+*      Return: None
+******************************************************************************/
+void uart_set_tx_policy(uint8_t policy)
+{
+    txPolicy = policy;
+}
+
+
+/******************************************************************************
+*                                TX FREE SPACE                                *
+*******************************************************************************
+* Description: Number of characters that can be queued without hitting the
+*              buffer full policy
+*
+*   Arguments: None
+*
+*      Return: free space in the transmit ring
+******************************************************************************/
+uint8_t uart_tx_free(void)
+{
+    return UART_TX_BUFFER_SIZE - (uint8_t)(txHead - txTail);
+}
+
+
+/******************************************************************************
+*                              TX DROPPED COUNT                               *
+*******************************************************************************
+* Description: Characters discarded by the DROP and OVERWRITE policies
+*
+*   Arguments: None
+*
+*      Return: dropped character count
+******************************************************************************/
+uint16_t uart_tx_dropped(void)
+{
+    uint16_t count;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        count = txDropped;
+    }
+    return count;
+}
+
+
+/******************************************************************************
+*                              UART HAS RX DATA                               *
+*******************************************************************************
+* Description: Checks the USART0 Rx complete status flag 
+*
+*   Arguments: None
+*
+*      Return: true if there is RX data in the buffer
+******************************************************************************/
+uint8_t usart0_has_rx_data(void)
+{
+    return (UCSR0A & (1 << RXC0)) != 0;
+}
+
+
+/******************************************************************************
+*                               RECEIVE UART                                  *
+*******************************************************************************
+* Description: Reads data from the USART receive buffer 
+*              UDR0 - UART0 Data Register
+*
+*   Arguments: None
+*
+*      Return: character received (8bits)
+******************************************************************************/
+uint8_t receive_usart0(void)
+{
+    uint8_t ret_val = UDR0; // Read data register
+    return ret_val;         // Return read value
+}
+
+
+/******************************************************************************
+*                            UART PUT CHARACTER                               *
+*******************************************************************************
+* Description: Implementation of putc for a stdio stream on UART0.  The
+*              console uses cprintf (console.c) instead.
+*
+*   Arguments: c      - char to send to UART0
+*              stream - 
+*
+*      Return: 0
+******************************************************************************/
+int UartPutChar(char c, FILE* stream) 
+{
+    uart_tx_queue(c, txPolicy);
+    return 0;
+}
+
+
+/******************************************************************************
+*                            UART GET CHARACTER                               *
+*******************************************************************************
+* Description: Implementation of getc for a stdio stream on UART0.
+*
+*   Arguments: stream -
+*
+*      Return: character read from UART0
+******************************************************************************/
+int UartGetChar(FILE* stream) 
+{
+    char c;
+    while(!(UCSR0A & (1 << RXC0)));
+    c = UDR0;
+    return c;
+}
+
+
+/******************************************************************************
+*                              GET RX CHARACTER                               *
+*******************************************************************************
+* Description: Take the next character out of the receive buffer and
+*              release the host once the buffer has drained.
+*
+*      Global: rxBuf[UART_RX_BUFFER_SIZE] - receive ring buffer
+*              rxTail                     - data extraction point
+*              rxHead                     - next insert point
+*
+*   Arguments: data - received character goes here
+*
+*      Return: 1 if a character was read, 0 if the buffer is empty
+******************************************************************************/
+uint8_t uart_rx_get(uint8_t *data)
+{
+    if(rxHead == rxTail)
+    {
+        return 0;
+    }
+
+    *data = rxBuf[rxTail & UART_RX_BUFFER_MASK];
+    rxTail++;
+
+    if(rxThrottled && (uint8_t)(rxHead - rxTail) <= UART_RX_START_FILL)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            uart_rx_throttle(0);
+        }
+    }
+    return 1;
+}
+
+
+/******************************************************************************
+*                              CLEAR RX BUFFER                                *
+*******************************************************************************
+* Description: Discard everything in the receive buffer
+*
+*   Arguments: None
+*
+*      Return: None
+******************************************************************************/
+void uart_rx_clear(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        rxTail = rxHead;
+        if(rxThrottled)
+        {
+            uart_rx_throttle(0);
+        }
+    }
+}
+
+
+/******************************************************************************
+*                              RX ERROR COUNTS                                *
+*******************************************************************************
+* Description: Copy the receive error counters
+*
+*   Arguments: stats - counters go here
+*              clear - non zero to reset the counters
+*
+*      Return: None
+******************************************************************************/
+void uart_rx_stats(uart_rx_stats_t *stats, uint8_t clear)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        stats->overflow = rxStats.overflow;
+        stats->overrun  = rxStats.overrun;
+        stats->framing  = rxStats.framing;
+        if(clear)
+        {
+            rxStats.overflow = 0;
+            rxStats.overrun  = 0;
+            rxStats.framing  = 0;
+        }
+    }
+}
+
+
+/******************************************************************************
+*                                 FLUSH UART                                  *
+*******************************************************************************
+* Description: Wait until every queued character, including the one in the
+*              shift register, has been sent.  Gives up if nothing leaves
+*              the ring for UART_FLUSH_STALL_MS, e.g. a host that sent XOFF
+*              or dropped RTS and went away.  Must be called with
+*              interrupts enabled.
+*
+*   Arguments: None
+*
+*      Return: None
+******************************************************************************/
+void uart_flush(void)
+{
+    uint8_t  tail  = txTail;
+    uint32_t limit = timer_deadline(UART_FLUSH_STALL_MS * 1000UL);
+
+    while(txHead != txTail)
+    {
+        uart_service();
+        if(txTail != tail)
+        {
+            tail  = txTail;
+            limit = timer_deadline(UART_FLUSH_STALL_MS * 1000UL);
+        }
+        else if(timer_expired(limit))
+        {
+            return;
+        }
+    }
+
+    // TXC0 is cleared on every write to UDR0 and set when the shift
+    // register empties, but it is never set if nothing has been sent
+    if(txStarted)
+    {
+        while(!(UCSR0A & _BV(TXC0)) && !timer_expired(limit))
+        ;
+    }
+}
+
+
+/******************************************************************************
+*                           NEGOTIATE BAUD RATE                               *
+*******************************************************************************
+* Description: Switch the console to a new baud rate without a power cycle.
+*              The host is told the new rate at the old rate, the rate is
+*              switched, and the host must then send "ok" followed by a
+*              carriage return at the new rate within UART_BAUD_CONFIRM_MS.
+*              Otherwise baudConfirmTimeout() restores the old rate so a
+*              host that could not follow is not locked out.  The main loop
+*              keeps running meanwhile; received characters go to
+*              uart_baud_rx() until the rate is confirmed or restored.
+*
+*      Global: baudTimer, baudOld, baudNew, baudErr, baudLen
+*
+*   Arguments: baud - requested baud rate
+*
+*      Return: 0 if the switch was started, -1 if the rate is not supported
+******************************************************************************/
+static int8_t negotiateBaud(uint32_t baud)
+{
+    uint16_t ubrr;
+    uint8_t  u2x;
+
+    // check the rate before announcing it
+    if(uart_calc_baud(baud, &ubrr, &u2x) < 0)
+    {
+        cprintf("ERROR - baud rate %lu not supported\r\n", baud);
+        return -1;
+    }
+
+    cprintf("switching to %lu baud, send ok to confirm\r\n", baud);
+    baudOld = uartBaud;
+    baudNew = baud;
+    baudErr = uart_set_baud(baud);
+    baudLen = 0;
+    uart_rx_clear();
+
+    swtimer_start(&baudTimer, UART_BAUD_CONFIRM_MS, 0, baudConfirmTimeout, NULL);
+    return 0;
+}
+
+
+/******************************************************************************
+*                          BAUD CONFIRM TIMEOUT                               *
+*******************************************************************************
+* Description: The host did not confirm a new baud rate in time, go back to
+*              the old one.
+*
+*      Global: baudOld
+*
+*   Arguments: timer - baud confirm timer
+*
+*      Return: None
+******************************************************************************/
+static void baudConfirmTimeout(sw_timer_t *timer)
+{
+    uart_set_baud(baudOld);
+    uart_rx_clear();
+    cprintf("\r\nbaud rate not confirmed, staying at %lu\r\n", baudOld);
+}
+
+
+/******************************************************************************
+*                          BAUD CONFIRM PENDING                               *
+*******************************************************************************
+* Description: A baud rate change is waiting for the host to confirm it
+*
+*      Return: 1 while uart_baud_rx() should get the received characters
+******************************************************************************/
+uint8_t uart_baud_pending(void)
+{
+    return swtimer_active(&baudTimer);
+}
+
+
+/******************************************************************************
+*                          BAUD CONFIRM RECEIVE                               *
+*******************************************************************************
+* Description: Collect the host's reply to a baud rate change.  "ok" and a
+*              carriage return confirm the new rate, anything else is
+*              ignored until the confirm timer runs out.
+*
+*      Global: baudReply, baudLen
+*
+*   Arguments: data - received character
+*
+*      Return: None
+******************************************************************************/
+void uart_baud_rx(uint8_t data)
+{
+    if(data == '\r')
+    {
+        baudReply[baudLen] = '\0';
+        if(strcmp_P(baudReply, PSTR("ok")) == STRINGS_MATCH)
+        {
+            swtimer_stop(&baudTimer);
+            cprintf("\r\nbaud = %lu, error = %d.%d%%\r\n", baudNew,
+                   baudErr / 10, baudErr % 10);
+        }
+        baudLen = 0;
+    }
+    else if(baudLen < sizeof(baudReply) - 1)
+    {
+        baudReply[baudLen++] = data;
+    }
+}
+
+
+/******************************************************************************
+*                             UART SERIAL COMMANDS                            *
+*******************************************************************************
+* Description: UART serial port commands, see serialPortCmd.c
+*
+*      Global: uartBaud, flowMode
+*
+*   Arguments: args - parsed arguments
+*
+*      Return: None
+******************************************************************************/
+void cmdUartBaud(cmd_args_t *args)
+{
+    if(args->argc == 0)
+    {
+        cprintf("  baud = %lu\r\n", uartBaud);
+    }
+    else
+    {
+        negotiateBaud(args->val[0]);
+    }
+}
+
+void cmdUartFlow(cmd_args_t *args)
+{
+    if(args->argc == 0)
+    {
+        // display only
+    }
+    else if(strcmp_P(args->argv[0], PSTR("none")) == STRINGS_MATCH)
+    {
+        uart_set_flow(UART_FLOW_NONE);
+    }
+    else if(strcmp_P(args->argv[0], PSTR("xon")) == STRINGS_MATCH)
+    {
+        uart_set_flow(UART_FLOW_XONXOFF);
+    }
+    else if(strcmp_P(args->argv[0], PSTR("rts")) == STRINGS_MATCH)
+    {
+        uart_set_flow(UART_FLOW_RTSCTS);
+    }
+    else
+    {
+        cprintf("ERROR - unknown flow control = %s\r\n", args->argv[0]);
+    }
+
+    cprintf("  flow = %S\r\n", (flowMode == UART_FLOW_XONXOFF) ? PSTR("xon") :
+                               (flowMode == UART_FLOW_RTSCTS)  ? PSTR("rts") : PSTR("none"));
+}
+
+void cmdUartStats(cmd_args_t *args)
+{
+    uart_rx_stats_t stats;
+
+    uart_rx_stats(&stats, args->argc > 0 && strcmp_P(args->argv[0], PSTR("clear")) == STRINGS_MATCH);
+    cprintf("  rx overflow = %u, overrun = %u, framing = %u\r\n",
+           stats.overflow, stats.overrun, stats.framing);
+    cprintf("  tx dropped  = %u\r\n", uart_tx_dropped());
+}
@@ -0,0 +1,136 @@
+/*******************************************************************************
+*   File Name: uart.h
+*  
+* Description: Data and definitions for uart.c
+*******************************************************************************/
+#ifndef __UART_H__
+#define __UART_H__
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "main.h"
+#include "serialPortCmd.h"
+
+/*
+ * transmit ring buffer, indices are free running uint8_t so the size must be
+ * a power of two no larger than 128
+ */
+#define UART_TX_BUFFER_SIZE     128
+#define UART_TX_BUFFER_MASK     (UART_TX_BUFFER_SIZE - 1)
+
+#if (UART_TX_BUFFER_SIZE & UART_TX_BUFFER_MASK) || (UART_TX_BUFFER_SIZE > 128)
+#error UART_TX_BUFFER_SIZE must be a power of two no larger than 128
+#endif
+
+/*
+ * receive ring buffer, same rules as the transmit ring.  With flow control
+ * on, the host is throttled when fewer than UART_RX_STOP_FREE bytes are free
+ * and released when the fill drops to UART_RX_START_FILL.  The stop margin
+ * has to cover what the host sends after it has been told to stop: a couple
+ * of characters for RTS/CTS, and for XON/XOFF the host's own transmit FIFO
+ * (16 bytes on a 16550 or an FTDI part).
+ */
+#define UART_RX_BUFFER_SIZE     64
+#define UART_RX_BUFFER_MASK     (UART_RX_BUFFER_SIZE - 1)
+#define UART_RX_STOP_FREE       24
+#define UART_RX_START_FILL      16
+
+#if (UART_RX_BUFFER_SIZE & UART_RX_BUFFER_MASK) || (UART_RX_BUFFER_SIZE > 128)
+#error UART_RX_BUFFER_SIZE must be a power of two no larger than 128
+#endif
+
+/*
+ * flow control
+ */
+#define UART_FLOW_NONE          0
+#define UART_FLOW_XONXOFF       1   // software, XON/XOFF in band
+#define UART_FLOW_RTSCTS        2   // hardware, see Ports.h
+
+#define UART_XON                0x11
+#define UART_XOFF               0x13
+
+// hardware handshake lines, active low, named as in Ports.h
+#define UART_CTS_PORT           PORTB       // out: low = host may send
+#define UART_CTS_DDR            DDRB
+#define UART_CTS                PB4
+#define UART_RTS_PIN            PINE        // in: low = host can receive
+#define UART_RTS_PORT           PORTE
+#define UART_RTS_DDR            DDRE
+#define UART_RTS                PE2
+
+/*
+ * receive error counters
+ */
+typedef struct
+{
+    uint16_t          overflow;     // characters lost, receive ring full
+    uint16_t          overrun;      // characters lost in hardware (DOR0)
+    uint16_t          framing;      // framing errors (FE0)
+} uart_rx_stats_t;
+
+/*
+ * what to do when the transmit buffer is full
+ */
+#define UART_TX_BLOCK           0   // wait for room
+#define UART_TX_DROP            1   // discard the new character
+#define UART_TX_OVERWRITE       2   // discard the oldest queued character
+
+#define UART_TX_POLICY_DEFAULT  UART_TX_BLOCK
+
+/*
+ * baud rate generator.  UBRR is rounded to nearest for normal (16x) and
+ * double speed (U2X0, 8x) mode; double speed is used only when it gives a
+ * smaller error.  Errors are in 0.1 % units.  The datasheet recommends 2.0 %
+ * for 8N1; 115200 at 16 MHz is 2.1 % with U2X0, which is the usual practice,
+ * so the limit is 2.5 %.
+ *
+ * Rates that are exact at 16 MHz: 250000, 500000 and 1000000.
+ */
+#define UART_MAX_ERR            25
+#define UART_BAUD_CONFIRM_MS    5000    // host must confirm a new rate in time
+#define UART_FLUSH_STALL_MS     100     // uart_flush() gives up on a stalled host
+
+#define UART_UBRR_X16(baud)     ((F_CPU + 8UL * (baud)) / (16UL * (baud)) - 1)
+#define UART_UBRR_X8(baud)      ((F_CPU + 4UL * (baud)) / (8UL * (baud)) - 1)
+#define UART_ACTUAL_X16(baud)   (F_CPU / (16UL * (UART_UBRR_X16(baud) + 1)))
+#define UART_ACTUAL_X8(baud)    (F_CPU / (8UL * (UART_UBRR_X8(baud) + 1)))
+#define UART_ABSDIFF(a, b)      (((a) > (b)) ? ((a) - (b)) : ((b) - (a)))
+#define UART_ERR_X16(baud)      (UART_ABSDIFF(UART_ACTUAL_X16(baud), (baud)) * 1000UL / (baud))
+#define UART_ERR_X8(baud)       (UART_ABSDIFF(UART_ACTUAL_X8(baud), (baud)) * 1000UL / (baud))
+#define UART_USE_U2X(baud)      (UART_ERR_X8(baud) < UART_ERR_X16(baud))
+#define UART_UBRR(baud)         (UART_USE_U2X(baud) ? UART_UBRR_X8(baud) : UART_UBRR_X16(baud))
+#define UART_ERR(baud)          (UART_USE_U2X(baud) ? UART_ERR_X8(baud) : UART_ERR_X16(baud))
+
+#if UART_ERR(UART_BAUD) > UART_MAX_ERR
+#error UART_BAUD error is too large for F_CPU
+#endif
+
+
+// global functions
+void     init_usart0(void);
+int16_t  uart_set_baud(uint32_t baud);
+uint32_t uart_get_baud(void);
+void     uart_rx_clear(void);
+void     uart_rx_stats(uart_rx_stats_t *stats, uint8_t clear);
+void     uart_set_flow(uint8_t mode);
+uint8_t  uart_get_flow(void);
+void     uart_set_echo(uint8_t on);
+void     uart_service(void);
+uint8_t  uart_baud_pending(void);
+void     uart_baud_rx(uint8_t data);
+void     cmdUartBaud(cmd_args_t *args);
+void     cmdUartFlow(cmd_args_t *args);
+void     cmdUartStats(cmd_args_t *args);
+void     transmit_usart0(uint8_t byte);
+uint8_t  uart_tx_queue(uint8_t data, uint8_t policy);
+void     uart_set_tx_policy(uint8_t policy);
+uint8_t  uart_tx_free(void);
+uint16_t uart_tx_dropped(void);
+void     uart_flush(void);
+uint8_t  uart_rx_get(uint8_t *data);
+uint8_t  usart0_has_rx_data(void);
+uint8_t  receive_usart0(void);
+int      UartPutChar(char c, FILE* stream);
+int      UartGetChar(FILE* stream);
+
+#endif  // end __UART_H__